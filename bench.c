@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cwin.h"
+
+/*
+ * Measures the event queue hot path, alloc_event through cwin_poll_event, on
+ * the headless backend. Every pattern runs twice: once untimed per event for
+ * throughput, and once stamping each event on injection and delivery for
+ * latency. Events carry their sequence number in a coordinate, which indexes
+ * the injection timestamps.
+ *
+ * It also times cwin_framebuffer_convert on a full 4K frame in every format.
+ */
+
+#define BENCH_MAX_WINDOWS 512
+#define BENCH_CONVERT_WIDTH 3840
+#define BENCH_CONVERT_HEIGHT 2160
+#define BENCH_CONVERT_FRAMES 50
+
+enum bench_message {
+  BENCH_MESSAGE_MOTION,
+  BENCH_MESSAGE_RESIZE,
+};
+
+struct bench_pattern {
+  const char *name;
+  enum bench_message message;
+  int frames;
+  /* Messages injected per window per frame, before the queues are drained. */
+  int per_frame;
+  int queues;
+  int windows;
+};
+
+struct bench_result {
+  size_t events;
+  double seconds;
+  uint64_t p50_ns, p99_ns;
+  size_t peak_memory;
+};
+
+const struct bench_pattern bench_patterns[] = {
+  /* One event per frame, the common idle case. */
+  { "steady trickle", BENCH_MESSAGE_MOTION, 200000, 1, 1, 1 },
+  /* An 8 kHz mouse during 33 ms frames, which overflows the default queue. */
+  { "8 kHz pointer burst", BENCH_MESSAGE_MOTION, 2000, 267, 1, 1 },
+  /* Dragging a window edge. */
+  { "resize storm", BENCH_MESSAGE_RESIZE, 2000, 128, 1, 1 },
+  { "8 queues, 512 windows", BENCH_MESSAGE_MOTION, 1000, 1, 8,
+    BENCH_MAX_WINDOWS },
+};
+
+struct bench_format {
+  const char *name;
+  enum cwin_pixel_format format;
+  size_t pixel_size;
+};
+
+const struct bench_format bench_formats[] = {
+  { "RGBA8", CWIN_PIXEL_FORMAT_RGBA8, 4 },
+  { "RGBA8 premultiplied", CWIN_PIXEL_FORMAT_RGBA8_PREMULTIPLIED, 4 },
+  { "RGBA16F premultiplied", CWIN_PIXEL_FORMAT_RGBA16F_PREMULTIPLIED, 8 },
+  { "RGB565", CWIN_PIXEL_FORMAT_RGB565, 2 },
+};
+
+uint64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int bench_compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+void bench_inject(const struct bench_pattern *pattern,
+                  struct cwin_window *window, int seq)
+{
+  struct cwin_headless_message message = {
+    .window = window,
+  };
+
+  if (pattern->message == BENCH_MESSAGE_MOTION)
+  {
+    message.t = CWIN_HEADLESS_MESSAGE_POINTER_MOTION;
+    message.motion.x = seq;
+  } else
+  {
+    message.t = CWIN_HEADLESS_MESSAGE_RESIZE;
+    message.resize.width = seq;
+    message.resize.height = 1;
+  }
+
+  cwin_headless_inject(&message);
+}
+
+int bench_event_seq(const struct cwin_event *event)
+{
+  if (event->t == CWIN_EVENT_MOUSE)
+  {
+    return event->mouse.x;
+  }
+  return event->window.width;
+}
+
+enum cwin_error bench_run(const struct bench_pattern *pattern,
+                          struct bench_result *result)
+{
+  enum cwin_error err;
+  struct cwin_event_queue *queues[8];
+  struct cwin_window *windows[BENCH_MAX_WINDOWS];
+  struct cwin_event event;
+
+  size_t total = (size_t) pattern->frames * pattern->per_frame *
+    pattern->windows;
+  uint64_t *injected = malloc(total * sizeof(uint64_t));
+  uint64_t *latencies = malloc(total * sizeof(uint64_t));
+  if (injected == NULL || latencies == NULL)
+  {
+    free(injected);
+    free(latencies);
+    return CWIN_ERROR_OOM;
+  }
+
+  for (int i = 0; i < pattern->queues; i++)
+  {
+    err = cwin_create_event_queue(&queues[i]);
+    if (err)
+    {
+      return err;
+    }
+  }
+
+  for (int i = 0; i < pattern->windows; i++)
+  {
+    struct cwin_window_builder builder = {
+      .name = (const uint8_t *) "bench",
+      .queue = queues[i % pattern->queues],
+    };
+    err = cwin_create_window(&windows[i], &builder);
+    if (err)
+    {
+      return err;
+    }
+  }
+
+  /* Throughput. */
+  size_t delivered = 0;
+  int seq = 0;
+  uint64_t start = bench_now_ns();
+  for (int frame = 0; frame < pattern->frames; frame++)
+  {
+    for (int i = 0; i < pattern->per_frame; i++)
+    {
+      for (int w = 0; w < pattern->windows; w++)
+      {
+        bench_inject(pattern, windows[w], seq++);
+      }
+    }
+
+    for (int q = 0; q < pattern->queues; q++)
+    {
+      while (cwin_poll_event(queues[q], &event))
+      {
+        delivered++;
+      }
+    }
+  }
+  uint64_t end = bench_now_ns();
+
+  /* Latency, from injection to delivery. */
+  size_t measured = 0;
+  seq = 0;
+  for (int frame = 0; frame < pattern->frames; frame++)
+  {
+    for (int i = 0; i < pattern->per_frame; i++)
+    {
+      for (int w = 0; w < pattern->windows; w++)
+      {
+        injected[seq] = bench_now_ns();
+        bench_inject(pattern, windows[w], seq);
+        seq++;
+      }
+    }
+
+    for (int q = 0; q < pattern->queues; q++)
+    {
+      while (cwin_poll_event(queues[q], &event))
+      {
+        latencies[measured++] = bench_now_ns() -
+          injected[bench_event_seq(&event)];
+      }
+    }
+  }
+
+  qsort(latencies, measured, sizeof(uint64_t), bench_compare_u64);
+
+  result->events = delivered;
+  result->seconds = (end - start) / 1e9;
+  result->p50_ns = measured ? latencies[measured / 2] : 0;
+  result->p99_ns = measured ? latencies[measured * 99 / 100] : 0;
+  result->peak_memory = 0;
+  for (int q = 0; q < pattern->queues; q++)
+  {
+    size_t current, peak;
+    cwin_event_queue_get_memory(queues[q], &current, &peak);
+    result->peak_memory += peak;
+  }
+
+  for (int i = 0; i < pattern->windows; i++)
+  {
+    cwin_destroy_window(windows[i]);
+  }
+  for (int i = 0; i < pattern->queues; i++)
+  {
+    cwin_destroy_event_queue(queues[i]);
+  }
+  free(injected);
+  free(latencies);
+
+  return CWIN_SUCCESS;
+}
+
+/* Returns the average time to convert a frame, or 0 if out of memory. */
+double bench_convert(const struct bench_format *format)
+{
+  size_t pixels = (size_t) BENCH_CONVERT_WIDTH * BENCH_CONVERT_HEIGHT;
+  uint8_t *src = malloc(pixels * format->pixel_size);
+  uint32_t *dst = malloc(pixels * sizeof(uint32_t));
+  if (src == NULL || dst == NULL)
+  {
+    free(src);
+    free(dst);
+    return 0;
+  }
+
+  /* Any bytes are valid in every format, including half float NaNs. */
+  for (size_t i = 0; i < pixels * format->pixel_size; i++)
+  {
+    src[i] = (uint8_t) (i * 2654435761u >> 24);
+  }
+
+  struct cwin_framebuffer framebuffer = {
+    .pixels = dst,
+    .width = BENCH_CONVERT_WIDTH,
+    .height = BENCH_CONVERT_HEIGHT,
+    .stride = BENCH_CONVERT_WIDTH,
+  };
+  size_t src_stride = BENCH_CONVERT_WIDTH * format->pixel_size;
+
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < BENCH_CONVERT_FRAMES; i++)
+  {
+    cwin_framebuffer_convert(&framebuffer, src, src_stride, format->format,
+                             NULL, 0);
+  }
+  uint64_t end = bench_now_ns();
+
+  free(src);
+  free(dst);
+  return (end - start) / 1e9 / BENCH_CONVERT_FRAMES;
+}
+
+int main()
+{
+  enum cwin_error err;
+
+  err = cwin_init(NULL);
+  if (err)
+  {
+    printf("error: %d\n", err);
+    return EXIT_FAILURE;
+  }
+
+  printf("%-24s %10s %12s %8s %8s %8s %10s\n", "pattern", "events",
+         "events/s", "ns/ev", "p50 ns", "p99 ns", "peak KiB");
+
+  for (size_t i = 0; i < sizeof(bench_patterns) / sizeof(bench_patterns[0]);
+       i++)
+  {
+    struct bench_result result;
+    err = bench_run(&bench_patterns[i], &result);
+    if (err)
+    {
+      printf("error: %d\n", err);
+      return EXIT_FAILURE;
+    }
+
+    printf("%-24s %10zu %12.0f %8.1f %8llu %8llu %10.1f\n",
+           bench_patterns[i].name, result.events,
+           result.events / result.seconds,
+           result.seconds * 1e9 / result.events,
+           (unsigned long long) result.p50_ns,
+           (unsigned long long) result.p99_ns,
+           result.peak_memory / 1024.0);
+  }
+
+  printf("\n%-24s %10s %12s\n", "4K conversion", "ms/frame", "Mpixels/s");
+
+  for (size_t i = 0; i < sizeof(bench_formats) / sizeof(bench_formats[0]);
+       i++)
+  {
+    double seconds = bench_convert(&bench_formats[i]);
+    if (seconds == 0)
+    {
+      printf("error: %d\n", CWIN_ERROR_OOM);
+      return EXIT_FAILURE;
+    }
+
+    printf("%-24s %10.3f %12.0f\n", bench_formats[i].name, seconds * 1e3,
+           BENCH_CONVERT_WIDTH * BENCH_CONVERT_HEIGHT / seconds / 1e6);
+  }
+
+  cwin_deinit();
+  return EXIT_SUCCESS;
+}
@@ -1,33 +1,449 @@
 #include "cwin.h"
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define CWIN_NEW(type) ((type *) calloc(1, sizeof(type)))
-#define CWIN_ARR(type, len) ((type *) calloc((len), sizeof(type)))
-#define CWIN_FREE(type, ptr) free(ptr)
-#define CWIN_FREE_ARR(type, len, ptr) free(ptr)
-#define CWIN_REALLOC(type, old, new, ptr) ((type *) realloc(ptr, new *          \
-                                                            sizeof(type)))
+/* Conversion kernels. SSE2 is always there on x86-64, AVX2 is checked for at
+   runtime, and NEON is always there on AArch64. CWIN_NO_SIMD leaves only the
+   scalar kernels. */
+#ifndef CWIN_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define CONVERT_SSE2
+#define CONVERT_AVX2
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CONVERT_TARGET_AVX2
+#else
+#define CONVERT_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+#endif
+
+/* Everything goes through the allocator passed to cwin_init. New memory is
+   zeroed. */
+#define CWIN_NEW(type) ((type *) mem_alloc(1, sizeof(type), _Alignof(type)))
+#define CWIN_ARR(type, len) ((type *) mem_alloc((len), sizeof(type),           \
+                                                _Alignof(type)))
+#define CWIN_FREE(type, ptr) mem_free(ptr, sizeof(type))
+#define CWIN_FREE_ARR(type, len, ptr) mem_free(ptr, (len) * sizeof(type))
+#define CWIN_REALLOC(type, old, new, ptr) ((type *) mem_realloc(ptr, (old),    \
+                                                                (new),          \
+                                                                sizeof(type),   \
+                                                                _Alignof(type)))
 
-#define INIT_EVENT_QUEUE_EVENTS 32
+#define DEFAULT_EVENT_QUEUE_CAPACITY 256
+#define DEFAULT_MOUSE_HISTORY_CAPACITY 1024
+#define DEFAULT_USER_EVENT_CAPACITY 256
+#define COMMAND_CAPACITY 64
+#define DEFAULT_SCRATCH_SIZE 256
+#define DEFAULT_TEXT_CAPACITY 4096
+#define DEFAULT_FRAMEBUFFER_BUFFERS 2
+#define MAX_FRAMEBUFFER_BUFFERS 3
+#define PIXEL_FORMAT_COUNT 4
+#define RECORD_CHUNKS 4
+#define RECORD_CHUNK_SIZE 65536
+/* A chunk that isn't full is still written once it's this old. */
+#define RECORD_FLUSH_NS 100000000
+/* The longest record, apart from the bytes of a text event. */
+#define RECORD_MAX_SIZE 64
+/* The length of the chunk that tells the writer to stop. */
+#define RECORD_END SIZE_MAX
+
+/* Platform timestamps older than this are assumed to be on another clock. */
+#define MAX_EVENT_AGE_MS 10000
+
+/*
+ * Stats are only written by the event thread. Relaxed atomic loads and
+ * stores compile to plain moves, and let other threads read the counters
+ * without locks or torn values. Without CWIN_STATS these expand to nothing.
+ */
+#ifdef CWIN_STATS
+#define STAT_ADD(counter, n)                                                    \
+  atomic_store_explicit(&(counter),                                             \
+                        atomic_load_explicit(&(counter),                        \
+                                             memory_order_relaxed) + (n),       \
+                        memory_order_relaxed)
+/* Times a zone, adding its duration to counter. Once per scope. */
+#define STATS_BEGIN(zone) uint64_t stats_start_ns = stats_begin(zone)
+#define STATS_END(counter) stats_end(&(counter), stats_start_ns)
+#else
+#define STAT_ADD(counter, n) ((void) 0)
+#define STATS_BEGIN(zone) ((void) 0)
+#define STATS_END(counter) ((void) 0)
+#endif
 
 #if !defined(CWIN_BACKEND_WIN32) && !defined(CWIN_BACKEND_WL) &&                \
+    !defined(CWIN_BACKEND_X11) && !defined(CWIN_BACKEND_HEADLESS) &&            \
     !defined(CWIN_BACKEND_MACOS)
 #error One CWin backend must be defined
 #endif
 
+/*
+ * Events are stored in a fixed-capacity power-of-two ring. head and tail are
+ * free running, so the number of pending events is always tail - head and a
+ * slot is found by masking. Nothing is moved or reallocated when events are
+ * pushed or popped.
+ *
+ * With CWIN_QUEUE_OVERFLOW_GROW, events that don't fit in the ring are
+ * appended to a single spill segment of the same capacity. While the spill
+ * segment exists every new event goes there, so FIFO order is kept, and it is
+ * freed as soon as it has been drained, so a burst of input doesn't leave a
+ * permanently oversized queue behind.
+ *
+ * cwin_borrow_events lends out the front of the ring (or the spill segment)
+ * directly. lent is the length of that span, and until it is committed those
+ * slots are never overwritten.
+ *
+ * When coalescing, a mouse move replaces the previous event if that is a
+ * pending move for the same window, and the replaced position is appended to
+ * the history ring. Since only the newest event is ever merged into, the
+ * samples of one event are always contiguous in the history, and the event
+ * records where they start. The history overwrites its oldest samples when
+ * full; history_tail is free running so stale ranges can be detected.
+ *
+ * User events are posted from any thread into a separate bounded ring, which
+ * only the event thread drains into the ring above. It is Dmitry Vyukov's
+ * bounded MPMC queue with a single consumer: every slot has a sequence number
+ * saying whose turn it is. A producer claims position p by moving user_tail
+ * from p to p + 1 once slot p's sequence is p, writes the payload, then
+ * publishes it by setting the sequence to p + 1. The consumer takes the slot
+ * when its sequence is user_head + 1 and hands it back to the producers of
+ * the next lap by setting it to user_head + capacity. Neither side ever
+ * blocks on the other.
+ *
+ * The text of text events is appended to a fixed arena, and the events point
+ * into it. The arena is recycled once the queue has been emptied and events
+ * are retrieved again, since by then the application is done with the text
+ * of everything it was given.
+ */
+struct cwin_user_slot {
+  atomic_size_t seq;
+  struct cwin_user_event payload;
+  uint64_t time_ns;
+};
+
+#ifdef CWIN_STATS
+struct queue_stats {
+  atomic_uint_least64_t enqueued[CWIN_EVENT_TYPE_COUNT];
+  atomic_uint_least64_t dropped[CWIN_EVENT_TYPE_COUNT];
+  atomic_uint_least64_t coalesced[CWIN_EVENT_TYPE_COUNT];
+  atomic_size_t high_water;
+  atomic_uint_least64_t allocations;
+};
+
+struct {
+  atomic_uint_least64_t pumps, pump_ns;
+  atomic_uint_least64_t waits, wait_ns;
+  atomic_uint_least64_t translate_ns;
+} stats;
+
+struct cwin_trace_hooks trace_hooks;
+#endif
+
 struct cwin_event_queue {
   struct cwin_event *events;
-  size_t events_alloc, events_left;
+  size_t mask; /* Capacity - 1. */
+  size_t head, tail;
+  enum cwin_queue_overflow overflow;
+
+  struct cwin_event *spill;
+  size_t spill_head, spill_tail;
+
+  size_t lent;
+
+  uint32_t coalesce;
+  uint32_t event_mask;
+  struct cwin_mouse_sample *history;
+  size_t history_mask, history_tail;
+
+  /* Bytes allocated for the queue, now and at most. */
+  size_t memory, peak_memory;
+
+  struct cwin_user_slot *user_slots;
+  size_t user_mask;
+  size_t user_head; /* Only touched by the event thread. */
+  atomic_size_t user_tail;
+
+  char *text;
+  size_t text_capacity, text_used;
+
+  struct recorder *recorder; /* NULL unless recording. */
+  bool replaying; /* Live events are dropped while set. */
+
+#ifdef CWIN_STATS
+  struct queue_stats stats;
+#endif
 };
 
+struct cwin_allocator allocator;
+
+/*
+ * Reused for short-lived conversions, like window titles, so they don't
+ * allocate every time. It only grows when a request doesn't fit, and holds a
+ * single allocation at a time.
+ */
+struct {
+  void *data;
+  size_t size;
+} scratch;
+
 struct cwin_event_queue *global_queue;
 
+/* The enum cwin_event_mask bit of each event type, 0 for events that can't
+   be masked. */
+const uint32_t window_event_masks[] = {
+  [CWIN_WINDOW_EVENT_RESIZE] = CWIN_EVENT_MASK_RESIZE,
+  [CWIN_WINDOW_EVENT_CLOSE] = CWIN_EVENT_MASK_CLOSE,
+  [CWIN_WINDOW_EVENT_FOCUS] = CWIN_EVENT_MASK_FOCUS,
+  [CWIN_WINDOW_EVENT_UNFOCUS] = CWIN_EVENT_MASK_FOCUS,
+  [CWIN_WINDOW_EVENT_ENTER] = CWIN_EVENT_MASK_CROSSING,
+  [CWIN_WINDOW_EVENT_EXIT] = CWIN_EVENT_MASK_CROSSING,
+  [CWIN_WINDOW_EVENT_FRAME] = 0,
+  [CWIN_WINDOW_EVENT_SCALE_CHANGED] = CWIN_EVENT_MASK_RESIZE,
+};
+const uint32_t mouse_event_masks[] = {
+  [CWIN_MOUSE_EVENT_MOVE] = CWIN_EVENT_MASK_MOUSE_MOVE,
+  [CWIN_MOUSE_EVENT_BUTTON] = CWIN_EVENT_MASK_MOUSE_BUTTON,
+  [CWIN_MOUSE_EVENT_WHEEL] = CWIN_EVENT_MASK_MOUSE_WHEEL,
+  [CWIN_MOUSE_EVENT_RELATIVE] = CWIN_EVENT_MASK_MOUSE_RELATIVE,
+};
+
+/*
+ * Timers are kept in a binary min-heap ordered by deadline, so the earliest
+ * one is at the root and arming, firing and destroying one are O(log n). The
+ * platform has a single timer, set to the root's deadline, which wakes up
+ * waits and the event fd. The heap always has room for every timer, so
+ * rearming never allocates.
+ */
+#define TIMER_DISARMED SIZE_MAX
+
+struct cwin_timer {
+  struct cwin_event_queue *queue;
+  uint64_t deadline_ns;
+  uint64_t interval_ns;
+  bool oneshot;
+  size_t heap_index; /* TIMER_DISARMED when not in the heap. */
+  /* Every timer, armed or not, so cwin_deinit can free them. */
+  struct cwin_timer *prev, *next;
+};
+
+struct {
+  struct cwin_timer **heap;
+  size_t len, capacity;
+  size_t count; /* Timers that exist. */
+  struct cwin_timer *all;
+  uint64_t armed_ns; /* The platform timer's deadline, or 0. */
+} timers;
+
+/*
+ * Set while the event thread is about to sleep or sleeping for platform
+ * input, so posting a user event only makes a wakeup syscall when it's
+ * needed.
+ */
+atomic_bool event_thread_waiting;
+
+/*
+ * Stamped on every event allocated while translating the current platform
+ * message. Backends set it to the message's own timestamp when the platform
+ * provides one, otherwise to the time it was read.
+ */
+uint64_t message_time_ns;
+
+/*
+ * A window's framebuffer. Buffers are created by the backend when they are
+ * first needed, which sets pixels, and all of them are the framebuffer's
+ * size. busy is set while the windowing system may still read a buffer.
+ * presents counts the presents so far, and a buffer's presented is the count
+ * it was last presented at, or 0, which gives the age of its contents.
+ */
+struct framebuffer_buffer {
+  uint32_t *pixels;
+  bool busy;
+  uint64_t presented;
+};
+
+struct framebuffer {
+  int buffer_count; /* 0 without a framebuffer. */
+  int width, height;
+  int acquired; /* -1 if no buffer is acquired. */
+  uint64_t presents;
+  struct framebuffer_buffer buffers[MAX_FRAMEBUFFER_BUFFERS];
+};
+
+/*
+ * Maps native handles to windows, for backends whose events only carry a
+ * handle. It is an open addressing table with linear probing, kept at most
+ * half full. Removal shifts the following entries back instead of leaving
+ * tombstones, so lookups stay short however windows come and go. Empty slots
+ * have a NULL window.
+ */
+struct window_map_slot {
+  uintptr_t handle;
+  struct cwin_window *window;
+};
+
+struct window_map {
+  struct window_map_slot *slots;
+  size_t mask; /* Capacity - 1, or 0 before the first insert. */
+  size_t len;
+};
+
+/* Windows by id, for replaying, and by address, to check that the window of
+   an event being recorded still exists. */
+struct window_map window_ids;
+struct window_map live_windows;
+uint32_t next_window_id;
+
+/*
+ * A log starts with RECORD_MAGIC, followed by a record per event:
+ *
+ *   type     varint, enum cwin_event_type << 4 | the window or mouse event
+ *            type
+ *   time     zigzag varint, time_ns minus the previous record's
+ *   window   varint, the window's id, or 0 for events without one
+ *
+ * and then the payload. Sizes, wheel deltas and frame times, the latter
+ * relative to time_ns, are zigzag varints. Mouse positions are zigzag deltas
+ * from the previous position in the log, and relative motion is two floats in
+ * memory order. Keys are state | repeat << 1, the scancode, key and modifiers
+ * as varints. Text is its length as a varint and its bytes. User events keep
+ * their code and timer events their expirations.
+ *
+ * Records are encoded into a ring of RECORD_CHUNKS chunks on the event
+ * thread, and a full chunk is handed to a thread that writes it. filled and
+ * written count the chunks handed over and written, so the writer sleeps
+ * while they are equal and the event thread only sleeps while every chunk is
+ * waiting to be written.
+ */
+#define RECORD_MAGIC "CWINLOG\1"
+#define RECORD_MAGIC_SIZE 8
+
+/* A thread started by the platform, which calls run(arg). */
+struct thread {
+  void (*run)(void *arg);
+  void *arg;
+  uintptr_t handle;
+};
+
+/* The delta state shared by encoding and decoding. */
+struct log_state {
+  uint64_t time_ns;
+  int x, y;
+};
+
+struct recorder {
+  FILE *file;
+  struct thread thread;
+  uint8_t *chunks;
+  size_t chunk_size;
+  size_t lens[RECORD_CHUNKS];
+  size_t used; /* In the chunk being filled. */
+  uint64_t chunk_start_ns;
+  atomic_uint filled, written;
+  bool failed; /* Set by the writer, read after it is joined. */
+  struct log_state state;
+};
+
+struct log_cursor {
+  const uint8_t *next, *end;
+  struct log_state state;
+};
+
+/*
+ * The log being replayed is read into memory whole, so replaying does no
+ * IO. next is decoded ahead, to know when it is due.
+ */
+struct {
+  struct cwin_event_queue *queue; /* NULL unless replaying. */
+  bool real_time;
+  bool feeding; /* Lets alloc_event accept the replayed events. */
+  uint8_t *log;
+  size_t size;
+  struct log_cursor cursor;
+  struct cwin_event next;
+  uint64_t next_window;
+  bool has_next;
+  uint64_t offset_ns; /* Added to the recorded times. */
+} replay;
+
+/* Converts count pixels of a row, indexed by enum cwin_pixel_format. */
+void (*convert_rows[PIXEL_FORMAT_COUNT])(uint32_t *dst, const uint8_t *src,
+                                         size_t count);
+
+/*
+ * The window state other threads may read, as a seqlock. Only the event
+ * thread writes it: seq turns odd, the fields are stored, and seq turns even
+ * again. A reader copies the fields between two loads of seq and retries if
+ * they differ or are odd. The fields are relaxed atomics, so a read that
+ * races with a write is discarded instead of being undefined, and on every
+ * supported platform they are plain loads and stores. The scale is stored as
+ * its bits.
+ */
+struct window_snapshot {
+  atomic_uint seq;
+  atomic_int width, height;
+  atomic_int screen_width, screen_height;
+  atomic_uint scale_bits;
+  atomic_int screen_state;
+};
+
+/*
+ * State changes made off the event thread wait here until it pumps events.
+ * It is the same queue as the user events, shared by every window. A command
+ * for a window is drained before the window is destroyed. Producers that find
+ * it full wake the event thread and sleep on drained until it moves on.
+ */
+enum command_type {
+  COMMAND_SCREEN_STATE,
+  COMMAND_FULLSCREEN,
+  COMMAND_MINIMUM_SIZE,
+  COMMAND_MAXIMUM_SIZE,
+};
+
+struct command {
+  enum command_type t;
+  struct cwin_window *window;
+  union {
+    enum cwin_screen_state screen_state;
+    struct {
+      uint64_t monitor;
+      bool has_mode;
+      struct cwin_monitor_mode mode;
+    } fullscreen;
+    struct {
+      int width, height;
+    } size;
+  };
+};
+
+struct command_slot {
+  atomic_size_t seq;
+  struct command command;
+};
+
+struct {
+  struct command_slot *slots; /* COMMAND_CAPACITY of them. */
+  size_t head; /* Only touched by the event thread. */
+  atomic_size_t tail;
+  atomic_uint drained; /* Counts drains that freed slots. */
+} commands;
+
 #define CWIN_WINDOW_TYPE(__platform_type)                                       \
   struct cwin_window {                                                          \
     __platform_type plat;                                                       \
     struct cwin_event_queue *queue;                                             \
+    uint32_t coalesce;                                                          \
+    uint32_t event_mask; /* Already limited by the queue's. */                  \
+    uint32_t id; /* Counts up from 1 since cwin_init. */                        \
+    struct framebuffer framebuffer;                                             \
+    struct window_snapshot snapshot;                                            \
   }
 
 /* PLATFORM PROTOTYPES */
@@ -37,19 +453,205 @@ void cwin_plat_deinit_window(struct cwin_window *window);
 enum cwin_error cwin_plat_init(void);
 void cwin_plat_deinit(void);
 enum cwin_error cwin_plat_pump_events(void);
+/* Sleeps until the platform has input or timeout_ns passes, then pumps. */
+enum cwin_error cwin_plat_wait_events(uint64_t timeout_ns);
+/* A monotonic clock in nanoseconds. */
+uint64_t cwin_plat_now_ns(void);
+/* Makes cwin_plat_wait_events return early. Called from any thread. */
+void cwin_plat_wake(void);
+/* Consumes a pending wakeup, so the event fd stops being readable. */
+void cwin_plat_clear_wake(void);
+/* Makes waits and the event fd wake up at deadline_ns, or disarms the timer
+   if it is 0. Setting it also consumes an earlier expiration. */
+void cwin_plat_set_timer(uint64_t deadline_ns);
+/* A fd that is readable while the platform has input or a wakeup is pending,
+   or -1. */
+int cwin_plat_get_event_fd(void);
 void cwin_plat_get_raw_window(struct cwin_window *window,
                               struct cwin_raw_window *raw);
+/* Reads the window's current state, on the event thread. */
+void cwin_plat_get_state(struct cwin_window *window,
+                         struct cwin_window_state *state);
+bool cwin_plat_is_event_thread(void);
+/* The state changes behind the public functions of the same name, run on the
+   event thread. */
+void cwin_plat_set_screen_state(struct cwin_window *window,
+                                enum cwin_screen_state state);
+enum cwin_error cwin_plat_set_fullscreen(
+  struct cwin_window *window, uint64_t monitor,
+  const struct cwin_monitor_mode *mode);
+void cwin_plat_set_minimum_size(struct cwin_window *window,
+                                int min_width, int min_height);
+void cwin_plat_set_maximum_size(struct cwin_window *window,
+                                int max_width, int max_height);
+/* Subscribes to the platform input window->event_mask needs, after it
+   changed. */
+void cwin_plat_set_event_mask(struct cwin_window *window);
+/* Starts thread->run on a new thread. thread stays valid until joined. */
+enum cwin_error cwin_plat_start_thread(struct thread *thread);
+void cwin_plat_join_thread(struct thread *thread);
+/* Sleeps while *address is value, until woken. May return spuriously. */
+void cwin_plat_wait_on_address(atomic_uint *address, unsigned value);
+/* Wakes every thread sleeping on address. */
+void cwin_plat_wake_address(atomic_uint *address);
+/* Creates the framebuffer buffer at index, at the framebuffer's size. */
+enum cwin_error cwin_plat_create_buffer(struct cwin_window *window, int index);
+void cwin_plat_destroy_buffer(struct cwin_window *window, int index);
+/* Waits for platform input once, which may release a busy buffer. */
+enum cwin_error cwin_plat_wait_buffer(struct cwin_window *window);
+/* The damage is inside the buffer, and there is at least one rectangle. */
+enum cwin_error cwin_plat_present_buffer(struct cwin_window *window,
+                                         int index,
+                                         const struct cwin_rect *damage,
+                                         size_t damage_count);
 
 /* REGULAR PROTOTYPES */
 
+void *mem_alloc(size_t len, size_t size, size_t align);
+void *mem_realloc(void *ptr, size_t old_len, size_t new_len, size_t size,
+                  size_t align);
+void mem_free(void *ptr, size_t size);
+void *scratch_reserve(size_t size);
+
 struct cwin_event *alloc_event(struct cwin_event_queue *queue,
                                enum cwin_event_type type);
+struct cwin_event *alloc_overflow_event(struct cwin_event_queue *queue);
+bool event_queue_is_empty(struct cwin_event_queue *queue);
+bool pop_event(struct cwin_event_queue *queue, struct cwin_event *event);
+size_t pop_events(struct cwin_event_queue *queue, struct cwin_event *events,
+                  size_t capacity);
+size_t front_events(struct cwin_event_queue *queue,
+                    struct cwin_event **events);
+void drop_front_events(struct cwin_event_queue *queue, size_t count);
+struct cwin_event *last_pending_event(struct cwin_event_queue *queue);
+void track_queue_memory(struct cwin_event_queue *queue, size_t allocated,
+                        size_t freed);
+uint64_t event_time_from_ms(uint32_t time_ms, uint32_t now_ms,
+                            uint64_t now_ns);
+struct cwin_event *coalesce_mouse_move(struct cwin_event_queue *queue,
+                                       struct cwin_window *window);
+bool window_wants(struct cwin_window *window, uint32_t events);
 struct cwin_event *alloc_window_event(struct cwin_event_queue *queue,
                                       enum cwin_window_event_type type,
                                       struct cwin_window *window);
+struct cwin_event *alloc_frame_event(struct cwin_event_queue *queue,
+                                     struct cwin_window *window,
+                                     uint64_t presented_ns,
+                                     uint64_t vblank_ns, uint64_t refresh_ns);
+uint64_t predict_vblank(uint64_t vblank_ns, uint64_t refresh_ns,
+                        uint64_t now_ns);
+struct cwin_event *alloc_scale_event(struct cwin_event_queue *queue,
+                                     struct cwin_window *window, float scale);
+int scale_round(float value);
+int compare_modes(const void *a, const void *b);
+size_t normalize_modes(struct cwin_monitor_mode *modes, size_t count);
+int pick_mode(const struct cwin_monitor_mode *modes, size_t count,
+              const struct cwin_monitor_mode *wanted);
+void copy_monitor_name(char *name, const char *src, size_t len);
+void copy_list(void *out, int *count, const void *items, size_t len,
+               size_t size);
 struct cwin_event *alloc_mouse_event(struct cwin_event_queue *queue,
                                       enum cwin_mouse_event_type type,
                                       struct cwin_window *window);
+struct cwin_event *alloc_key_event(struct cwin_event_queue *queue,
+                                   enum cwin_button_state state,
+                                   struct cwin_window *window);
+struct cwin_event *alloc_text_event(struct cwin_event_queue *queue,
+                                    struct cwin_window *window,
+                                    const char *text, size_t len);
+void recycle_text(struct cwin_event_queue *queue);
+size_t encode_utf8(uint32_t c, char *out);
+void framebuffer_destroy_buffers(struct cwin_window *window);
+enum cwin_error framebuffer_pick_buffer(struct cwin_window *window,
+                                        int *index);
+bool clip_rect(const struct cwin_rect *rect, int width, int height,
+               struct cwin_rect *clipped);
+uint32_t convert_div255(uint32_t t);
+float convert_half_to_float(uint16_t half);
+uint32_t convert_float_to_unorm8(float value);
+void convert_rgba8_scalar(uint32_t *dst, const uint8_t *src, size_t count);
+void convert_rgba8_premultiplied_scalar(uint32_t *dst, const uint8_t *src,
+                                        size_t count);
+void convert_rgba16f_premultiplied_scalar(uint32_t *dst, const uint8_t *src,
+                                          size_t count);
+void convert_rgb565_scalar(uint32_t *dst, const uint8_t *src, size_t count);
+#ifdef CONVERT_SSE2
+__m128i convert_swap_rb_sse2(__m128i pixels);
+__m128i convert_premultiply_sse2(__m128i pixels);
+void convert_rgba8_sse2(uint32_t *dst, const uint8_t *src, size_t count);
+void convert_rgba8_premultiplied_sse2(uint32_t *dst, const uint8_t *src,
+                                      size_t count);
+void convert_rgb565_sse2(uint32_t *dst, const uint8_t *src, size_t count);
+#endif
+#ifdef CONVERT_AVX2
+CONVERT_TARGET_AVX2 __m256i convert_swap_rb_avx2(__m256i pixels);
+CONVERT_TARGET_AVX2 __m256i convert_premultiply_avx2(__m256i pixels);
+CONVERT_TARGET_AVX2 void convert_rgba8_avx2(uint32_t *dst, const uint8_t *src,
+                                            size_t count);
+CONVERT_TARGET_AVX2 void convert_rgba8_premultiplied_avx2(uint32_t *dst,
+                                                          const uint8_t *src,
+                                                          size_t count);
+CONVERT_TARGET_AVX2 void convert_rgba16f_premultiplied_avx2(uint32_t *dst,
+                                                            const uint8_t *src,
+                                                            size_t count);
+CONVERT_TARGET_AVX2 void convert_rgb565_avx2(uint32_t *dst, const uint8_t *src,
+                                             size_t count);
+bool convert_cpu_has_avx2(void);
+#endif
+#ifdef CONVERT_NEON
+void convert_rgba8_neon(uint32_t *dst, const uint8_t *src, size_t count);
+void convert_rgba8_premultiplied_neon(uint32_t *dst, const uint8_t *src,
+                                      size_t count);
+void convert_rgba16f_premultiplied_neon(uint32_t *dst, const uint8_t *src,
+                                        size_t count);
+void convert_rgb565_neon(uint32_t *dst, const uint8_t *src, size_t count);
+#endif
+void convert_init(void);
+void timer_sift_up(size_t index);
+void timer_sift_down(size_t index);
+void timer_insert(struct cwin_timer *timer);
+void timer_remove(struct cwin_timer *timer);
+void timer_update_platform(void);
+void fire_timers(void);
+enum cwin_error pump_events(void);
+enum cwin_error wait_events(uint64_t timeout_ns);
+size_t window_map_home(const struct window_map *map, uintptr_t handle);
+enum cwin_error window_map_insert(struct window_map *map, uintptr_t handle,
+                                  struct cwin_window *window);
+struct cwin_window *window_map_find(const struct window_map *map,
+                                    uintptr_t handle);
+void window_map_remove(struct window_map *map, uintptr_t handle);
+void window_map_free(struct window_map *map);
+struct cwin_window *event_window(const struct cwin_event *event);
+uint8_t *log_put_varint(uint8_t *out, uint64_t value);
+uint8_t *log_put_signed(uint8_t *out, int64_t value);
+bool log_get_varint(struct log_cursor *cursor, uint64_t *value);
+bool log_get_signed(struct log_cursor *cursor, int64_t *value);
+uint8_t *log_encode(struct log_state *state, const struct cwin_event *event,
+                    uint32_t window_id, uint8_t *out);
+bool log_decode(struct log_cursor *cursor, struct cwin_event *event,
+                uint64_t *window_id);
+void record_write(void *arg);
+void record_hand_off(struct recorder *recorder);
+void record_events(struct recorder *recorder, const struct cwin_event *events,
+                   size_t count);
+void replay_shift(uint64_t offset_ns);
+void replay_advance(void);
+void replay_deliver(void);
+void replay_feed(void);
+#ifdef CWIN_STATS
+uint64_t stats_begin(const char *zone);
+void stats_end(atomic_uint_least64_t *total_ns, uint64_t start_ns);
+void stats_enqueued(struct cwin_event_queue *queue,
+                    enum cwin_event_type type);
+#endif
+bool user_events_pending(struct cwin_event_queue *queue);
+void drain_user_events(struct cwin_event_queue *queue);
+void publish_window_state(struct cwin_window *window);
+void push_command(const struct command *command);
+bool commands_pending(void);
+void drain_commands(void);
+void run_command(const struct command *command);
 
 #ifdef CWIN_BACKEND_WIN32
 
@@ -59,24 +661,69 @@ struct cwin_event *alloc_mouse_event(struct cwin_event_queue *queue,
 #endif
 
 #include <windows.h>
+#include <dwmapi.h>
+#include <shellscalingapi.h>
+
+/* Older SDKs don't have it. */
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+/* The frame interval when DWM has no timing, 60 Hz. */
+#define WIN32_FALLBACK_REFRESH_NS 16666667
 
 /* TYPES */
 
 struct cwin_win32_window {
   HWND handle;
+  UINT dpi; /* USER_DEFAULT_SCREEN_DPI is a scale of 1. */
   bool is_tracked;
   enum cwin_screen_state screen_state;
   WINDOWPLACEMENT prev_placement; /* Window placement before fullscreen. */
   bool has_minimum, has_maximum;
   int min_width, min_height;
   int max_width, max_height;
+  /* WM_CHAR sends UTF-16 code units, so characters outside the BMP arrive
+     as two messages. */
+  WCHAR high_surrogate;
+  bool is_relative;
+  /* DIB sections, which GDI blits from without a conversion. */
+  HBITMAP buffers[MAX_FRAMEBUFFER_BUFFERS];
+  int shown_buffer; /* Repainted on WM_PAINT, or -1. */
+  bool wants_frame;
+  struct cwin_window *next_frame; /* In win32.frame_windows. */
+  /* The display mode cwin_window_set_fullscreen switched to. The desktop's
+     mode is put back while the window is inactive. */
+  bool has_mode, mode_active;
+  HMONITOR mode_monitor;
+  WCHAR mode_device[CCHDEVICENAME];
+  DEVMODEW mode;
 };
 
 CWIN_WINDOW_TYPE(struct cwin_win32_window);
 
+/* Collects monitors for cwin_get_monitors, counting all of them. */
+struct win32_monitor_list {
+  struct cwin_monitor *monitors;
+  int capacity, len;
+};
+
 struct {
   HINSTANCE instance;
   ATOM window_class;
+  LARGE_INTEGER qpc_frequency;
+  DWORD thread_id; /* The event thread, which called cwin_init. */
+
+  /*
+   * DWM composes every window at each vblank, so all frame requests wait
+   * for the same one. frame_timer is a manual reset timer set to it, which
+   * stays signaled until the frames are sent.
+   */
+  struct cwin_window *frame_windows;
+  HANDLE frame_timer;
+  uint64_t frame_deadline_ns;
+  /* Auto reset, set to the earliest cwin timer's deadline. */
+  HANDLE timer;
 } win32;
 
 /* CONSTANTS */
@@ -89,55 +736,205 @@ LRESULT CALLBACK cwin_win32_window_proc(HWND hwnd, UINT umsg, WPARAM wparam,
                                         LPARAM lparam);
 enum cwin_error utf8_to_wide_string(WCHAR **str_out, int *len_out,
                                     const uint8_t *src, size_t src_len);
+uint64_t win32_message_time(UINT umsg);
+uint32_t win32_key(WPARAM vk, uint32_t scancode);
+uint32_t win32_modifiers(void);
+void win32_clip_cursor(struct cwin_window *window);
+void win32_blit_buffer(struct cwin_window *window, HDC dc, int index,
+                       const struct cwin_rect *rects, size_t rect_count);
+uint64_t win32_qpc_to_ns(uint64_t counter);
+bool win32_frame_timing(uint64_t *vblank_ns, uint64_t *refresh_ns);
+void win32_send_frames(void);
+DWORD WINAPI win32_thread_main(LPVOID arg);
+BOOL CALLBACK win32_monitor_proc(HMONITOR monitor, HDC dc, LPRECT rect,
+                                 LPARAM data);
+void win32_fill_monitor(HMONITOR monitor, const MONITORINFOEXW *info,
+                        struct cwin_monitor *out);
+size_t win32_list_modes(const WCHAR *device,
+                        struct cwin_monitor_mode **modes);
+bool win32_apply_mode(struct cwin_window *window);
+void win32_restore_mode(struct cwin_window *window);
+void win32_cover_monitor(struct cwin_window *window, HMONITOR monitor,
+                         HWND insert_after);
 
 /* PLATFORM FUNCTIONS */
 
-void cwin_window_get_size_pixels(struct cwin_window *window,
-                                 int *width, int *height)
+/* The process is per monitor DPI aware, so client rectangles are in
+   pixels. */
+void cwin_plat_get_state(struct cwin_window *window,
+                         struct cwin_window_state *state)
 {
   RECT rect;
   GetClientRect(window->plat.handle, &rect);
 
-  if (width != NULL)
+  state->width = rect.right;
+  state->height = rect.bottom;
+  state->screen_width = MulDiv(rect.right, USER_DEFAULT_SCREEN_DPI,
+                               window->plat.dpi);
+  state->screen_height = MulDiv(rect.bottom, USER_DEFAULT_SCREEN_DPI,
+                                window->plat.dpi);
+  state->scale = (float) window->plat.dpi / USER_DEFAULT_SCREEN_DPI;
+  state->screen_state = window->plat.screen_state;
+}
+
+enum cwin_error cwin_plat_pump_events(void)
+{
+  MSG msg;
+  STATS_BEGIN("cwin translate");
+  while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
   {
-    *width = rect.right;
+    TranslateMessage(&msg);
+    DispatchMessage(&msg);
   }
-  if (height != NULL)
+  STATS_END(stats.translate_ns);
+
+  win32_send_frames();
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_plat_wait_events(uint64_t timeout_ns)
+{
+  DWORD timeout = INFINITE;
+  if (timeout_ns != CWIN_WAIT_FOREVER)
   {
-    *height = rect.bottom;
+    /* Round up, waking before the deadline would just spin. */
+    uint64_t ms = (timeout_ns + 999999) / 1000000;
+    timeout = ms >= INFINITE ? INFINITE - 1 : (DWORD) ms;
   }
+
+  /*
+   * MWMO_INPUTAVAILABLE also returns for messages that were already in the
+   * queue but have been seen by an earlier PeekMessage.
+   */
+  HANDLE handles[] = { win32.timer, win32.frame_timer };
+  DWORD handle_count = win32.frame_windows != NULL ? 2 : 1;
+  MsgWaitForMultipleObjectsEx(handle_count, handles, timeout, QS_ALLINPUT,
+                              MWMO_INPUTAVAILABLE);
+  return cwin_plat_pump_events();
 }
 
-void cwin_window_get_size_screen_coordinates(struct cwin_window *window,
-                                             int *width, int *height)
+uint64_t cwin_plat_now_ns(void)
 {
-  RECT rect;
-  GetClientRect(window->plat.handle, &rect);
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return win32_qpc_to_ns(counter.QuadPart);
+}
 
-  if (width != NULL)
-  {
-    *width = rect.right;
-  }
-  if (height != NULL)
+/* The posted message is retrieved and ignored by cwin_plat_pump_events. */
+void cwin_plat_wake(void)
+{
+  PostThreadMessage(win32.thread_id, WM_NULL, 0, 0);
+}
+
+void cwin_plat_clear_wake(void)
+{
+}
+
+bool cwin_plat_is_event_thread(void)
+{
+  return GetCurrentThreadId() == win32.thread_id;
+}
+
+DWORD WINAPI win32_thread_main(LPVOID arg)
+{
+  struct thread *thread = arg;
+  thread->run(thread->arg);
+  return 0;
+}
+
+enum cwin_error cwin_plat_start_thread(struct thread *thread)
+{
+  HANDLE handle = CreateThread(NULL, 0, win32_thread_main, thread, 0, NULL);
+  if (handle == NULL)
   {
-    *height = rect.bottom;
+    return CWIN_ERROR_WIN32_INTERNAL;
   }
+
+  thread->handle = (uintptr_t) handle;
+  return CWIN_SUCCESS;
 }
 
-enum cwin_error cwin_plat_pump_events(void)
+void cwin_plat_join_thread(struct thread *thread)
 {
-  MSG msg;
-  while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+  WaitForSingleObject((HANDLE) thread->handle, INFINITE);
+  CloseHandle((HANDLE) thread->handle);
+}
+
+void cwin_plat_wait_on_address(atomic_uint *address, unsigned value)
+{
+  WaitOnAddress((volatile VOID *) address, &value, sizeof(value), INFINITE);
+}
+
+void cwin_plat_wake_address(atomic_uint *address)
+{
+  WakeByAddressAll((PVOID) address);
+}
+
+/* Due times are relative, in 100 ns units, so they follow QPC. */
+void cwin_plat_set_timer(uint64_t deadline_ns)
+{
+  if (deadline_ns == 0)
   {
-    TranslateMessage(&msg);
-    DispatchMessage(&msg);
+    CancelWaitableTimer(win32.timer);
+    return;
   }
-  return CWIN_SUCCESS;
+
+  uint64_t now = cwin_plat_now_ns();
+  uint64_t wait = deadline_ns > now ? deadline_ns - now : 0;
+  LARGE_INTEGER due = {
+    .QuadPart = -(LONGLONG) ((wait + 99) / 100),
+  };
+  SetWaitableTimer(win32.timer, &due, 0, NULL, NULL, FALSE);
+}
+
+/* Window messages can't be waited on through a file descriptor. */
+int cwin_plat_get_event_fd(void)
+{
+  return -1;
 }
 
 enum cwin_error cwin_plat_init(void)
 {
   win32.instance = GetModuleHandle(NULL);
+  QueryPerformanceFrequency(&win32.qpc_frequency);
+  win32.thread_id = GetCurrentThreadId();
+
+  /*
+   * Without DPI awareness, Windows renders the window at 96 DPI and scales
+   * it up, blurring it. Per monitor v2 also scales the frame and sends
+   * WM_DPICHANGED. This fails if a manifest already set the awareness,
+   * which is left alone.
+   */
+  SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
+
+  /* High resolution timers are new in Windows 10 1803. */
+  win32.frame_windows = NULL;
+  win32.frame_timer =
+    CreateWaitableTimerExW(NULL, NULL,
+                           CREATE_WAITABLE_TIMER_MANUAL_RESET |
+                           CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                           TIMER_ALL_ACCESS);
+  if (win32.frame_timer == NULL)
+  {
+    win32.frame_timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+  }
+  if (win32.frame_timer == NULL)
+  {
+    return CWIN_ERROR_WIN32_INTERNAL;
+  }
+
+  win32.timer =
+    CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                           TIMER_ALL_ACCESS);
+  if (win32.timer == NULL)
+  {
+    win32.timer = CreateWaitableTimerW(NULL, FALSE, NULL);
+  }
+  if (win32.timer == NULL)
+  {
+    CloseHandle(win32.frame_timer);
+    return CWIN_ERROR_WIN32_INTERNAL;
+  }
 
   WNDCLASS wc = {
     .lpfnWndProc = cwin_win32_window_proc,
@@ -148,6 +945,8 @@ enum cwin_error cwin_plat_init(void)
   win32.window_class = RegisterClass(&wc);
   if (win32.window_class == 0)
   {
+    CloseHandle(win32.frame_timer);
+    CloseHandle(win32.timer);
     return CWIN_ERROR_WIN32_INTERNAL;
   }
 
@@ -157,6 +956,8 @@ enum cwin_error cwin_plat_init(void)
 void cwin_plat_deinit(void)
 {
   UnregisterClass(CWIN_CLASS_NAME, win32.instance);
+  CloseHandle(win32.frame_timer);
+  CloseHandle(win32.timer);
 }
 
 enum cwin_error cwin_plat_init_window(struct cwin_window *window,
@@ -194,9 +995,15 @@ enum cwin_error cwin_plat_init_window(struct cwin_window *window,
   style |= WS_MAXIMIZEBOX | WS_THICKFRAME;
 
   DWORD exstyle = WS_EX_APPWINDOW;
+  window->plat.dpi = USER_DEFAULT_SCREEN_DPI;
   window->plat.is_tracked = false;
   window->plat.screen_state = CWIN_SCREEN_WINDOWED;
   window->plat.has_minimum = window->plat.has_maximum = false;
+  window->plat.high_surrogate = 0;
+  window->plat.is_relative = false;
+  window->plat.shown_buffer = -1;
+  window->plat.wants_frame = false;
+  window->plat.has_mode = window->plat.mode_active = false;
   window->plat.handle = CreateWindowEx(exstyle,
                                        CWIN_CLASS_NAME,
                                        str,
@@ -208,14 +1015,25 @@ enum cwin_error cwin_plat_init_window(struct cwin_window *window,
                                        win32.instance,
                                        NULL);
 
-  CWIN_FREE_ARR(WCHAR, size, str);
-
   if (window->plat.handle == NULL)
   {
-    CWIN_FREE(struct cwin_window, window);
     return CWIN_ERROR_WIN32_INTERNAL;
   }
 
+  /* The monitor, and so the DPI, is only known once the window exists. The
+     builder's size is in screen coordinates. */
+  window->plat.dpi = GetDpiForWindow(window->plat.handle);
+  if (window->plat.dpi != USER_DEFAULT_SCREEN_DPI &&
+      builder->width != CW_USEDEFAULT && builder->height != CW_USEDEFAULT)
+  {
+    SetWindowPos(window->plat.handle, NULL, 0, 0,
+                 MulDiv(builder->width, window->plat.dpi,
+                        USER_DEFAULT_SCREEN_DPI),
+                 MulDiv(builder->height, window->plat.dpi,
+                        USER_DEFAULT_SCREEN_DPI),
+                 SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
+  }
+
   ShowWindow(window->plat.handle, SW_NORMAL);
   SetWindowLongPtrA(window->plat.handle, GWLP_USERDATA, (LONG_PTR) window);
 
@@ -224,6 +1042,17 @@ enum cwin_error cwin_plat_init_window(struct cwin_window *window,
 
 void cwin_plat_deinit_window(struct cwin_window *window)
 {
+  if (window->plat.wants_frame)
+  {
+    struct cwin_window **it = &win32.frame_windows;
+    while (*it != window)
+    {
+      it = &(*it)->plat.next_frame;
+    }
+    *it = window->plat.next_frame;
+  }
+
+  win32_restore_mode(window);
   DestroyWindow(window->plat.handle);
 }
 
@@ -235,104 +1064,454 @@ void cwin_plat_get_raw_window(struct cwin_window *window,
   raw->win32.hinstance = win32.instance;
 }
 
-void cwin_window_set_screen_state(struct cwin_window *window,
-                                  enum cwin_screen_state state)
+/* Messages always arrive, only leave tracking depends on the mask, and it is
+   checked when the cursor moves. */
+void cwin_plat_set_event_mask(struct cwin_window *window)
+{
+  (void) window;
+}
+
+void cwin_plat_set_screen_state(struct cwin_window *window,
+                                enum cwin_screen_state state)
 {
   if (state == window->plat.screen_state)
   {
     return;
   }
 
-  DWORD style = GetWindowLong(window->plat.handle, GWL_STYLE);
+  if (state == CWIN_SCREEN_FULLSCREEN)
+  {
+    cwin_plat_set_fullscreen(window, 0, NULL);
+    return;
+  }
+
+  win32_restore_mode(window);
+  window->plat.has_mode = false;
+
   switch (state)
   {
-  case CWIN_SCREEN_FULLSCREEN: {
-    MONITORINFO mi = {
-      sizeof(MONITORINFO)
-    };
-    if (GetWindowPlacement(window->plat.handle,
-                           &window->plat.prev_placement) &&
-        GetMonitorInfo(MonitorFromWindow(window->plat.handle,
-                                         MONITOR_DEFAULTTOPRIMARY), &mi))
+  case CWIN_SCREEN_DESKTOP:
+    if (window->plat.screen_state == CWIN_SCREEN_WINDOWED)
     {
-      SetWindowLong(window->plat.handle, GWL_STYLE,
-                    style & ~WS_OVERLAPPEDWINDOW);
-      SetWindowPos(window->plat.handle, HWND_TOP, mi.rcMonitor.left,
-                   mi.rcMonitor.top, mi.rcMonitor.right - mi.rcMonitor.left,
-                   mi.rcMonitor.bottom - mi.rcMonitor.top,
-                   SWP_NOOWNERZORDER | SWP_FRAMECHANGED);
+      GetWindowPlacement(window->plat.handle, &window->plat.prev_placement);
     }
+    win32_cover_monitor(window,
+                        MonitorFromWindow(window->plat.handle,
+                                          MONITOR_DEFAULTTONEAREST),
+                        HWND_NOTOPMOST);
     break;
-  }
   case CWIN_SCREEN_WINDOWED: {
+    DWORD style = GetWindowLong(window->plat.handle, GWL_STYLE);
     SetWindowLong(window->plat.handle, GWL_STYLE, style | WS_OVERLAPPEDWINDOW);
     SetWindowPlacement(window->plat.handle, &window->plat.prev_placement);
-    SetWindowPos(window->plat.handle, NULL, 0, 0, 0, 0,
-                 SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_NOOWNERZORDER |
+    SetWindowPos(window->plat.handle, HWND_NOTOPMOST, 0, 0, 0, 0,
+                 SWP_NOMOVE | SWP_NOSIZE | SWP_NOOWNERZORDER |
                  SWP_FRAMECHANGED);
     break;
   }
+  default:
+    break;
   }
 
   window->plat.screen_state = state;
 }
 
-void cwin_window_set_maximum_size(struct cwin_window *window,
-                                  int max_width, int max_height)
+/*
+ * A topmost borderless window covering the monitor. DWM lets a swapchain
+ * that covers it flip straight to the screen, which is as good as the
+ * exclusive mode older versions of Windows had.
+ */
+enum cwin_error cwin_plat_set_fullscreen(
+  struct cwin_window *window, uint64_t monitor,
+  const struct cwin_monitor_mode *mode)
 {
-  window->plat.has_maximum = true;
-  window->plat.max_width = max_width;
-  window->plat.max_height = max_height;
+  HMONITOR handle = (HMONITOR) (uintptr_t) monitor;
+  if (monitor == 0)
+  {
+    handle = MonitorFromWindow(window->plat.handle, MONITOR_DEFAULTTONEAREST);
+  }
+
+  MONITORINFOEXW info;
+  info.cbSize = sizeof(info);
+  if (!GetMonitorInfoW(handle, (MONITORINFO *) &info))
+  {
+    return CWIN_ERROR_INVALID_MONITOR;
+  }
+
+  win32_restore_mode(window);
+  window->plat.has_mode = false;
+
+  if (mode != NULL)
+  {
+    struct cwin_monitor_mode *modes;
+    size_t count = win32_list_modes(info.szDevice, &modes);
+    if (count == SIZE_MAX)
+    {
+      return CWIN_ERROR_OOM;
+    }
+    int index = pick_mode(modes, count, mode);
+    if (index == -1)
+    {
+      return CWIN_ERROR_UNSUPPORTED;
+    }
+
+    DEVMODEW *dm = &window->plat.mode;
+    memset(dm, 0, sizeof(*dm));
+    dm->dmSize = sizeof(*dm);
+    dm->dmFields = DM_PELSWIDTH | DM_PELSHEIGHT;
+    dm->dmPelsWidth = modes[index].width;
+    dm->dmPelsHeight = modes[index].height;
+    if (modes[index].refresh_mhz != 0)
+    {
+      dm->dmFields |= DM_DISPLAYFREQUENCY;
+      dm->dmDisplayFrequency = modes[index].refresh_mhz / 1000;
+    }
+    memcpy(window->plat.mode_device, info.szDevice, sizeof(info.szDevice));
+    window->plat.mode_monitor = handle;
+    if (!win32_apply_mode(window))
+    {
+      return CWIN_ERROR_UNSUPPORTED;
+    }
+    window->plat.has_mode = true;
+  }
+
+  if (window->plat.screen_state == CWIN_SCREEN_WINDOWED)
+  {
+    GetWindowPlacement(window->plat.handle, &window->plat.prev_placement);
+  }
+  win32_cover_monitor(window, handle, HWND_TOPMOST);
+  window->plat.screen_state = CWIN_SCREEN_FULLSCREEN;
+  return CWIN_SUCCESS;
 }
 
-void cwin_window_set_minimum_size(struct cwin_window *window,
-                                  int min_width, int min_height)
+BOOL CALLBACK win32_monitor_proc(HMONITOR monitor, HDC dc, LPRECT rect,
+                                 LPARAM data)
 {
-  window->plat.has_minimum = true;
-  window->plat.min_width = min_width;
-  window->plat.min_height = min_height;
+  struct win32_monitor_list *list = (struct win32_monitor_list *) data;
+  (void) dc;
+  (void) rect;
+
+  MONITORINFOEXW info;
+  info.cbSize = sizeof(info);
+  if (!GetMonitorInfoW(monitor, (MONITORINFO *) &info))
+  {
+    return TRUE;
+  }
+
+  if (list->len < list->capacity)
+  {
+    win32_fill_monitor(monitor, &info, &list->monitors[list->len]);
+  }
+  list->len++;
+  return TRUE;
 }
 
-LRESULT CALLBACK cwin_win32_window_proc(HWND hwnd, UINT umsg, WPARAM wparam,
-                                        LPARAM lparam)
+enum cwin_error cwin_get_monitors(struct cwin_monitor *monitors, int *count)
 {
-  struct cwin_event *event;
-  struct cwin_window *window =
-    (struct cwin_window *) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+  struct win32_monitor_list list = {
+    .monitors = monitors,
+    .capacity = monitors != NULL ? *count : 0,
+  };
+  if (!EnumDisplayMonitors(NULL, NULL, win32_monitor_proc, (LPARAM) &list))
+  {
+    return CWIN_ERROR_WIN32_INTERNAL;
+  }
 
-  /*
-   * Creating a window calls the window procedure, so we haven't set the
-   * user data yet.
-   */
-  if (window == NULL)
+  *count = monitors == NULL || list.len < list.capacity ? list.len :
+    list.capacity;
+  return CWIN_SUCCESS;
+}
+
+void win32_fill_monitor(HMONITOR monitor, const MONITORINFOEXW *info,
+                        struct cwin_monitor *out)
+{
+  memset(out, 0, sizeof(*out));
+  out->id = (uintptr_t) monitor;
+  out->x = info->rcMonitor.left;
+  out->y = info->rcMonitor.top;
+  out->width = info->rcMonitor.right - info->rcMonitor.left;
+  out->height = info->rcMonitor.bottom - info->rcMonitor.top;
+  out->primary = info->dwFlags & MONITORINFOF_PRIMARY;
+
+  /* The adapter's first device is the monitor, with a readable name. */
+  DISPLAY_DEVICEW device = {
+    .cb = sizeof(device),
+  };
+  const WCHAR *name = info->szDevice;
+  if (EnumDisplayDevicesW(info->szDevice, 0, &device, 0))
   {
-    return DefWindowProc(hwnd, umsg, wparam, lparam);
+    name = device.DeviceString;
+  }
+  char utf8[4 * sizeof(device.DeviceString) / sizeof(WCHAR)];
+  if (WideCharToMultiByte(CP_UTF8, 0, name, -1, utf8, sizeof(utf8), NULL,
+                          NULL) > 0)
+  {
+    copy_monitor_name(out->name, utf8, strlen(utf8));
   }
-  struct cwin_event_queue *queue = window->queue;
 
-  switch (umsg)
+  HDC dc = CreateDCW(L"DISPLAY", info->szDevice, NULL, NULL);
+  if (dc != NULL)
   {
-  case WM_CLOSE:
-    event = alloc_window_event(queue, CWIN_WINDOW_EVENT_CLOSE, window);
-    break;
+    out->width_mm = GetDeviceCaps(dc, HORZSIZE);
+    out->height_mm = GetDeviceCaps(dc, VERTSIZE);
+    DeleteDC(dc);
+  }
+
+  UINT dpi_x, dpi_y;
+  out->scale = 1;
+  if (GetDpiForMonitor(monitor, MDT_EFFECTIVE_DPI, &dpi_x, &dpi_y) == S_OK)
+  {
+    out->scale = (float) dpi_x / USER_DEFAULT_SCREEN_DPI;
+  }
+
+  /* 0 and 1 Hz mean the hardware's default rate. */
+  DEVMODEW dm = {
+    .dmSize = sizeof(dm),
+  };
+  if (EnumDisplaySettingsW(info->szDevice, ENUM_CURRENT_SETTINGS, &dm))
+  {
+    out->mode.width = dm.dmPelsWidth;
+    out->mode.height = dm.dmPelsHeight;
+    out->mode.refresh_mhz = dm.dmDisplayFrequency > 1 ?
+      dm.dmDisplayFrequency * 1000 : 0;
+  }
+}
+
+/* Returns the number of modes, or SIZE_MAX if out of memory. They are in
+   scratch memory. Windows only reports whole hertz. */
+size_t win32_list_modes(const WCHAR *device,
+                        struct cwin_monitor_mode **modes)
+{
+  DEVMODEW dm = {
+    .dmSize = sizeof(dm),
+  };
+  size_t count = 0;
+  while (EnumDisplaySettingsW(device, (DWORD) count, &dm))
+  {
+    count++;
+  }
+
+  *modes = scratch_reserve(count * sizeof(**modes) + 1);
+  if (*modes == NULL)
+  {
+    return SIZE_MAX;
+  }
+
+  size_t len = 0;
+  for (; len < count && EnumDisplaySettingsW(device, (DWORD) len, &dm); len++)
+  {
+    (*modes)[len].width = dm.dmPelsWidth;
+    (*modes)[len].height = dm.dmPelsHeight;
+    (*modes)[len].refresh_mhz = dm.dmDisplayFrequency > 1 ?
+      dm.dmDisplayFrequency * 1000 : 0;
+  }
+  return normalize_modes(*modes, len);
+}
+
+enum cwin_error cwin_monitor_get_modes(uint64_t monitor,
+                                       struct cwin_monitor_mode *modes,
+                                       int *count)
+{
+  MONITORINFOEXW info;
+  info.cbSize = sizeof(info);
+  if (monitor == 0 ||
+      !GetMonitorInfoW((HMONITOR) (uintptr_t) monitor, (MONITORINFO *) &info))
+  {
+    return CWIN_ERROR_INVALID_MONITOR;
+  }
+
+  struct cwin_monitor_mode *all;
+  size_t len = win32_list_modes(info.szDevice, &all);
+  if (len == SIZE_MAX)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  copy_list(modes, count, all, len, sizeof(*all));
+  return CWIN_SUCCESS;
+}
+
+/* CDS_FULLSCREEN makes the change temporary, Windows undoes it if the
+   process exits without restoring it. */
+bool win32_apply_mode(struct cwin_window *window)
+{
+  window->plat.mode_active =
+    ChangeDisplaySettingsExW(window->plat.mode_device, &window->plat.mode,
+                             NULL, CDS_FULLSCREEN, NULL) ==
+    DISP_CHANGE_SUCCESSFUL;
+  return window->plat.mode_active;
+}
+
+void win32_restore_mode(struct cwin_window *window)
+{
+  if (window->plat.mode_active)
+  {
+    ChangeDisplaySettingsExW(window->plat.mode_device, NULL, NULL, 0, NULL);
+    window->plat.mode_active = false;
+  }
+}
+
+/* Borderless, over the whole monitor, which may have just changed mode. */
+void win32_cover_monitor(struct cwin_window *window, HMONITOR monitor,
+                         HWND insert_after)
+{
+  MONITORINFO info = {
+    .cbSize = sizeof(info),
+  };
+  if (!GetMonitorInfoW(monitor, &info))
+  {
+    return;
+  }
+
+  DWORD style = GetWindowLong(window->plat.handle, GWL_STYLE);
+  SetWindowLong(window->plat.handle, GWL_STYLE, style & ~WS_OVERLAPPEDWINDOW);
+  SetWindowPos(window->plat.handle, insert_after, info.rcMonitor.left,
+               info.rcMonitor.top, info.rcMonitor.right - info.rcMonitor.left,
+               info.rcMonitor.bottom - info.rcMonitor.top,
+               SWP_NOOWNERZORDER | SWP_FRAMECHANGED);
+}
+
+void cwin_plat_set_maximum_size(struct cwin_window *window,
+                                int max_width, int max_height)
+{
+  window->plat.has_maximum = true;
+  window->plat.max_width = max_width;
+  window->plat.max_height = max_height;
+}
+
+void cwin_plat_set_minimum_size(struct cwin_window *window,
+                                int min_width, int min_height)
+{
+  window->plat.has_minimum = true;
+  window->plat.min_width = min_width;
+  window->plat.min_height = min_height;
+}
+
+/* The first request arms the timer for the next vblank, later ones wait for
+   the same one. */
+enum cwin_error cwin_window_request_frame(struct cwin_window *window)
+{
+  if (window->plat.wants_frame)
+  {
+    return CWIN_SUCCESS;
+  }
+
+  if (win32.frame_windows == NULL)
+  {
+    uint64_t now = cwin_plat_now_ns();
+    uint64_t vblank_ns, refresh_ns;
+    win32.frame_deadline_ns = now + WIN32_FALLBACK_REFRESH_NS;
+    if (win32_frame_timing(&vblank_ns, &refresh_ns))
+    {
+      win32.frame_deadline_ns = predict_vblank(vblank_ns, refresh_ns, now);
+    }
+
+    /* Negative due times are relative, in 100 ns units. */
+    LARGE_INTEGER due;
+    due.QuadPart = -(LONGLONG) ((win32.frame_deadline_ns - now + 99) / 100);
+    if (!SetWaitableTimer(win32.frame_timer, &due, 0, NULL, NULL, FALSE))
+    {
+      return CWIN_ERROR_WIN32_INTERNAL;
+    }
+  }
+
+  window->plat.wants_frame = true;
+  window->plat.next_frame = win32.frame_windows;
+  win32.frame_windows = window;
+  return CWIN_SUCCESS;
+}
+
+LRESULT CALLBACK cwin_win32_window_proc(HWND hwnd, UINT umsg, WPARAM wparam,
+                                        LPARAM lparam)
+{
+  struct cwin_event *event;
+  struct cwin_window *window =
+    (struct cwin_window *) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+
+  /*
+   * Creating a window calls the window procedure, so we haven't set the
+   * user data yet.
+   */
+  if (window == NULL)
+  {
+    return DefWindowProc(hwnd, umsg, wparam, lparam);
+  }
+  struct cwin_event_queue *queue = window->queue;
+  message_time_ns = win32_message_time(umsg);
+
+  switch (umsg)
+  {
+  case WM_CLOSE:
+    event = alloc_window_event(queue, CWIN_WINDOW_EVENT_CLOSE, window);
+    break;
+  case WM_PAINT: {
+    /* Without a framebuffer, the application redraws on its own. */
+    if (window->plat.shown_buffer == -1)
+    {
+      return DefWindowProc(hwnd, umsg, wparam, lparam);
+    }
+
+    PAINTSTRUCT paint;
+    HDC dc = BeginPaint(hwnd, &paint);
+    struct cwin_rect rect = {
+      paint.rcPaint.left, paint.rcPaint.top,
+      paint.rcPaint.right - paint.rcPaint.left,
+      paint.rcPaint.bottom - paint.rcPaint.top,
+    };
+    win32_blit_buffer(window, dc, window->plat.shown_buffer, &rect, 1);
+    EndPaint(hwnd, &paint);
+    break;
+  }
   case WM_GETMINMAXINFO: {
+    /* The limits are in screen coordinates, the track sizes in pixels. */
     LPMINMAXINFO info = (LPMINMAXINFO) lparam;
+    UINT dpi = window->plat.dpi;
     if (window->plat.has_minimum)
     {
-      info->ptMinTrackSize.x = window->plat.min_width;
-      info->ptMinTrackSize.y = window->plat.min_height;
+      info->ptMinTrackSize.x = MulDiv(window->plat.min_width, dpi,
+                                      USER_DEFAULT_SCREEN_DPI);
+      info->ptMinTrackSize.y = MulDiv(window->plat.min_height, dpi,
+                                      USER_DEFAULT_SCREEN_DPI);
     }
     if (window->plat.has_maximum)
     {
-      info->ptMaxTrackSize.x = window->plat.max_width;
-      info->ptMaxTrackSize.y = window->plat.max_height;
+      info->ptMaxTrackSize.x = MulDiv(window->plat.max_width, dpi,
+                                      USER_DEFAULT_SCREEN_DPI);
+      info->ptMaxTrackSize.y = MulDiv(window->plat.max_height, dpi,
+                                      USER_DEFAULT_SCREEN_DPI);
+    }
+    break;
+  }
+  case WM_DPICHANGED: {
+    /* The suggested rectangle keeps the size in screen coordinates, and
+       applying it sends the WM_SIZE that reports the new pixel size. A
+       fullscreen window keeps covering its monitor instead. */
+    const RECT *suggested = (const RECT *) lparam;
+    window->plat.dpi = HIWORD(wparam);
+    publish_window_state(window);
+    alloc_scale_event(queue, window,
+                      (float) window->plat.dpi / USER_DEFAULT_SCREEN_DPI);
+    if (window->plat.screen_state == CWIN_SCREEN_WINDOWED)
+    {
+      SetWindowPos(hwnd, NULL, suggested->left, suggested->top,
+                   suggested->right - suggested->left,
+                   suggested->bottom - suggested->top,
+                   SWP_NOZORDER | SWP_NOACTIVATE);
     }
     break;
   }
   case WM_SIZE:
+    publish_window_state(window);
     event = alloc_window_event(queue, CWIN_WINDOW_EVENT_RESIZE, window);
-    event->window.width = LOWORD(lparam);
-    event->window.height = HIWORD(lparam);
+    if (event != NULL)
+    {
+      event->window.width = LOWORD(lparam);
+      event->window.height = HIWORD(lparam);
+    }
+    if (window->plat.is_relative && GetFocus() == hwnd)
+    {
+      win32_clip_cursor(window);
+    }
     break;
   case WM_MOUSEHOVER:
     event = alloc_window_event(queue, CWIN_WINDOW_EVENT_ENTER, window);
@@ -343,50 +1522,189 @@ LRESULT CALLBACK cwin_win32_window_proc(HWND hwnd, UINT umsg, WPARAM wparam,
     break;
   case WM_LBUTTONDOWN:
     event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_BUTTON, window);
-    event->mouse.state = CWIN_BUTTON_DOWN;
-    event->mouse.button = CWIN_MOUSE_BUTTON_LEFT;
+    if (event != NULL)
+    {
+      event->mouse.state = CWIN_BUTTON_DOWN;
+      event->mouse.button = CWIN_MOUSE_BUTTON_LEFT;
+    }
     break;
   case WM_MBUTTONDOWN:
     event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_BUTTON, window);
-    event->mouse.state = CWIN_BUTTON_DOWN;
-    event->mouse.button = CWIN_MOUSE_BUTTON_MIDDLE;
+    if (event != NULL)
+    {
+      event->mouse.state = CWIN_BUTTON_DOWN;
+      event->mouse.button = CWIN_MOUSE_BUTTON_MIDDLE;
+    }
     break;
   case WM_RBUTTONDOWN:
     event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_BUTTON, window);
-    event->mouse.state = CWIN_BUTTON_DOWN;
-    event->mouse.button = CWIN_MOUSE_BUTTON_RIGHT;
+    if (event != NULL)
+    {
+      event->mouse.state = CWIN_BUTTON_DOWN;
+      event->mouse.button = CWIN_MOUSE_BUTTON_RIGHT;
+    }
     break;
   case WM_LBUTTONUP:
     event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_BUTTON, window);
-    event->mouse.state = CWIN_BUTTON_UP;
-    event->mouse.button = CWIN_MOUSE_BUTTON_LEFT;
+    if (event != NULL)
+    {
+      event->mouse.state = CWIN_BUTTON_UP;
+      event->mouse.button = CWIN_MOUSE_BUTTON_LEFT;
+    }
     break;
   case WM_MBUTTONUP:
     event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_BUTTON, window);
-    event->mouse.state = CWIN_BUTTON_UP;
-    event->mouse.button = CWIN_MOUSE_BUTTON_MIDDLE;
+    if (event != NULL)
+    {
+      event->mouse.state = CWIN_BUTTON_UP;
+      event->mouse.button = CWIN_MOUSE_BUTTON_MIDDLE;
+    }
     break;
   case WM_RBUTTONUP:
     event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_BUTTON, window);
-    event->mouse.state = CWIN_BUTTON_UP;
-    event->mouse.button = CWIN_MOUSE_BUTTON_RIGHT;
+    if (event != NULL)
+    {
+      event->mouse.state = CWIN_BUTTON_UP;
+      event->mouse.button = CWIN_MOUSE_BUTTON_RIGHT;
+    }
     break;
   case WM_MOUSEWHEEL:
     event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_WHEEL, window);
-    event->mouse.delta = GET_WHEEL_DELTA_WPARAM(wparam);
+    if (event != NULL)
+    {
+      event->mouse.delta = GET_WHEEL_DELTA_WPARAM(wparam);
+    }
+    break;
+  case WM_KEYDOWN:
+  case WM_SYSKEYDOWN:
+  case WM_KEYUP:
+  case WM_SYSKEYUP: {
+    bool pressed = umsg == WM_KEYDOWN || umsg == WM_SYSKEYDOWN;
+    event = alloc_key_event(queue, pressed ? CWIN_BUTTON_DOWN : CWIN_BUTTON_UP,
+                            window);
+    if (event != NULL)
+    {
+      uint32_t scancode = (lparam >> 16) & 0xff;
+      if (lparam & (1 << 24))
+      {
+        scancode |= 0xe000;
+      }
+      event->key.scancode = scancode;
+      event->key.key = win32_key(wparam, scancode);
+      event->key.modifiers = win32_modifiers();
+      /* Bit 30 is the previous key state, which is down for repeats. */
+      event->key.repeat = pressed && (lparam & (1 << 30));
+    }
+
+    /* Alt + F4 and the window menu are handled by DefWindowProc. */
+    if (umsg == WM_SYSKEYDOWN || umsg == WM_SYSKEYUP)
+    {
+      return DefWindowProc(hwnd, umsg, wparam, lparam);
+    }
+    break;
+  }
+  case WM_CHAR: {
+    WCHAR unit = (WCHAR) wparam;
+    uint32_t c = unit;
+    if (IS_HIGH_SURROGATE(unit))
+    {
+      window->plat.high_surrogate = unit;
+      break;
+    }
+    if (IS_LOW_SURROGATE(unit))
+    {
+      if (window->plat.high_surrogate == 0)
+      {
+        break;
+      }
+      c = 0x10000 + ((window->plat.high_surrogate - 0xd800) << 10) +
+        (unit - 0xdc00);
+    }
+    window->plat.high_surrogate = 0;
+
+    /* Keys like backspace and ctrl + c send control characters, but they are
+       only key events. */
+    if (c < 0x20 || c == 0x7f)
+    {
+      break;
+    }
+
+    char utf8[4];
+    alloc_text_event(queue, window, utf8, encode_utf8(c, utf8));
     break;
+  }
+  case WM_ACTIVATE:
+    /* A switched mode only lasts while the window is in front, otherwise
+       the rest of the desktop would be shown in it. */
+    if (window->plat.has_mode && LOWORD(wparam) == WA_INACTIVE)
+    {
+      win32_restore_mode(window);
+      ShowWindow(hwnd, SW_MINIMIZE);
+    } else if (window->plat.has_mode && !window->plat.mode_active &&
+               win32_apply_mode(window))
+    {
+      win32_cover_monitor(window, window->plat.mode_monitor, HWND_TOPMOST);
+    }
+    return DefWindowProc(hwnd, umsg, wparam, lparam);
   case WM_KILLFOCUS:
     alloc_window_event(queue, CWIN_WINDOW_EVENT_UNFOCUS, window);
+    if (window->plat.is_relative)
+    {
+      ClipCursor(NULL);
+    }
     break;
   case WM_SETFOCUS:
     alloc_window_event(queue, CWIN_WINDOW_EVENT_FOCUS, window);
+    if (window->plat.is_relative)
+    {
+      win32_clip_cursor(window);
+    }
     break;
+  case WM_SETCURSOR:
+    if (window->plat.is_relative && LOWORD(lparam) == HTCLIENT)
+    {
+      SetCursor(NULL);
+      return TRUE;
+    }
+    return DefWindowProc(hwnd, umsg, wparam, lparam);
+  case WM_INPUT: {
+    /* Raw input is only registered while the window is relative. */
+    RAWINPUT raw;
+    UINT size = sizeof(raw);
+    if (GetRawInputData((HRAWINPUT) lparam, RID_INPUT, &raw, &size,
+                        sizeof(RAWINPUTHEADER)) != (UINT) -1 &&
+        raw.header.dwType == RIM_TYPEMOUSE &&
+        !(raw.data.mouse.usFlags & MOUSE_MOVE_ABSOLUTE) &&
+        (raw.data.mouse.lLastX != 0 || raw.data.mouse.lLastY != 0))
+    {
+      event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_RELATIVE, window);
+      if (event != NULL)
+      {
+        event->mouse.dx = (float) raw.data.mouse.lLastX;
+        event->mouse.dy = (float) raw.data.mouse.lLastY;
+      }
+    }
+    /* Lets the system clean up after the input. */
+    return DefWindowProc(hwnd, umsg, wparam, lparam);
+  }
   case WM_MOUSEMOVE:
+    /* The cursor is hidden and clipped, WM_INPUT has the motion. */
+    if (window->plat.is_relative)
+    {
+      break;
+    }
+
     event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_MOVE, window);
-    event->mouse.x = MAKEPOINTS(lparam).x;
-    event->mouse.y = MAKEPOINTS(lparam).y;
+    if (event != NULL)
+    {
+      event->mouse.x = MAKEPOINTS(lparam).x;
+      event->mouse.y = MAKEPOINTS(lparam).y;
+    }
 
-    if (!window->plat.is_tracked)
+    /* Don't have the system watch for the cursor leaving when nothing would
+       be sent. */
+    if (!window->plat.is_tracked &&
+        window_wants(window, CWIN_EVENT_MASK_CROSSING))
     {
       TRACKMOUSEEVENT track_mouse_event;
       track_mouse_event.cbSize = sizeof(TRACKMOUSEEVENT);
@@ -398,268 +1716,8957 @@ LRESULT CALLBACK cwin_win32_window_proc(HWND hwnd, UINT umsg, WPARAM wparam,
         window->plat.is_tracked = true;
       }
 
-      alloc_window_event(queue, CWIN_WINDOW_EVENT_ENTER, window);
-    }
+      alloc_window_event(queue, CWIN_WINDOW_EVENT_ENTER, window);
+    }
+
+    break;
+  default:
+    return DefWindowProc(hwnd, umsg, wparam, lparam);
+  }
+
+  return 0;
+}
+
+/*
+ * Input messages are posted with a GetTickCount timestamp. Others may be sent
+ * directly to the window procedure, where GetMessageTime is stale.
+ */
+uint64_t win32_message_time(UINT umsg)
+{
+  uint64_t now_ns = cwin_plat_now_ns();
+  if ((umsg < WM_MOUSEFIRST || umsg > WM_MOUSELAST) &&
+      (umsg < WM_KEYFIRST || umsg > WM_KEYLAST))
+  {
+    return now_ns;
+  }
+
+  return event_time_from_ms(GetMessageTime(), GetTickCount(), now_ns);
+}
+
+uint32_t win32_key(WPARAM vk, uint32_t scancode)
+{
+  bool extended = (scancode & 0xff00) == 0xe000;
+  if (vk >= VK_F1 && vk <= VK_F12)
+  {
+    return CWIN_KEY_F1 + (vk - VK_F1);
+  }
+
+  switch (vk)
+  {
+  case VK_BACK:
+    return CWIN_KEY_BACKSPACE;
+  case VK_TAB:
+    return CWIN_KEY_TAB;
+  case VK_RETURN:
+    return CWIN_KEY_ENTER;
+  case VK_ESCAPE:
+    return CWIN_KEY_ESCAPE;
+  case VK_SPACE:
+    return CWIN_KEY_SPACE;
+  case VK_DELETE:
+    return CWIN_KEY_DELETE;
+  case VK_LEFT:
+    return CWIN_KEY_LEFT;
+  case VK_RIGHT:
+    return CWIN_KEY_RIGHT;
+  case VK_UP:
+    return CWIN_KEY_UP;
+  case VK_DOWN:
+    return CWIN_KEY_DOWN;
+  case VK_HOME:
+    return CWIN_KEY_HOME;
+  case VK_END:
+    return CWIN_KEY_END;
+  case VK_PRIOR:
+    return CWIN_KEY_PAGE_UP;
+  case VK_NEXT:
+    return CWIN_KEY_PAGE_DOWN;
+  case VK_INSERT:
+    return CWIN_KEY_INSERT;
+  /* The generic shift, control and alt keys are told apart by scan code. */
+  case VK_SHIFT:
+    return MapVirtualKey(scancode & 0xff, MAPVK_VSC_TO_VK_EX) == VK_RSHIFT ?
+      CWIN_KEY_RIGHT_SHIFT : CWIN_KEY_LEFT_SHIFT;
+  case VK_CONTROL:
+    return extended ? CWIN_KEY_RIGHT_CTRL : CWIN_KEY_LEFT_CTRL;
+  case VK_MENU:
+    return extended ? CWIN_KEY_RIGHT_ALT : CWIN_KEY_LEFT_ALT;
+  case VK_LWIN:
+    return CWIN_KEY_LEFT_SUPER;
+  case VK_RWIN:
+    return CWIN_KEY_RIGHT_SUPER;
+  case VK_CAPITAL:
+    return CWIN_KEY_CAPS_LOCK;
+  case VK_NUMLOCK:
+    return CWIN_KEY_NUM_LOCK;
+  case VK_SCROLL:
+    return CWIN_KEY_SCROLL_LOCK;
+  case VK_SNAPSHOT:
+    return CWIN_KEY_PRINT_SCREEN;
+  case VK_PAUSE:
+    return CWIN_KEY_PAUSE;
+  case VK_APPS:
+    return CWIN_KEY_MENU;
+  }
+
+  /* The unshifted character in the current layout, with the top bit set for
+     dead keys. Letters come back uppercase. */
+  UINT c = MapVirtualKey(vk, MAPVK_VK_TO_CHAR) & 0x7fffffff;
+  if (c == 0)
+  {
+    return CWIN_KEY_UNKNOWN;
+  }
+  return (uint32_t) (ULONG_PTR) CharLower((LPWSTR) (ULONG_PTR) c);
+}
+
+/* GetKeyState is the state as of the message being processed. */
+uint32_t win32_modifiers(void)
+{
+  uint32_t modifiers = 0;
+  if (GetKeyState(VK_SHIFT) & 0x8000)
+  {
+    modifiers |= CWIN_MOD_SHIFT;
+  }
+  if (GetKeyState(VK_CONTROL) & 0x8000)
+  {
+    modifiers |= CWIN_MOD_CTRL;
+  }
+  if (GetKeyState(VK_MENU) & 0x8000)
+  {
+    modifiers |= CWIN_MOD_ALT;
+  }
+  if ((GetKeyState(VK_LWIN) | GetKeyState(VK_RWIN)) & 0x8000)
+  {
+    modifiers |= CWIN_MOD_SUPER;
+  }
+  if (GetKeyState(VK_CAPITAL) & 1)
+  {
+    modifiers |= CWIN_MOD_CAPS_LOCK;
+  }
+  if (GetKeyState(VK_NUMLOCK) & 1)
+  {
+    modifiers |= CWIN_MOD_NUM_LOCK;
+  }
+  return modifiers;
+}
+
+void cwin_mouse_capture(struct cwin_window *window)
+{
+  SetCapture(window->plat.handle);
+}
+
+void cwin_mouse_uncapture(struct cwin_window *window)
+{
+  ReleaseCapture();
+}
+
+/*
+ * Raw input is registered for the process, so only one window can be
+ * relative at a time.
+ */
+enum cwin_error cwin_mouse_set_relative(struct cwin_window *window,
+                                        bool relative)
+{
+  RAWINPUTDEVICE device = {
+    .usUsagePage = 0x01, /* Generic desktop controls. */
+    .usUsage = 0x02, /* Mouse. */
+    .dwFlags = relative ? 0 : RIDEV_REMOVE,
+    .hwndTarget = relative ? window->plat.handle : NULL,
+  };
+  if (!RegisterRawInputDevices(&device, 1, sizeof(device)))
+  {
+    return CWIN_ERROR_WIN32_INTERNAL;
+  }
+
+  window->plat.is_relative = relative;
+  if (!relative)
+  {
+    ClipCursor(NULL);
+    SetCursor(LoadCursor(NULL, IDC_ARROW));
+  } else if (GetFocus() == window->plat.handle)
+  {
+    win32_clip_cursor(window);
+    SetCursor(NULL);
+  }
+
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_plat_create_buffer(struct cwin_window *window, int index)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  BITMAPINFO info = {
+    .bmiHeader = {
+      .biSize = sizeof(BITMAPINFOHEADER),
+      .biWidth = framebuffer->width,
+      .biHeight = -framebuffer->height, /* Negative for top-down rows. */
+      .biPlanes = 1,
+      .biBitCount = 32,
+      .biCompression = BI_RGB,
+    },
+  };
+
+  void *pixels;
+  window->plat.buffers[index] = CreateDIBSection(NULL, &info, DIB_RGB_COLORS,
+                                                 &pixels, NULL, 0);
+  if (window->plat.buffers[index] == NULL)
+  {
+    return CWIN_ERROR_WIN32_INTERNAL;
+  }
+
+  framebuffer->buffers[index].pixels = pixels;
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_destroy_buffer(struct cwin_window *window, int index)
+{
+  DeleteObject(window->plat.buffers[index]);
+  window->plat.buffers[index] = NULL;
+  if (window->plat.shown_buffer == index)
+  {
+    window->plat.shown_buffer = -1;
+  }
+}
+
+/* GDI is done with a buffer when presenting returns, so none is ever busy. */
+enum cwin_error cwin_plat_wait_buffer(struct cwin_window *window)
+{
+  (void) window;
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_plat_present_buffer(struct cwin_window *window,
+                                         int index,
+                                         const struct cwin_rect *damage,
+                                         size_t damage_count)
+{
+  HDC dc = GetDC(window->plat.handle);
+  if (dc == NULL)
+  {
+    return CWIN_ERROR_WIN32_INTERNAL;
+  }
+
+  win32_blit_buffer(window, dc, index, damage, damage_count);
+  ReleaseDC(window->plat.handle, dc);
+
+  window->plat.shown_buffer = index;
+  return CWIN_SUCCESS;
+}
+
+void win32_blit_buffer(struct cwin_window *window, HDC dc, int index,
+                       const struct cwin_rect *rects, size_t rect_count)
+{
+  HDC buffer_dc = CreateCompatibleDC(dc);
+  HGDIOBJ old = SelectObject(buffer_dc, window->plat.buffers[index]);
+  for (size_t i = 0; i < rect_count; i++)
+  {
+    BitBlt(dc, rects[i].x, rects[i].y, rects[i].width, rects[i].height,
+           buffer_dc, rects[i].x, rects[i].y, SRCCOPY);
+  }
+  SelectObject(buffer_dc, old);
+  DeleteDC(buffer_dc);
+
+  /* GDI batches calls, the application may write the pixels next. */
+  GdiFlush();
+}
+
+uint64_t win32_qpc_to_ns(uint64_t counter)
+{
+  /* Split to avoid overflowing the multiplication. */
+  uint64_t freq = win32.qpc_frequency.QuadPart;
+  uint64_t seconds = counter / freq;
+  uint64_t rest = counter % freq;
+  return seconds * 1000000000 + rest * 1000000000 / freq;
+}
+
+/* The last vblank DWM composed at and the refresh period, false without
+   composition. */
+bool win32_frame_timing(uint64_t *vblank_ns, uint64_t *refresh_ns)
+{
+  DWM_TIMING_INFO info = {
+    .cbSize = sizeof(info),
+  };
+  if (FAILED(DwmGetCompositionTimingInfo(NULL, &info)) ||
+      info.qpcRefreshPeriod == 0)
+  {
+    return false;
+  }
+
+  *vblank_ns = win32_qpc_to_ns(info.qpcVBlank);
+  *refresh_ns = win32_qpc_to_ns(info.qpcRefreshPeriod);
+  return true;
+}
+
+/* Sends the requested frames once the timer says their vblank has come. */
+void win32_send_frames(void)
+{
+  struct cwin_event *event;
+  if (win32.frame_windows == NULL ||
+      WaitForSingleObject(win32.frame_timer, 0) != WAIT_OBJECT_0)
+  {
+    return;
+  }
+
+  uint64_t vblank_ns = 0;
+  uint64_t refresh_ns = 0;
+  win32_frame_timing(&vblank_ns, &refresh_ns);
+
+  struct cwin_window *window = win32.frame_windows;
+  win32.frame_windows = NULL;
+  while (window != NULL)
+  {
+    struct cwin_window *next = window->plat.next_frame;
+    window->plat.wants_frame = false;
+    /* Every window is composed at each vblank, so the last one is when the
+       window's last frame was shown. */
+    event = alloc_frame_event(window->queue, window, vblank_ns, vblank_ns,
+                              refresh_ns);
+    if (event != NULL)
+    {
+      event->time_ns = win32.frame_deadline_ns;
+    }
+    window = next;
+  }
+}
+
+void win32_clip_cursor(struct cwin_window *window)
+{
+  RECT rect;
+  GetClientRect(window->plat.handle, &rect);
+  MapWindowPoints(window->plat.handle, NULL, (POINT *) &rect, 2);
+  ClipCursor(&rect);
+}
+
+/* The string is stored in the scratch buffer, and is only valid until the
+   next use of it. */
+enum cwin_error utf8_to_wide_string(WCHAR **str_out, int *len_out,
+                                    const uint8_t *src, size_t src_len)
+{
+  int real_src_len = src_len == 0 ? -1 : src_len;
+  int len = MultiByteToWideChar(CP_UTF8, 0, src, real_src_len,
+                                 NULL, 0);
+  if (len == 0)
+  {
+    return CWIN_ERROR_INVALID_UTF8;
+  }
+
+  WCHAR *str = scratch_reserve(len * sizeof(WCHAR));
+  if (str == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  if (MultiByteToWideChar(CP_UTF8, 0, src, real_src_len, str, len) == 0)
+  {
+    return CWIN_ERROR_INVALID_UTF8;
+  }
+
+  *len_out = len;
+  *str_out = str;
+
+  return CWIN_SUCCESS;
+}
+
+#ifdef CWIN_VULKAN
+
+const char *win32_vk_extensions[] = {
+  "VK_KHR_surface",
+  "VK_KHR_win32_surface",
+};
+
+void cwin_vk_get_required_extensions(struct cwin_window *window,
+                                     const char **extensions,
+                                     int *extension_count)
+{
+  (void) window;
+
+  if (*extension_count == 0 || extensions == NULL)
+  {
+    *extension_count = sizeof(win32_vk_extensions) /
+      sizeof(win32_vk_extensions[0]);
+  } else
+  {
+    for (int i = 0; i < *extension_count; i++)
+    {
+      extensions[i] = win32_vk_extensions[i];
+    }
+  }
+}
+
+enum cwin_error cwin_vk_create_surface(struct cwin_window *window,
+                                       VkInstance instance,
+                                       VkSurfaceKHR *surface)
+{
+  VkResult err;
+  VkWin32SurfaceCreateInfoKHR surface_create_info = {
+    .sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
+    .hwnd = window->plat.handle,
+    .hinstance = win32.instance,
+  };
+
+  err = vkCreateWin32SurfaceKHR(instance, &surface_create_info, NULL, surface);
+  if (err)
+  {
+    return CWIN_ERROR_VK_INTERNAL;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+#endif
+
+#endif
+
+#if defined(CWIN_BACKEND_WL) || defined(CWIN_BACKEND_X11) ||                   \
+    defined(CWIN_BACKEND_HEADLESS)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+/* Shared by the backends that run on POSIX systems. */
+
+struct {
+  /* Readable while a wakeup is pending, polled alongside platform input. */
+  int wake_fd;
+  /* Readable once the earliest cwin timer is due. */
+  int timer_fd;
+  /* Created on first use by cwin_get_event_fd, or -1. */
+  int epoll_fd;
+  pthread_t event_thread; /* The thread that called cwin_init. */
+} posix;
+
+int posix_timeout_ms(uint64_t timeout_ns);
+uint64_t posix_event_time(uint32_t time_ms, uint64_t now_ns);
+enum cwin_error posix_init_wake(void);
+void posix_deinit_wake(void);
+int posix_get_event_fd(int display_fd);
+int posix_create_shm(size_t size);
+void *posix_thread_main(void *arg);
+
+uint64_t cwin_plat_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Wayland compositors and X servers stamp input with CLOCK_MONOTONIC in
+ * milliseconds, truncated to 32 bits.
+ */
+uint64_t posix_event_time(uint32_t time_ms, uint64_t now_ns)
+{
+  return event_time_from_ms(time_ms, (uint32_t) (now_ns / 1000000), now_ns);
+}
+
+enum cwin_error posix_init_wake(void)
+{
+  posix.event_thread = pthread_self();
+  posix.epoll_fd = -1;
+  posix.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (posix.wake_fd == -1)
+  {
+    return CWIN_ERROR_POSIX_INTERNAL;
+  }
+
+  posix.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (posix.timer_fd == -1)
+  {
+    close(posix.wake_fd);
+    return CWIN_ERROR_POSIX_INTERNAL;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+void posix_deinit_wake(void)
+{
+  if (posix.epoll_fd != -1)
+  {
+    close(posix.epoll_fd);
+    posix.epoll_fd = -1;
+  }
+  close(posix.wake_fd);
+  close(posix.timer_fd);
+  posix.wake_fd = posix.timer_fd = -1;
+}
+
+/*
+ * Combines the display connection, if there is one, the wakeup eventfd and
+ * the timerfd into a single epoll fd. An epoll fd is readable whenever one of
+ * the fds in it is, so it can itself be waited on by poll, epoll or io_uring.
+ */
+int posix_get_event_fd(int display_fd)
+{
+  if (posix.epoll_fd != -1)
+  {
+    return posix.epoll_fd;
+  }
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1)
+  {
+    return -1;
+  }
+
+  int fds[] = { display_fd, posix.wake_fd, posix.timer_fd };
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+  {
+    struct epoll_event event = {
+      .events = EPOLLIN,
+      .data.fd = fds[i],
+    };
+    if (fds[i] != -1 &&
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) == -1)
+    {
+      close(epoll_fd);
+      return -1;
+    }
+  }
+
+  posix.epoll_fd = epoll_fd;
+  return epoll_fd;
+}
+
+void cwin_plat_clear_wake(void)
+{
+  uint64_t count;
+  /* The fd is non-blocking, so this fails harmlessly if nothing is pending. */
+  (void) read(posix.wake_fd, &count, sizeof(count));
+}
+
+void cwin_plat_wake(void)
+{
+  uint64_t one = 1;
+  (void) write(posix.wake_fd, &one, sizeof(one));
+}
+
+bool cwin_plat_is_event_thread(void)
+{
+  return pthread_equal(pthread_self(), posix.event_thread);
+}
+
+void *posix_thread_main(void *arg)
+{
+  struct thread *thread = arg;
+  thread->run(thread->arg);
+  return NULL;
+}
+
+enum cwin_error cwin_plat_start_thread(struct thread *thread)
+{
+  pthread_t handle;
+  if (pthread_create(&handle, NULL, posix_thread_main, thread) != 0)
+  {
+    return CWIN_ERROR_POSIX_INTERNAL;
+  }
+
+  thread->handle = (uintptr_t) handle;
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_join_thread(struct thread *thread)
+{
+  pthread_join((pthread_t) thread->handle, NULL);
+}
+
+/* A futex, the kernel checks the value and sleeps atomically. */
+void cwin_plat_wait_on_address(atomic_uint *address, unsigned value)
+{
+  syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+void cwin_plat_wake_address(atomic_uint *address)
+{
+  syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Setting a timerfd also makes it unreadable until it expires again. */
+void cwin_plat_set_timer(uint64_t deadline_ns)
+{
+  struct itimerspec spec = {
+    .it_value.tv_sec = deadline_ns / 1000000000,
+    .it_value.tv_nsec = deadline_ns % 1000000000,
+  };
+  timerfd_settime(posix.timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/* Converts a wait timeout to the milliseconds poll() takes, -1 if infinite. */
+int posix_timeout_ms(uint64_t timeout_ns)
+{
+  if (timeout_ns == CWIN_WAIT_FOREVER)
+  {
+    return -1;
+  }
+
+  /* Round up, waking before the deadline would just spin. */
+  uint64_t ms = (timeout_ns + 999999) / 1000000;
+  return ms > INT32_MAX ? INT32_MAX : (int) ms;
+}
+
+/*
+ * Anonymous shared memory for sharing pixels with the display server, as a
+ * fd that can be mapped and passed over the connection. The name is unlinked
+ * right away, so the memory goes away with the last mapping. Returns -1 on
+ * failure.
+ */
+int posix_create_shm(size_t size)
+{
+  static unsigned counter;
+  char name[64];
+  int fd = -1;
+  for (int tries = 0; fd == -1 && tries < 16; tries++)
+  {
+    snprintf(name, sizeof(name), "/cwin-%ld-%u", (long) getpid(), counter++);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1 && errno != EEXIST)
+    {
+      return -1;
+    }
+  }
+  if (fd == -1)
+  {
+    return -1;
+  }
+  shm_unlink(name);
+
+  if (ftruncate(fd, size) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+#endif
+
+#if defined(CWIN_BACKEND_WL) || defined(CWIN_BACKEND_X11)
+
+#include <xkbcommon/xkbcommon.h>
+
+/*
+ * Both Linux backends translate keys with xkbcommon. The keymap and state are
+ * kept for as long as the keyboard, and the modifiers are only recomputed
+ * when the state changes, so translating a key is a few table lookups.
+ */
+
+/* One per bit of enum cwin_modifiers. */
+#define KEYBOARD_MOD_COUNT 6
+
+struct {
+  struct xkb_context *context;
+  struct xkb_keymap *keymap; /* NULL until the platform sends one. */
+  struct xkb_state *state;
+  xkb_mod_index_t mods[KEYBOARD_MOD_COUNT];
+  uint32_t modifiers; /* enum cwin_modifiers, for the current state. */
+} keyboard;
+
+const char *const KEYBOARD_MOD_NAMES[KEYBOARD_MOD_COUNT] = {
+  XKB_MOD_NAME_SHIFT,
+  XKB_MOD_NAME_CTRL,
+  XKB_MOD_NAME_ALT,
+  XKB_MOD_NAME_LOGO,
+  XKB_MOD_NAME_CAPS,
+  XKB_MOD_NAME_NUM,
+};
+
+bool keyboard_init(void);
+void keyboard_deinit(void);
+void keyboard_set_keymap(struct xkb_keymap *keymap, struct xkb_state *state);
+void keyboard_update_mask(uint32_t depressed, uint32_t latched,
+                          uint32_t locked, uint32_t layout);
+uint32_t keyboard_key(xkb_keycode_t keycode);
+void keyboard_translate(struct cwin_event_queue *queue,
+                        struct cwin_window *window, xkb_keycode_t keycode,
+                        bool pressed, bool repeat, uint64_t time_ns);
+
+bool keyboard_init(void)
+{
+  keyboard.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  keyboard.keymap = NULL;
+  keyboard.state = NULL;
+  return keyboard.context != NULL;
+}
+
+void keyboard_deinit(void)
+{
+  if (keyboard.state != NULL)
+  {
+    xkb_state_unref(keyboard.state);
+  }
+  if (keyboard.keymap != NULL)
+  {
+    xkb_keymap_unref(keyboard.keymap);
+  }
+  if (keyboard.context != NULL)
+  {
+    xkb_context_unref(keyboard.context);
+  }
+  memset(&keyboard, 0, sizeof(keyboard));
+}
+
+/* Takes ownership of both. */
+void keyboard_set_keymap(struct xkb_keymap *keymap, struct xkb_state *state)
+{
+  if (keyboard.state != NULL)
+  {
+    xkb_state_unref(keyboard.state);
+  }
+  if (keyboard.keymap != NULL)
+  {
+    xkb_keymap_unref(keyboard.keymap);
+  }
+  keyboard.keymap = keymap;
+  keyboard.state = state;
+
+  for (int i = 0; i < KEYBOARD_MOD_COUNT; i++)
+  {
+    keyboard.mods[i] = xkb_keymap_mod_get_index(keymap, KEYBOARD_MOD_NAMES[i]);
+  }
+  keyboard_update_mask(0, 0, 0, 0);
+}
+
+void keyboard_update_mask(uint32_t depressed, uint32_t latched,
+                          uint32_t locked, uint32_t layout)
+{
+  xkb_state_update_mask(keyboard.state, depressed, latched, locked, 0, 0,
+                        layout);
+
+  keyboard.modifiers = 0;
+  for (int i = 0; i < KEYBOARD_MOD_COUNT; i++)
+  {
+    if (keyboard.mods[i] != XKB_MOD_INVALID &&
+        xkb_state_mod_index_is_active(keyboard.state, keyboard.mods[i],
+                                      XKB_STATE_MODS_EFFECTIVE) > 0)
+    {
+      keyboard.modifiers |= 1 << i;
+    }
+  }
+}
+
+/* The key's symbol on the first shift level of the active layout. */
+uint32_t keyboard_key(xkb_keycode_t keycode)
+{
+  const xkb_keysym_t *syms;
+  xkb_layout_index_t layout = xkb_state_key_get_layout(keyboard.state, keycode);
+  if (xkb_keymap_key_get_syms_by_level(keyboard.keymap, keycode, layout, 0,
+                                       &syms) != 1)
+  {
+    return CWIN_KEY_UNKNOWN;
+  }
+
+  xkb_keysym_t sym = syms[0];
+  if (sym >= XKB_KEY_F1 && sym <= XKB_KEY_F12)
+  {
+    return CWIN_KEY_F1 + (sym - XKB_KEY_F1);
+  }
+
+  switch (sym)
+  {
+  case XKB_KEY_ISO_Left_Tab:
+    return CWIN_KEY_TAB;
+  case XKB_KEY_KP_Enter:
+    return CWIN_KEY_ENTER;
+  case XKB_KEY_Left:
+    return CWIN_KEY_LEFT;
+  case XKB_KEY_Right:
+    return CWIN_KEY_RIGHT;
+  case XKB_KEY_Up:
+    return CWIN_KEY_UP;
+  case XKB_KEY_Down:
+    return CWIN_KEY_DOWN;
+  case XKB_KEY_Home:
+    return CWIN_KEY_HOME;
+  case XKB_KEY_End:
+    return CWIN_KEY_END;
+  case XKB_KEY_Page_Up:
+    return CWIN_KEY_PAGE_UP;
+  case XKB_KEY_Page_Down:
+    return CWIN_KEY_PAGE_DOWN;
+  case XKB_KEY_Insert:
+    return CWIN_KEY_INSERT;
+  case XKB_KEY_Shift_L:
+    return CWIN_KEY_LEFT_SHIFT;
+  case XKB_KEY_Shift_R:
+    return CWIN_KEY_RIGHT_SHIFT;
+  case XKB_KEY_Control_L:
+    return CWIN_KEY_LEFT_CTRL;
+  case XKB_KEY_Control_R:
+    return CWIN_KEY_RIGHT_CTRL;
+  case XKB_KEY_Alt_L:
+    return CWIN_KEY_LEFT_ALT;
+  case XKB_KEY_Alt_R:
+  case XKB_KEY_ISO_Level3_Shift:
+    return CWIN_KEY_RIGHT_ALT;
+  case XKB_KEY_Super_L:
+    return CWIN_KEY_LEFT_SUPER;
+  case XKB_KEY_Super_R:
+    return CWIN_KEY_RIGHT_SUPER;
+  case XKB_KEY_Caps_Lock:
+    return CWIN_KEY_CAPS_LOCK;
+  case XKB_KEY_Num_Lock:
+    return CWIN_KEY_NUM_LOCK;
+  case XKB_KEY_Scroll_Lock:
+    return CWIN_KEY_SCROLL_LOCK;
+  case XKB_KEY_Print:
+    return CWIN_KEY_PRINT_SCREEN;
+  case XKB_KEY_Pause:
+    return CWIN_KEY_PAUSE;
+  case XKB_KEY_Menu:
+    return CWIN_KEY_MENU;
+  }
+
+  /* Backspace, tab, enter, escape and delete map to their control
+     characters, which are also their cwin keys. */
+  return xkb_keysym_to_utf32(sym);
+}
+
+/* Sends the key event, and the text the key types when it is pressed. */
+void keyboard_translate(struct cwin_event_queue *queue,
+                        struct cwin_window *window, xkb_keycode_t keycode,
+                        bool pressed, bool repeat, uint64_t time_ns)
+{
+  struct cwin_event *event;
+  if (keyboard.keymap == NULL ||
+      !window_wants(window, CWIN_EVENT_MASK_KEY | CWIN_EVENT_MASK_TEXT))
+  {
+    return;
+  }
+
+  event = alloc_key_event(queue, pressed ? CWIN_BUTTON_DOWN : CWIN_BUTTON_UP,
+                          window);
+  if (event != NULL)
+  {
+    event->time_ns = time_ns;
+    /* X11 keycodes are evdev codes offset by 8. */
+    event->key.scancode = keycode - 8;
+    event->key.key = keyboard_key(keycode);
+    event->key.modifiers = keyboard.modifiers;
+    event->key.repeat = repeat;
+  }
+
+  if (!pressed)
+  {
+    return;
+  }
+
+  char text[32];
+  int len = xkb_state_key_get_utf8(keyboard.state, keycode, text,
+                                   sizeof(text));
+  /* Keys like backspace and ctrl + c produce control characters, but they are
+     only key events. */
+  if (len <= 0 || (size_t) len >= sizeof(text) ||
+      (unsigned char) text[0] < 0x20 || text[0] == 0x7f)
+  {
+    return;
+  }
+
+  event = alloc_text_event(queue, window, text, len);
+  if (event != NULL)
+  {
+    event->time_ns = time_ns;
+  }
+}
+
+#endif
+
+#ifdef CWIN_BACKEND_WL
+
+#if defined(CWIN_BACKEND_X11) || defined(CWIN_BACKEND_WIN32) ||                \
+    defined(CWIN_BACKEND_MACOS)
+#error Only one backend supported at a time.
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/input-event-codes.h>
+#include <wayland-client.h>
+
+#include "fractional-scale-v1-client-protocol.h"
+#include "pointer-constraints-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "relative-pointer-unstable-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+
+#define WL_DEFAULT_WIDTH 640
+#define WL_DEFAULT_HEIGHT 480
+
+/* wp_fractional_scale_v1 sends scales in 120ths. */
+#define WL_SCALE_DENOMINATOR 120
+
+/* TYPES */
+
+struct cwin_wl_window {
+  struct wl_surface *surface;
+  struct xdg_surface *xdg_surface;
+  struct xdg_toplevel *xdg_toplevel;
+  enum cwin_screen_state screen_state;
+  /* The id of the output the surface entered last, 0 once it left it. Only
+     the id is kept, the output may go away first. */
+  uint64_t output_id;
+  /* Set by the first xdg_surface.configure, before that nothing may be
+     attached to the surface. */
+  bool configured;
+  int width, height; /* In surface coordinates, cwin's screen coordinates. */
+  /* Pixels per surface coordinate, in WL_SCALE_DENOMINATOR units. */
+  int scale;
+  /* Both NULL without fractional scaling, then the scale is an integer set
+     with wl_surface.set_buffer_scale. */
+  struct wp_viewport *viewport;
+  /* The integer scale last set. It may only change along with a buffer of
+     the matching size, or the compositor rejects the buffer. */
+  int buffer_scale;
+  struct wp_fractional_scale_v1 *fractional_scale;
+  /* From the last xdg_toplevel.configure, applied on xdg_surface.configure. */
+  int pending_width, pending_height;
+  /* Not NULL while the window is relative. */
+  struct zwp_locked_pointer_v1 *locked_pointer;
+  struct wl_buffer *buffers[MAX_FRAMEBUFFER_BUFFERS];
+  /* Both are pending until the compositor answers, each at most once. */
+  struct wl_callback *frame_callback;
+  struct wp_presentation_feedback *feedback;
+  /* From the last presentation feedback, 0 without wp_presentation. */
+  uint64_t presented_ns, refresh_ns;
+};
+
+CWIN_WINDOW_TYPE(struct cwin_wl_window);
+
+/* A wl_output global, described by its events up to wl_output.done. */
+struct cwin_wl_output {
+  struct wl_output *output;
+  uint32_t version;
+  struct cwin_monitor info; /* The id is the global's name. */
+  int32_t transform, scale;
+  bool done;
+  struct cwin_wl_output *next;
+};
+
+struct {
+  struct wl_display *display;
+  struct wl_registry *registry;
+  struct wl_compositor *compositor;
+  struct xdg_wm_base *wm_base;
+  struct wl_shm *shm;
+  struct wl_seat *seat;
+  struct wl_pointer *pointer;
+  struct wl_keyboard *keyboard;
+  /* Optional, relative mode is unsupported without them. */
+  struct zwp_relative_pointer_manager_v1 *relative_pointer_manager;
+  struct zwp_pointer_constraints_v1 *pointer_constraints;
+  /* Created with the first relative window. */
+  struct zwp_relative_pointer_v1 *relative_pointer;
+  /* Optional, frames have no timing without it. Its timestamps are only
+     used if they are on CLOCK_MONOTONIC like cwin_now_ns. */
+  struct wp_presentation *presentation;
+  bool presentation_monotonic;
+  /* Optional, fractional scales need both. */
+  struct wp_viewporter *viewporter;
+  struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+  struct cwin_wl_output *outputs;
+
+  struct cwin_window *pointer_focus;
+  uint32_t pointer_enter_serial; /* For wl_pointer.set_cursor. */
+  struct cwin_window *keyboard_focus;
+
+  uint64_t dispatch_time_ns; /* When the events being dispatched were read. */
+
+  /* Key repeat is left to clients. The held key repeats at repeat_next_ns,
+     which is 0 while nothing repeats. */
+  int32_t repeat_rate, repeat_delay;
+  uint32_t repeat_key;
+  uint64_t repeat_next_ns;
+} wl;
+
+/* CONSTANTS */
+
+/* Marks the surfaces created by cwin, so surfaces from other code sharing the
+   connection are never mistaken for a window. */
+const char *const CWIN_WL_SURFACE_TAG = "cwin";
+
+/* PROTOTYPES */
+
+struct cwin_window *cwin_wl_surface_to_window(struct wl_surface *surface);
+enum cwin_error cwin_wl_dispatch(uint64_t timeout_ns);
+void cwin_wl_repeat_key(void);
+int cwin_wl_to_pixels(struct cwin_window *window, int value);
+int cwin_wl_fixed_to_pixels(struct cwin_window *window, wl_fixed_t value);
+void cwin_wl_apply_scale(struct cwin_window *window);
+void cwin_wl_set_scale(struct cwin_window *window, int scale);
+void cwin_wl_send_resize(struct cwin_window *window);
+struct cwin_wl_output *cwin_wl_find_output(uint64_t id);
+void cwin_wl_bind_output(uint32_t name, uint32_t version);
+void cwin_wl_destroy_output(struct cwin_wl_output *output);
+
+void cwin_wl_registry_global(void *data, struct wl_registry *registry,
+                             uint32_t name, const char *interface,
+                             uint32_t version);
+void cwin_wl_registry_global_remove(void *data,
+                                    struct wl_registry *registry,
+                                    uint32_t name);
+void cwin_wl_wm_base_ping(void *data, struct xdg_wm_base *wm_base,
+                          uint32_t serial);
+void cwin_wl_seat_capabilities(void *data, struct wl_seat *seat,
+                               uint32_t capabilities);
+void cwin_wl_seat_name(void *data, struct wl_seat *seat, const char *name);
+void cwin_wl_output_geometry(void *data, struct wl_output *output,
+                             int32_t x, int32_t y, int32_t physical_width,
+                             int32_t physical_height, int32_t subpixel,
+                             const char *make, const char *model,
+                             int32_t transform);
+void cwin_wl_output_mode(void *data, struct wl_output *output,
+                         uint32_t flags, int32_t width, int32_t height,
+                         int32_t refresh);
+void cwin_wl_output_done(void *data, struct wl_output *output);
+void cwin_wl_output_scale(void *data, struct wl_output *output,
+                          int32_t factor);
+void cwin_wl_output_name(void *data, struct wl_output *output,
+                         const char *name);
+void cwin_wl_output_description(void *data, struct wl_output *output,
+                                const char *description);
+void cwin_wl_surface_enter(void *data, struct wl_surface *surface,
+                           struct wl_output *output);
+void cwin_wl_surface_leave(void *data, struct wl_surface *surface,
+                           struct wl_output *output);
+void cwin_wl_surface_preferred_buffer_scale(void *data,
+                                            struct wl_surface *surface,
+                                            int32_t factor);
+void cwin_wl_surface_preferred_buffer_transform(void *data,
+                                                struct wl_surface *surface,
+                                                uint32_t transform);
+void cwin_wl_fractional_preferred_scale(
+  void *data, struct wp_fractional_scale_v1 *fractional_scale,
+  uint32_t scale);
+void cwin_wl_xdg_surface_configure(void *data,
+                                   struct xdg_surface *xdg_surface,
+                                   uint32_t serial);
+void cwin_wl_xdg_toplevel_configure(void *data,
+                                    struct xdg_toplevel *xdg_toplevel,
+                                    int32_t width, int32_t height,
+                                    struct wl_array *states);
+void cwin_wl_xdg_toplevel_close(void *data,
+                                struct xdg_toplevel *xdg_toplevel);
+void cwin_wl_buffer_release(void *data, struct wl_buffer *wl_buffer);
+void cwin_wl_pointer_enter(void *data, struct wl_pointer *pointer,
+                           uint32_t serial, struct wl_surface *surface,
+                           wl_fixed_t x, wl_fixed_t y);
+void cwin_wl_pointer_leave(void *data, struct wl_pointer *pointer,
+                           uint32_t serial, struct wl_surface *surface);
+void cwin_wl_pointer_motion(void *data, struct wl_pointer *pointer,
+                            uint32_t time, wl_fixed_t x, wl_fixed_t y);
+void cwin_wl_pointer_button(void *data, struct wl_pointer *pointer,
+                            uint32_t serial, uint32_t time, uint32_t button,
+                            uint32_t state);
+void cwin_wl_pointer_axis(void *data, struct wl_pointer *pointer, uint32_t time,
+                          uint32_t axis, wl_fixed_t value);
+void cwin_wl_pointer_frame(void *data, struct wl_pointer *pointer);
+void cwin_wl_pointer_axis_source(void *data, struct wl_pointer *pointer,
+                                 uint32_t source);
+void cwin_wl_pointer_axis_stop(void *data, struct wl_pointer *pointer,
+                               uint32_t time, uint32_t axis);
+void cwin_wl_pointer_axis_discrete(void *data, struct wl_pointer *pointer,
+                                   uint32_t axis, int32_t discrete);
+void cwin_wl_keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
+                             uint32_t format, int32_t fd, uint32_t size);
+void cwin_wl_keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
+                            uint32_t serial, struct wl_surface *surface,
+                            struct wl_array *keys);
+void cwin_wl_keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
+                            uint32_t serial, struct wl_surface *surface);
+void cwin_wl_keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
+                          uint32_t serial, uint32_t time, uint32_t key,
+                          uint32_t state);
+void cwin_wl_keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
+                                uint32_t serial, uint32_t depressed,
+                                uint32_t latched, uint32_t locked,
+                                uint32_t group);
+void cwin_wl_keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
+                                  int32_t rate, int32_t delay);
+void cwin_wl_relative_motion(void *data,
+                             struct zwp_relative_pointer_v1 *relative_pointer,
+                             uint32_t utime_hi, uint32_t utime_lo,
+                             wl_fixed_t dx, wl_fixed_t dy,
+                             wl_fixed_t dx_unaccel, wl_fixed_t dy_unaccel);
+void cwin_wl_presentation_clock_id(void *data,
+                                   struct wp_presentation *presentation,
+                                   uint32_t clk_id);
+void cwin_wl_frame_done(void *data, struct wl_callback *callback,
+                        uint32_t time);
+void cwin_wl_feedback_sync_output(void *data,
+                                  struct wp_presentation_feedback *feedback,
+                                  struct wl_output *output);
+void cwin_wl_feedback_presented(void *data,
+                                struct wp_presentation_feedback *feedback,
+                                uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                                uint32_t tv_nsec, uint32_t refresh,
+                                uint32_t seq_hi, uint32_t seq_lo,
+                                uint32_t flags);
+void cwin_wl_feedback_discarded(void *data,
+                                struct wp_presentation_feedback *feedback);
+
+/* LISTENERS */
+
+const struct wl_registry_listener cwin_wl_registry_listener = {
+  .global = cwin_wl_registry_global,
+  .global_remove = cwin_wl_registry_global_remove,
+};
+
+const struct xdg_wm_base_listener cwin_wl_wm_base_listener = {
+  .ping = cwin_wl_wm_base_ping,
+};
+
+const struct wl_seat_listener cwin_wl_seat_listener = {
+  .capabilities = cwin_wl_seat_capabilities,
+  .name = cwin_wl_seat_name,
+};
+
+const struct wl_output_listener cwin_wl_output_listener = {
+  .geometry = cwin_wl_output_geometry,
+  .mode = cwin_wl_output_mode,
+  .done = cwin_wl_output_done,
+  .scale = cwin_wl_output_scale,
+  .name = cwin_wl_output_name,
+  .description = cwin_wl_output_description,
+};
+
+const struct wl_surface_listener cwin_wl_surface_listener = {
+  .enter = cwin_wl_surface_enter,
+  .leave = cwin_wl_surface_leave,
+  .preferred_buffer_scale = cwin_wl_surface_preferred_buffer_scale,
+  .preferred_buffer_transform = cwin_wl_surface_preferred_buffer_transform,
+};
+
+const struct wp_fractional_scale_v1_listener
+cwin_wl_fractional_scale_listener = {
+  .preferred_scale = cwin_wl_fractional_preferred_scale,
+};
+
+const struct xdg_surface_listener cwin_wl_xdg_surface_listener = {
+  .configure = cwin_wl_xdg_surface_configure,
+};
+
+const struct xdg_toplevel_listener cwin_wl_xdg_toplevel_listener = {
+  .configure = cwin_wl_xdg_toplevel_configure,
+  .close = cwin_wl_xdg_toplevel_close,
+};
+
+const struct wl_buffer_listener cwin_wl_buffer_listener = {
+  .release = cwin_wl_buffer_release,
+};
+
+const struct wl_pointer_listener cwin_wl_pointer_listener = {
+  .enter = cwin_wl_pointer_enter,
+  .leave = cwin_wl_pointer_leave,
+  .motion = cwin_wl_pointer_motion,
+  .button = cwin_wl_pointer_button,
+  .axis = cwin_wl_pointer_axis,
+  .frame = cwin_wl_pointer_frame,
+  .axis_source = cwin_wl_pointer_axis_source,
+  .axis_stop = cwin_wl_pointer_axis_stop,
+  .axis_discrete = cwin_wl_pointer_axis_discrete,
+};
+
+const struct wl_keyboard_listener cwin_wl_keyboard_listener = {
+  .keymap = cwin_wl_keyboard_keymap,
+  .enter = cwin_wl_keyboard_enter,
+  .leave = cwin_wl_keyboard_leave,
+  .key = cwin_wl_keyboard_key,
+  .modifiers = cwin_wl_keyboard_modifiers,
+  .repeat_info = cwin_wl_keyboard_repeat_info,
+};
+
+const struct zwp_relative_pointer_v1_listener
+cwin_wl_relative_pointer_listener = {
+  .relative_motion = cwin_wl_relative_motion,
+};
+
+const struct wp_presentation_listener cwin_wl_presentation_listener = {
+  .clock_id = cwin_wl_presentation_clock_id,
+};
+
+const struct wl_callback_listener cwin_wl_frame_listener = {
+  .done = cwin_wl_frame_done,
+};
+
+const struct wp_presentation_feedback_listener cwin_wl_feedback_listener = {
+  .sync_output = cwin_wl_feedback_sync_output,
+  .presented = cwin_wl_feedback_presented,
+  .discarded = cwin_wl_feedback_discarded,
+};
+
+/* PLATFORM FUNCTIONS */
+
+void cwin_plat_get_state(struct cwin_window *window,
+                         struct cwin_window_state *state)
+{
+  state->width = cwin_wl_to_pixels(window, window->plat.width);
+  state->height = cwin_wl_to_pixels(window, window->plat.height);
+  state->screen_width = window->plat.width;
+  state->screen_height = window->plat.height;
+  state->scale = (float) window->plat.scale / WL_SCALE_DENOMINATOR;
+  state->screen_state = window->plat.screen_state;
+}
+
+/*
+ * Reads and dispatches whatever the compositor has sent, waiting up to
+ * timeout_ns for something to arrive. Requests are only flushed here, so
+ * everything cwin sends in between is batched into one write.
+ */
+enum cwin_error cwin_wl_dispatch(uint64_t timeout_ns)
+{
+  while (wl_display_prepare_read(wl.display) != 0)
+  {
+    wl.dispatch_time_ns = message_time_ns = cwin_plat_now_ns();
+    if (wl_display_dispatch_pending(wl.display) == -1)
+    {
+      return CWIN_ERROR_WL_INTERNAL;
+    }
+  }
+
+  /* EAGAIN means the socket is full, the rest is sent on the next call. */
+  if (wl_display_flush(wl.display) == -1 && errno != EAGAIN)
+  {
+    wl_display_cancel_read(wl.display);
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+
+  /* Wake up for the next key repeat. */
+  if (wl.repeat_next_ns != 0)
+  {
+    uint64_t now = cwin_plat_now_ns();
+    uint64_t until_repeat = wl.repeat_next_ns > now ?
+      wl.repeat_next_ns - now : 0;
+    if (until_repeat < timeout_ns)
+    {
+      timeout_ns = until_repeat;
+    }
+  }
+
+  int timeout = posix_timeout_ms(timeout_ns);
+  struct pollfd pfds[] = {
+    { .fd = wl_display_get_fd(wl.display), .events = POLLIN },
+    { .fd = posix.wake_fd, .events = POLLIN },
+    { .fd = posix.timer_fd, .events = POLLIN },
+  };
+  if (poll(pfds, 3, timeout) > 0 && (pfds[0].revents & POLLIN))
+  {
+    if (wl_display_read_events(wl.display) == -1)
+    {
+      return CWIN_ERROR_WL_INTERNAL;
+    }
+  } else
+  {
+    wl_display_cancel_read(wl.display);
+  }
+
+  if (pfds[1].revents & POLLIN)
+  {
+    cwin_plat_clear_wake();
+  }
+
+  wl.dispatch_time_ns = message_time_ns = cwin_plat_now_ns();
+
+  STATS_BEGIN("cwin translate");
+  int dispatched = wl_display_dispatch_pending(wl.display);
+  STATS_END(stats.translate_ns);
+  if (dispatched == -1)
+  {
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+
+  cwin_wl_repeat_key();
+  return CWIN_SUCCESS;
+}
+
+/* Sends the repeats of the held key that have come due. */
+void cwin_wl_repeat_key(void)
+{
+  struct cwin_window *window = wl.keyboard_focus;
+  if (wl.repeat_next_ns == 0 || window == NULL)
+  {
+    return;
+  }
+
+  uint64_t now = cwin_plat_now_ns();
+  uint64_t interval = 1000000000 / wl.repeat_rate;
+  /* After a stall, like a suspend, don't replay every missed repeat. */
+  if (now > wl.repeat_next_ns && now - wl.repeat_next_ns > 1000000000)
+  {
+    wl.repeat_next_ns = now;
+  }
+
+  while (wl.repeat_next_ns <= now)
+  {
+    keyboard_translate(window->queue, window, wl.repeat_key + 8, true, true,
+                       wl.repeat_next_ns);
+    wl.repeat_next_ns += interval;
+  }
+}
+
+enum cwin_error cwin_plat_pump_events(void)
+{
+  return cwin_wl_dispatch(0);
+}
+
+enum cwin_error cwin_plat_wait_events(uint64_t timeout_ns)
+{
+  return cwin_wl_dispatch(timeout_ns);
+}
+
+int cwin_plat_get_event_fd(void)
+{
+  return posix_get_event_fd(wl_display_get_fd(wl.display));
+}
+
+enum cwin_error cwin_plat_init(void)
+{
+  enum cwin_error err;
+
+  err = posix_init_wake();
+  if (err)
+  {
+    return err;
+  }
+
+  if (!keyboard_init())
+  {
+    keyboard_deinit();
+    posix_deinit_wake();
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+
+  wl.display = wl_display_connect(NULL);
+  if (wl.display == NULL)
+  {
+    keyboard_deinit();
+    posix_deinit_wake();
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+
+  wl.registry = wl_display_get_registry(wl.display);
+  wl_registry_add_listener(wl.registry, &cwin_wl_registry_listener, NULL);
+
+  /*
+   * The only roundtrip cwin makes, apart from listing monitors that haven't
+   * described themselves yet. Everything else is sent without waiting for
+   * the compositor.
+   */
+  if (wl_display_roundtrip(wl.display) == -1 || wl.compositor == NULL ||
+      wl.wm_base == NULL)
+  {
+    cwin_plat_deinit();
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_deinit(void)
+{
+  while (wl.outputs != NULL)
+  {
+    cwin_wl_destroy_output(wl.outputs);
+  }
+  if (wl.fractional_scale_manager != NULL)
+  {
+    wp_fractional_scale_manager_v1_destroy(wl.fractional_scale_manager);
+  }
+  if (wl.viewporter != NULL)
+  {
+    wp_viewporter_destroy(wl.viewporter);
+  }
+  if (wl.relative_pointer != NULL)
+  {
+    zwp_relative_pointer_v1_destroy(wl.relative_pointer);
+  }
+  if (wl.relative_pointer_manager != NULL)
+  {
+    zwp_relative_pointer_manager_v1_destroy(wl.relative_pointer_manager);
+  }
+  if (wl.pointer_constraints != NULL)
+  {
+    zwp_pointer_constraints_v1_destroy(wl.pointer_constraints);
+  }
+  if (wl.presentation != NULL)
+  {
+    wp_presentation_destroy(wl.presentation);
+  }
+  if (wl.pointer != NULL)
+  {
+    wl_pointer_destroy(wl.pointer);
+  }
+  if (wl.keyboard != NULL)
+  {
+    wl_keyboard_destroy(wl.keyboard);
+  }
+  if (wl.seat != NULL)
+  {
+    wl_seat_destroy(wl.seat);
+  }
+  if (wl.wm_base != NULL)
+  {
+    xdg_wm_base_destroy(wl.wm_base);
+  }
+  if (wl.shm != NULL)
+  {
+    wl_shm_destroy(wl.shm);
+  }
+  if (wl.compositor != NULL)
+  {
+    wl_compositor_destroy(wl.compositor);
+  }
+  if (wl.registry != NULL)
+  {
+    wl_registry_destroy(wl.registry);
+  }
+  wl_display_disconnect(wl.display);
+  keyboard_deinit();
+  posix_deinit_wake();
+  memset(&wl, 0, sizeof(wl));
+}
+
+enum cwin_error cwin_plat_init_window(struct cwin_window *window,
+                                      struct cwin_window_builder *builder)
+{
+  /* Wayland clients can't position their windows. */
+  window->plat.width = builder->width;
+  window->plat.height = builder->height;
+  if (builder->width == CWIN_WINDOW_SIZE_UNDEFINED)
+  {
+    window->plat.width = WL_DEFAULT_WIDTH;
+  }
+  if (builder->height == CWIN_WINDOW_SIZE_UNDEFINED)
+  {
+    window->plat.height = WL_DEFAULT_HEIGHT;
+  }
+  window->plat.pending_width = window->plat.width;
+  window->plat.pending_height = window->plat.height;
+  window->plat.scale = WL_SCALE_DENOMINATOR;
+  window->plat.buffer_scale = 1;
+  window->plat.viewport = NULL;
+  window->plat.fractional_scale = NULL;
+  window->plat.screen_state = CWIN_SCREEN_WINDOWED;
+  window->plat.output_id = 0;
+  window->plat.configured = false;
+  window->plat.locked_pointer = NULL;
+  window->plat.frame_callback = NULL;
+  window->plat.feedback = NULL;
+  window->plat.presented_ns = window->plat.refresh_ns = 0;
+
+  /* set_title needs a null terminated string. */
+  char *title = NULL;
+  if (builder->name != NULL && builder->name_len != 0)
+  {
+    title = scratch_reserve(builder->name_len + 1);
+    if (title == NULL)
+    {
+      return CWIN_ERROR_OOM;
+    }
+    memcpy(title, builder->name, builder->name_len);
+    title[builder->name_len] = '\0';
+  }
+
+  window->plat.surface = wl_compositor_create_surface(wl.compositor);
+  wl_proxy_set_tag((struct wl_proxy *) window->plat.surface,
+                   &CWIN_WL_SURFACE_TAG);
+  wl_surface_set_user_data(window->plat.surface, window);
+  wl_surface_add_listener(window->plat.surface, &cwin_wl_surface_listener,
+                          window);
+
+  /* The preferred scale arrives once the surface is on an output. */
+  if (wl.viewporter != NULL && wl.fractional_scale_manager != NULL)
+  {
+    window->plat.viewport = wp_viewporter_get_viewport(wl.viewporter,
+                                                       window->plat.surface);
+    window->plat.fractional_scale =
+      wp_fractional_scale_manager_v1_get_fractional_scale(
+        wl.fractional_scale_manager, window->plat.surface);
+    wp_fractional_scale_v1_add_listener(window->plat.fractional_scale,
+                                        &cwin_wl_fractional_scale_listener,
+                                        window);
+  }
+
+  window->plat.xdg_surface = xdg_wm_base_get_xdg_surface(wl.wm_base,
+                                                         window->plat.surface);
+  xdg_surface_add_listener(window->plat.xdg_surface,
+                           &cwin_wl_xdg_surface_listener, window);
+
+  window->plat.xdg_toplevel =
+    xdg_surface_get_toplevel(window->plat.xdg_surface);
+  xdg_toplevel_add_listener(window->plat.xdg_toplevel,
+                            &cwin_wl_xdg_toplevel_listener, window);
+
+  if (title != NULL)
+  {
+    xdg_toplevel_set_title(window->plat.xdg_toplevel, title);
+  } else if (builder->name != NULL)
+  {
+    xdg_toplevel_set_title(window->plat.xdg_toplevel,
+                           (const char *) builder->name);
+  }
+
+  /*
+   * Committing without a buffer makes the compositor send the first
+   * configure. It is handled whenever events are next pumped, there is no
+   * roundtrip here.
+   */
+  wl_surface_commit(window->plat.surface);
+  if (wl_display_flush(wl.display) == -1 && errno != EAGAIN)
+  {
+    cwin_plat_deinit_window(window);
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_deinit_window(struct cwin_window *window)
+{
+  if (wl.pointer_focus == window)
+  {
+    wl.pointer_focus = NULL;
+  }
+  if (wl.keyboard_focus == window)
+  {
+    wl.keyboard_focus = NULL;
+    wl.repeat_next_ns = 0;
+  }
+  if (window->plat.locked_pointer != NULL)
+  {
+    zwp_locked_pointer_v1_destroy(window->plat.locked_pointer);
+  }
+  if (window->plat.frame_callback != NULL)
+  {
+    wl_callback_destroy(window->plat.frame_callback);
+  }
+  if (window->plat.feedback != NULL)
+  {
+    wp_presentation_feedback_destroy(window->plat.feedback);
+  }
+  if (window->plat.fractional_scale != NULL)
+  {
+    wp_fractional_scale_v1_destroy(window->plat.fractional_scale);
+    wp_viewport_destroy(window->plat.viewport);
+  }
+
+  xdg_toplevel_destroy(window->plat.xdg_toplevel);
+  xdg_surface_destroy(window->plat.xdg_surface);
+  wl_surface_destroy(window->plat.surface);
+  wl_display_flush(wl.display);
+}
+
+void cwin_plat_get_raw_window(struct cwin_window *window,
+                              struct cwin_raw_window *raw)
+{
+  raw->t = CWIN_RAW_WINDOW_WAYLAND;
+  raw->wayland.display = wl.display;
+  raw->wayland.surface = window->plat.surface;
+}
+
+/* Input is subscribed to per seat, not per surface, so masked events can only
+   be dropped. */
+void cwin_plat_set_event_mask(struct cwin_window *window)
+{
+  (void) window;
+}
+
+void cwin_plat_set_screen_state(struct cwin_window *window,
+                                enum cwin_screen_state state)
+{
+  if (state == window->plat.screen_state)
+  {
+    return;
+  }
+
+  /* Compositors scan fullscreen surfaces out directly when they can, so
+     both states ask for the same thing. */
+  switch (state)
+  {
+  case CWIN_SCREEN_FULLSCREEN:
+  case CWIN_SCREEN_DESKTOP:
+    xdg_toplevel_set_fullscreen(window->plat.xdg_toplevel, NULL);
+    break;
+  case CWIN_SCREEN_WINDOWED:
+    xdg_toplevel_unset_fullscreen(window->plat.xdg_toplevel);
+    break;
+  }
+
+  wl_display_flush(wl.display);
+  window->plat.screen_state = state;
+}
+
+enum cwin_error cwin_get_monitors(struct cwin_monitor *monitors, int *count)
+{
+  bool described = true;
+  for (struct cwin_wl_output *it = wl.outputs; it != NULL; it = it->next)
+  {
+    described = described && it->done;
+  }
+  if (!described && wl_display_roundtrip(wl.display) == -1)
+  {
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+
+  int len = 0;
+  int capacity = monitors != NULL ? *count : INT_MAX;
+  for (struct cwin_wl_output *it = wl.outputs; it != NULL && len < capacity;
+       it = it->next)
+  {
+    if (!it->done)
+    {
+      continue;
+    }
+    if (monitors != NULL)
+    {
+      monitors[len] = it->info;
+    }
+    len++;
+  }
+
+  *count = len;
+  return CWIN_SUCCESS;
+}
+
+/* wl_output only describes the current mode. */
+enum cwin_error cwin_monitor_get_modes(uint64_t monitor,
+                                       struct cwin_monitor_mode *modes,
+                                       int *count)
+{
+  struct cwin_wl_output *output = cwin_wl_find_output(monitor);
+  if (output == NULL)
+  {
+    return CWIN_ERROR_INVALID_MONITOR;
+  }
+
+  copy_list(modes, count, &output->info.mode, 1, sizeof(output->info.mode));
+  return CWIN_SUCCESS;
+}
+
+/*
+ * Clients can't change modes, so only the current one is accepted. Monitor 0
+ * is the output the window is on, the compositor picks one if it isn't on
+ * any yet, but a mode can't be checked then.
+ */
+enum cwin_error cwin_plat_set_fullscreen(
+  struct cwin_window *window, uint64_t monitor,
+  const struct cwin_monitor_mode *mode)
+{
+  struct wl_output *handle = NULL;
+  struct cwin_wl_output *output = cwin_wl_find_output(
+    monitor != 0 ? monitor : window->plat.output_id);
+  if (output != NULL)
+  {
+    handle = output->output;
+  } else if (monitor != 0)
+  {
+    return CWIN_ERROR_INVALID_MONITOR;
+  }
+
+  if (mode != NULL &&
+      (output == NULL || pick_mode(&output->info.mode, 1, mode) == -1))
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  xdg_toplevel_set_fullscreen(window->plat.xdg_toplevel, handle);
+  wl_display_flush(wl.display);
+  window->plat.screen_state = CWIN_SCREEN_FULLSCREEN;
+  return CWIN_SUCCESS;
+}
+
+struct cwin_wl_output *cwin_wl_find_output(uint64_t id)
+{
+  for (struct cwin_wl_output *it = wl.outputs; it != NULL; it = it->next)
+  {
+    if (it->info.id == id && it->done)
+    {
+      return it;
+    }
+  }
+  return NULL;
+}
+
+/* Outputs that fail to allocate are left out of cwin_get_monitors. */
+void cwin_wl_bind_output(uint32_t name, uint32_t version)
+{
+  struct cwin_wl_output *output = CWIN_NEW(struct cwin_wl_output);
+  if (output == NULL)
+  {
+    return;
+  }
+
+  /* Version 4 sends wl_output.name. */
+  memset(output, 0, sizeof(*output));
+  output->version = version < 4 ? version : 4;
+  output->output = wl_registry_bind(wl.registry, name, &wl_output_interface,
+                                    output->version);
+  output->info.id = name;
+  output->scale = 1;
+  wl_output_add_listener(output->output, &cwin_wl_output_listener, output);
+  output->next = wl.outputs;
+  wl.outputs = output;
+}
+
+void cwin_wl_destroy_output(struct cwin_wl_output *output)
+{
+  struct cwin_wl_output **it = &wl.outputs;
+  while (*it != output)
+  {
+    it = &(*it)->next;
+  }
+  *it = output->next;
+
+  if (output->version >= 3)
+  {
+    wl_output_release(output->output);
+  } else
+  {
+    wl_output_destroy(output->output);
+  }
+  CWIN_FREE(struct cwin_wl_output, output);
+}
+
+/* The size hints are double buffered, so they apply on the next commit. */
+void cwin_plat_set_maximum_size(struct cwin_window *window,
+                                int max_width, int max_height)
+{
+  xdg_toplevel_set_max_size(window->plat.xdg_toplevel, max_width, max_height);
+  wl_surface_commit(window->plat.surface);
+  wl_display_flush(wl.display);
+}
+
+void cwin_plat_set_minimum_size(struct cwin_window *window,
+                                int min_width, int min_height)
+{
+  xdg_toplevel_set_min_size(window->plat.xdg_toplevel, min_width, min_height);
+  wl_surface_commit(window->plat.surface);
+  wl_display_flush(wl.display);
+}
+
+/*
+ * Frame callbacks and presentation feedback are double buffered, so they
+ * belong to whatever commits the surface next, cwin_framebuffer_present or
+ * the Vulkan driver. Committing here would show a frame early.
+ */
+enum cwin_error cwin_window_request_frame(struct cwin_window *window)
+{
+  if (window->plat.frame_callback == NULL)
+  {
+    window->plat.frame_callback = wl_surface_frame(window->plat.surface);
+    wl_callback_add_listener(window->plat.frame_callback,
+                             &cwin_wl_frame_listener, window);
+  }
+  if (wl.presentation != NULL && window->plat.feedback == NULL)
+  {
+    window->plat.feedback = wp_presentation_feedback(wl.presentation,
+                                                     window->plat.surface);
+    wp_presentation_feedback_add_listener(window->plat.feedback,
+                                          &cwin_wl_feedback_listener, window);
+  }
+
+  if (wl_display_flush(wl.display) == -1 && errno != EAGAIN)
+  {
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+  return CWIN_SUCCESS;
+}
+
+/* The compositor already gives the focused surface an implicit grab while a
+   button is held. */
+void cwin_mouse_capture(struct cwin_window *window)
+{
+  (void) window;
+}
+
+void cwin_mouse_uncapture(struct cwin_window *window)
+{
+  (void) window;
+}
+
+enum cwin_error cwin_plat_create_buffer(struct cwin_window *window, int index)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  if (wl.shm == NULL)
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  int stride = framebuffer->width * 4;
+  size_t size = (size_t) stride * framebuffer->height;
+  int fd = posix_create_shm(size);
+  if (fd == -1)
+  {
+    return CWIN_ERROR_POSIX_INTERNAL;
+  }
+
+  void *pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (pixels == MAP_FAILED)
+  {
+    close(fd);
+    return CWIN_ERROR_POSIX_INTERNAL;
+  }
+
+  /* The buffer keeps the pool's memory alive, the pool isn't needed. */
+  struct wl_shm_pool *pool = wl_shm_create_pool(wl.shm, fd, size);
+  window->plat.buffers[index] =
+    wl_shm_pool_create_buffer(pool, 0, framebuffer->width,
+                              framebuffer->height, stride,
+                              WL_SHM_FORMAT_XRGB8888);
+  wl_shm_pool_destroy(pool);
+  close(fd);
+  wl_buffer_add_listener(window->plat.buffers[index], &cwin_wl_buffer_listener,
+                         window);
+
+  framebuffer->buffers[index].pixels = pixels;
+  return CWIN_SUCCESS;
+}
+
+/* The compositor keeps showing a destroyed buffer's contents as long as it
+   needs them. */
+void cwin_plat_destroy_buffer(struct cwin_window *window, int index)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  wl_buffer_destroy(window->plat.buffers[index]);
+  window->plat.buffers[index] = NULL;
+  munmap(framebuffer->buffers[index].pixels,
+         (size_t) framebuffer->width * 4 * framebuffer->height);
+}
+
+enum cwin_error cwin_plat_wait_buffer(struct cwin_window *window)
+{
+  (void) window;
+  return cwin_wl_dispatch(CWIN_WAIT_FOREVER);
+}
+
+/*
+ * The buffer is attached as is, the compositor reads straight from it until
+ * it sends wl_buffer.release. Nothing may be attached before the first
+ * configure, frames presented before then are dropped.
+ */
+enum cwin_error cwin_plat_present_buffer(struct cwin_window *window,
+                                         int index,
+                                         const struct cwin_rect *damage,
+                                         size_t damage_count)
+{
+  if (!window->plat.configured)
+  {
+    return CWIN_SUCCESS;
+  }
+
+  /* A buffer of the old size keeps the old scale. */
+  struct wl_surface *surface = window->plat.surface;
+  int buffer_scale = window->plat.scale / WL_SCALE_DENOMINATOR;
+  if (window->plat.viewport == NULL &&
+      buffer_scale != window->plat.buffer_scale &&
+      window->framebuffer.width ==
+        cwin_wl_to_pixels(window, window->plat.width) &&
+      window->framebuffer.height ==
+        cwin_wl_to_pixels(window, window->plat.height))
+  {
+    wl_surface_set_buffer_scale(surface, buffer_scale);
+    window->plat.buffer_scale = buffer_scale;
+  }
+  wl_surface_attach(surface, window->plat.buffers[index], 0, 0);
+  /* Buffer coordinates are the same as surface coordinates at scale 1, which
+     is all surfaces older than version 4 can be, since buffer scales need
+     version 6 here and fractional scales come with newer compositors. */
+  bool damage_buffer =
+    wl_proxy_get_version((struct wl_proxy *) surface) >= 4;
+  for (size_t i = 0; i < damage_count; i++)
+  {
+    if (damage_buffer)
+    {
+      wl_surface_damage_buffer(surface, damage[i].x, damage[i].y,
+                               damage[i].width, damage[i].height);
+    } else
+    {
+      wl_surface_damage(surface, damage[i].x, damage[i].y, damage[i].width,
+                        damage[i].height);
+    }
+  }
+  wl_surface_commit(surface);
+  window->framebuffer.buffers[index].busy = true;
+
+  if (wl_display_flush(wl.display) == -1 && errno != EAGAIN)
+  {
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+  return CWIN_SUCCESS;
+}
+
+/*
+ * The lock only takes effect while the surface has pointer focus, and the
+ * compositor stops sending wl_pointer.motion while it is active. There is no
+ * cursor theme to restore when relative mode ends, so the cursor stays hidden
+ * until the compositor picks one on the next enter.
+ */
+enum cwin_error cwin_mouse_set_relative(struct cwin_window *window,
+                                        bool relative)
+{
+  if (!relative)
+  {
+    if (window->plat.locked_pointer != NULL)
+    {
+      zwp_locked_pointer_v1_destroy(window->plat.locked_pointer);
+      window->plat.locked_pointer = NULL;
+      wl_display_flush(wl.display);
+    }
+    return CWIN_SUCCESS;
+  }
+
+  if (wl.relative_pointer_manager == NULL || wl.pointer_constraints == NULL ||
+      wl.pointer == NULL)
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+  if (window->plat.locked_pointer != NULL)
+  {
+    return CWIN_SUCCESS;
+  }
+
+  if (wl.relative_pointer == NULL)
+  {
+    wl.relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(
+      wl.relative_pointer_manager, wl.pointer);
+    zwp_relative_pointer_v1_add_listener(wl.relative_pointer,
+                                         &cwin_wl_relative_pointer_listener,
+                                         NULL);
+  }
+
+  window->plat.locked_pointer = zwp_pointer_constraints_v1_lock_pointer(
+    wl.pointer_constraints, window->plat.surface, wl.pointer, NULL,
+    ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT);
+  if (wl.pointer_focus == window)
+  {
+    wl_pointer_set_cursor(wl.pointer, wl.pointer_enter_serial, NULL, 0, 0);
+  }
+
+  if (wl_display_flush(wl.display) == -1 && errno != EAGAIN)
+  {
+    return CWIN_ERROR_WL_INTERNAL;
+  }
+  return CWIN_SUCCESS;
+}
+
+/* Rounds like the compositor does when it scales the surface. */
+int cwin_wl_to_pixels(struct cwin_window *window, int value)
+{
+  return scale_round((float) value * window->plat.scale /
+                     WL_SCALE_DENOMINATOR);
+}
+
+int cwin_wl_fixed_to_pixels(struct cwin_window *window, wl_fixed_t value)
+{
+  return (int) (wl_fixed_to_double(value) * window->plat.scale /
+                WL_SCALE_DENOMINATOR);
+}
+
+/*
+ * Maps the buffer's pixels onto the surface, double buffered like the buffer
+ * itself so both apply on the application's next commit. The viewport scales
+ * any buffer to the surface size, a buffer scale needs the buffer's size to be
+ * a multiple of it. With a framebuffer, the buffer scale is left for
+ * cwin_plat_present_buffer to set along with a buffer of the new size. The
+ * Vulkan driver's next commit takes it otherwise, which is why the swapchain
+ * has to be recreated before presenting again.
+ */
+void cwin_wl_apply_scale(struct cwin_window *window)
+{
+  int buffer_scale = window->plat.scale / WL_SCALE_DENOMINATOR;
+  if (window->plat.viewport != NULL)
+  {
+    wp_viewport_set_destination(window->plat.viewport, window->plat.width,
+                                window->plat.height);
+  } else if (window->framebuffer.buffer_count == 0 &&
+             buffer_scale != window->plat.buffer_scale)
+  {
+    wl_surface_set_buffer_scale(window->plat.surface, buffer_scale);
+    window->plat.buffer_scale = buffer_scale;
+  }
+}
+
+/* The surface keeps its size, so the pixel size follows the scale. */
+void cwin_wl_set_scale(struct cwin_window *window, int scale)
+{
+  if (scale <= 0 || scale == window->plat.scale)
+  {
+    return;
+  }
+
+  int width = cwin_wl_to_pixels(window, window->plat.width);
+  int height = cwin_wl_to_pixels(window, window->plat.height);
+  window->plat.scale = scale;
+  cwin_wl_apply_scale(window);
+  publish_window_state(window);
+
+  alloc_scale_event(window->queue, window,
+                    (float) scale / WL_SCALE_DENOMINATOR);
+  if (cwin_wl_to_pixels(window, window->plat.width) != width ||
+      cwin_wl_to_pixels(window, window->plat.height) != height)
+  {
+    cwin_wl_send_resize(window);
+  }
+}
+
+void cwin_wl_send_resize(struct cwin_window *window)
+{
+  struct cwin_event *event =
+    alloc_window_event(window->queue, CWIN_WINDOW_EVENT_RESIZE, window);
+  if (event != NULL)
+  {
+    event->window.width = cwin_wl_to_pixels(window, window->plat.width);
+    event->window.height = cwin_wl_to_pixels(window, window->plat.height);
+  }
+}
+
+struct cwin_window *cwin_wl_surface_to_window(struct wl_surface *surface)
+{
+  if (surface == NULL ||
+      wl_proxy_get_tag((struct wl_proxy *) surface) != &CWIN_WL_SURFACE_TAG)
+  {
+    return NULL;
+  }
+
+  return wl_surface_get_user_data(surface);
+}
+
+void cwin_wl_registry_global(void *data, struct wl_registry *registry,
+                             uint32_t name, const char *interface,
+                             uint32_t version)
+{
+  (void) data;
+
+  if (strcmp(interface, wl_compositor_interface.name) == 0)
+  {
+    /* Version 6 sends wl_surface.preferred_buffer_scale. */
+    wl.compositor = wl_registry_bind(registry, name, &wl_compositor_interface,
+                                     version < 6 ? version : 6);
+  } else if (strcmp(interface, xdg_wm_base_interface.name) == 0)
+  {
+    wl.wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+    xdg_wm_base_add_listener(wl.wm_base, &cwin_wl_wm_base_listener, NULL);
+  } else if (strcmp(interface, wl_shm_interface.name) == 0)
+  {
+    /* XRGB8888 is always supported, so the format events aren't needed. */
+    wl.shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+  } else if (strcmp(interface, wl_seat_interface.name) == 0 && wl.seat == NULL)
+  {
+    wl.seat = wl_registry_bind(registry, name, &wl_seat_interface,
+                               version < 5 ? version : 5);
+    wl_seat_add_listener(wl.seat, &cwin_wl_seat_listener, NULL);
+  } else if (strcmp(interface,
+                    zwp_relative_pointer_manager_v1_interface.name) == 0)
+  {
+    wl.relative_pointer_manager =
+      wl_registry_bind(registry, name,
+                       &zwp_relative_pointer_manager_v1_interface, 1);
+  } else if (strcmp(interface,
+                    zwp_pointer_constraints_v1_interface.name) == 0)
+  {
+    wl.pointer_constraints =
+      wl_registry_bind(registry, name, &zwp_pointer_constraints_v1_interface,
+                       1);
+  } else if (strcmp(interface, wp_presentation_interface.name) == 0)
+  {
+    wl.presentation = wl_registry_bind(registry, name,
+                                       &wp_presentation_interface, 1);
+    wp_presentation_add_listener(wl.presentation,
+                                 &cwin_wl_presentation_listener, NULL);
+  } else if (strcmp(interface, wp_viewporter_interface.name) == 0)
+  {
+    wl.viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface,
+                                     1);
+  } else if (strcmp(interface,
+                    wp_fractional_scale_manager_v1_interface.name) == 0)
+  {
+    wl.fractional_scale_manager =
+      wl_registry_bind(registry, name,
+                       &wp_fractional_scale_manager_v1_interface, 1);
+  } else if (strcmp(interface, wl_output_interface.name) == 0)
+  {
+    cwin_wl_bind_output(name, version);
+  }
+}
+
+void cwin_wl_registry_global_remove(void *data,
+                                    struct wl_registry *registry,
+                                    uint32_t name)
+{
+  (void) data;
+  (void) registry;
+
+  for (struct cwin_wl_output *it = wl.outputs; it != NULL; it = it->next)
+  {
+    if (it->info.id == name)
+    {
+      cwin_wl_destroy_output(it);
+      return;
+    }
+  }
+}
+
+void cwin_wl_wm_base_ping(void *data, struct xdg_wm_base *wm_base,
+                          uint32_t serial)
+{
+  (void) data;
+  xdg_wm_base_pong(wm_base, serial);
+}
+
+void cwin_wl_seat_capabilities(void *data, struct wl_seat *seat,
+                               uint32_t capabilities)
+{
+  (void) data;
+
+  bool has_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
+  if (has_pointer && wl.pointer == NULL)
+  {
+    wl.pointer = wl_seat_get_pointer(seat);
+    wl_pointer_add_listener(wl.pointer, &cwin_wl_pointer_listener, NULL);
+  } else if (!has_pointer && wl.pointer != NULL)
+  {
+    if (wl.relative_pointer != NULL)
+    {
+      zwp_relative_pointer_v1_destroy(wl.relative_pointer);
+      wl.relative_pointer = NULL;
+    }
+    wl_pointer_destroy(wl.pointer);
+    wl.pointer = NULL;
+    wl.pointer_focus = NULL;
+  }
+
+  bool has_keyboard = capabilities & WL_SEAT_CAPABILITY_KEYBOARD;
+  if (has_keyboard && wl.keyboard == NULL)
+  {
+    wl.keyboard = wl_seat_get_keyboard(seat);
+    wl_keyboard_add_listener(wl.keyboard, &cwin_wl_keyboard_listener, NULL);
+  } else if (!has_keyboard && wl.keyboard != NULL)
+  {
+    wl_keyboard_destroy(wl.keyboard);
+    wl.keyboard = NULL;
+    wl.keyboard_focus = NULL;
+    wl.repeat_next_ns = 0;
+  }
+}
+
+void cwin_wl_seat_name(void *data, struct wl_seat *seat, const char *name)
+{
+  (void) data;
+  (void) seat;
+  (void) name;
+}
+
+/* Before version 4 the model is the only name. */
+void cwin_wl_output_geometry(void *data, struct wl_output *output,
+                             int32_t x, int32_t y, int32_t physical_width,
+                             int32_t physical_height, int32_t subpixel,
+                             const char *make, const char *model,
+                             int32_t transform)
+{
+  struct cwin_wl_output *it = data;
+  (void) output;
+  (void) subpixel;
+  (void) make;
+
+  it->info.x = x;
+  it->info.y = y;
+  it->info.width_mm = physical_width;
+  it->info.height_mm = physical_height;
+  it->transform = transform;
+  if (it->version < 4)
+  {
+    copy_monitor_name(it->info.name, model, strlen(model));
+  }
+}
+
+void cwin_wl_output_mode(void *data, struct wl_output *output,
+                         uint32_t flags, int32_t width, int32_t height,
+                         int32_t refresh)
+{
+  struct cwin_wl_output *it = data;
+  (void) output;
+
+  if (flags & WL_OUTPUT_MODE_CURRENT)
+  {
+    it->info.mode.width = width;
+    it->info.mode.height = height;
+    it->info.mode.refresh_mhz = refresh > 0 ? (uint32_t) refresh : 0;
+  }
+}
+
+/* The compositor's logical size, which xdg-output would report exactly, is
+   the mode turned by the transform and divided by the scale. */
+void cwin_wl_output_done(void *data, struct wl_output *output)
+{
+  struct cwin_wl_output *it = data;
+  (void) output;
+
+  int width = it->info.mode.width;
+  int height = it->info.mode.height;
+  if (it->transform & 1)
+  {
+    width = it->info.mode.height;
+    height = it->info.mode.width;
+  }
+  it->info.width = width / it->scale;
+  it->info.height = height / it->scale;
+  it->info.scale = (float) it->scale;
+  it->done = true;
+}
+
+void cwin_wl_output_scale(void *data, struct wl_output *output,
+                          int32_t factor)
+{
+  struct cwin_wl_output *it = data;
+  (void) output;
+  it->scale = factor > 0 ? factor : 1;
+}
+
+void cwin_wl_output_name(void *data, struct wl_output *output,
+                         const char *name)
+{
+  struct cwin_wl_output *it = data;
+  (void) output;
+  copy_monitor_name(it->info.name, name, strlen(name));
+}
+
+void cwin_wl_output_description(void *data, struct wl_output *output,
+                                const char *description)
+{
+  (void) data;
+  (void) output;
+  (void) description;
+}
+
+void cwin_wl_surface_enter(void *data, struct wl_surface *surface,
+                           struct wl_output *output)
+{
+  struct cwin_window *window = data;
+  (void) surface;
+
+  for (struct cwin_wl_output *it = wl.outputs; it != NULL; it = it->next)
+  {
+    if (it->output == output)
+    {
+      window->plat.output_id = it->info.id;
+    }
+  }
+}
+
+void cwin_wl_surface_leave(void *data, struct wl_surface *surface,
+                           struct wl_output *output)
+{
+  struct cwin_window *window = data;
+  (void) surface;
+
+  struct cwin_wl_output *it = cwin_wl_find_output(window->plat.output_id);
+  if (it != NULL && it->output == output)
+  {
+    window->plat.output_id = 0;
+  }
+}
+
+/* Only used without fractional scaling, which would also send it. */
+void cwin_wl_surface_preferred_buffer_scale(void *data,
+                                            struct wl_surface *surface,
+                                            int32_t factor)
+{
+  struct cwin_window *window = data;
+  (void) surface;
+
+  if (window->plat.viewport == NULL)
+  {
+    cwin_wl_set_scale(window, factor * WL_SCALE_DENOMINATOR);
+  }
+}
+
+void cwin_wl_surface_preferred_buffer_transform(void *data,
+                                                struct wl_surface *surface,
+                                                uint32_t transform)
+{
+  (void) data;
+  (void) surface;
+  (void) transform;
+}
+
+void cwin_wl_fractional_preferred_scale(
+  void *data, struct wp_fractional_scale_v1 *fractional_scale,
+  uint32_t scale)
+{
+  struct cwin_window *window = data;
+  (void) fractional_scale;
+
+  cwin_wl_set_scale(window, (int) scale);
+}
+
+void cwin_wl_xdg_surface_configure(void *data,
+                                   struct xdg_surface *xdg_surface,
+                                   uint32_t serial)
+{
+  struct cwin_window *window = data;
+
+  xdg_surface_ack_configure(xdg_surface, serial);
+
+  if (window->plat.configured &&
+      window->plat.pending_width == window->plat.width &&
+      window->plat.pending_height == window->plat.height)
+  {
+    return;
+  }
+
+  bool resized = window->plat.pending_width != window->plat.width ||
+    window->plat.pending_height != window->plat.height;
+  window->plat.configured = true;
+  window->plat.width = window->plat.pending_width;
+  window->plat.height = window->plat.pending_height;
+  cwin_wl_apply_scale(window);
+  publish_window_state(window);
+
+  if (resized)
+  {
+    cwin_wl_send_resize(window);
+  }
+}
+
+void cwin_wl_xdg_toplevel_configure(void *data,
+                                    struct xdg_toplevel *xdg_toplevel,
+                                    int32_t width, int32_t height,
+                                    struct wl_array *states)
+{
+  struct cwin_window *window = data;
+  (void) xdg_toplevel;
+  (void) states;
+
+  /* 0 leaves the size up to us, so keep the current one. */
+  if (width != 0)
+  {
+    window->plat.pending_width = width;
+  }
+  if (height != 0)
+  {
+    window->plat.pending_height = height;
+  }
+}
+
+void cwin_wl_xdg_toplevel_close(void *data,
+                                struct xdg_toplevel *xdg_toplevel)
+{
+  struct cwin_window *window = data;
+  (void) xdg_toplevel;
+
+  alloc_window_event(window->queue, CWIN_WINDOW_EVENT_CLOSE, window);
+}
+
+void cwin_wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+  struct cwin_window *window = data;
+  for (int i = 0; i < window->framebuffer.buffer_count; i++)
+  {
+    if (window->plat.buffers[i] == wl_buffer)
+    {
+      window->framebuffer.buffers[i].busy = false;
+    }
+  }
+}
+
+void cwin_wl_pointer_enter(void *data, struct wl_pointer *pointer,
+                           uint32_t serial, struct wl_surface *surface,
+                           wl_fixed_t x, wl_fixed_t y)
+{
+  struct cwin_event *event;
+  (void) data;
+
+  struct cwin_window *window = cwin_wl_surface_to_window(surface);
+  wl.pointer_focus = window;
+  wl.pointer_enter_serial = serial;
+  if (window == NULL)
+  {
+    return;
+  }
+
+  alloc_window_event(window->queue, CWIN_WINDOW_EVENT_ENTER, window);
+  if (window->plat.locked_pointer != NULL)
+  {
+    wl_pointer_set_cursor(pointer, serial, NULL, 0, 0);
+  }
+
+  event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_MOVE, window);
+  if (event != NULL)
+  {
+    event->mouse.x = cwin_wl_fixed_to_pixels(window, x);
+    event->mouse.y = cwin_wl_fixed_to_pixels(window, y);
+  }
+}
+
+void cwin_wl_pointer_leave(void *data, struct wl_pointer *pointer,
+                           uint32_t serial, struct wl_surface *surface)
+{
+  (void) data;
+  (void) pointer;
+  (void) serial;
+  (void) surface;
+
+  struct cwin_window *window = wl.pointer_focus;
+  wl.pointer_focus = NULL;
+  if (window == NULL)
+  {
+    return;
+  }
+
+  alloc_window_event(window->queue, CWIN_WINDOW_EVENT_EXIT, window);
+}
+
+void cwin_wl_pointer_motion(void *data, struct wl_pointer *pointer,
+                            uint32_t time, wl_fixed_t x, wl_fixed_t y)
+{
+  struct cwin_event *event;
+  (void) data;
+  (void) pointer;
+
+  struct cwin_window *window = wl.pointer_focus;
+  if (window == NULL)
+  {
+    return;
+  }
+
+  event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_MOVE, window);
+  if (event != NULL)
+  {
+    event->time_ns = posix_event_time(time, wl.dispatch_time_ns);
+    event->mouse.x = cwin_wl_fixed_to_pixels(window, x);
+    event->mouse.y = cwin_wl_fixed_to_pixels(window, y);
+  }
+}
+
+void cwin_wl_pointer_button(void *data, struct wl_pointer *pointer,
+                            uint32_t serial, uint32_t time, uint32_t button,
+                            uint32_t state)
+{
+  struct cwin_event *event;
+  enum cwin_mouse_button cwin_button;
+  (void) data;
+  (void) pointer;
+  (void) serial;
+
+  struct cwin_window *window = wl.pointer_focus;
+  if (window == NULL)
+  {
+    return;
+  }
+
+  switch (button)
+  {
+  case BTN_LEFT:
+    cwin_button = CWIN_MOUSE_BUTTON_LEFT;
+    break;
+  case BTN_MIDDLE:
+    cwin_button = CWIN_MOUSE_BUTTON_MIDDLE;
+    break;
+  case BTN_RIGHT:
+    cwin_button = CWIN_MOUSE_BUTTON_RIGHT;
+    break;
+  default:
+    return;
+  }
+
+  event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_BUTTON, window);
+  if (event != NULL)
+  {
+    event->time_ns = posix_event_time(time, wl.dispatch_time_ns);
+    event->mouse.state = state == WL_POINTER_BUTTON_STATE_PRESSED ?
+      CWIN_BUTTON_DOWN : CWIN_BUTTON_UP;
+    event->mouse.button = cwin_button;
+  }
+}
+
+void cwin_wl_pointer_axis(void *data, struct wl_pointer *pointer, uint32_t time,
+                          uint32_t axis, wl_fixed_t value)
+{
+  struct cwin_event *event;
+  (void) data;
+  (void) pointer;
+
+  struct cwin_window *window = wl.pointer_focus;
+  if (window == NULL || axis != WL_POINTER_AXIS_VERTICAL_SCROLL)
+  {
+    return;
+  }
+
+  /*
+   * A wheel notch is usually 10 units scrolling down, scale it to the 120
+   * units scrolling up that Win32 reports.
+   */
+  event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_WHEEL, window);
+  if (event != NULL)
+  {
+    event->time_ns = posix_event_time(time, wl.dispatch_time_ns);
+    event->mouse.delta = (int) (-wl_fixed_to_double(value) * 12.0);
+  }
+}
+
+void cwin_wl_pointer_frame(void *data, struct wl_pointer *pointer)
+{
+  (void) data;
+  (void) pointer;
+}
+
+void cwin_wl_pointer_axis_source(void *data, struct wl_pointer *pointer,
+                                 uint32_t source)
+{
+  (void) data;
+  (void) pointer;
+  (void) source;
+}
+
+void cwin_wl_pointer_axis_stop(void *data, struct wl_pointer *pointer,
+                               uint32_t time, uint32_t axis)
+{
+  (void) data;
+  (void) pointer;
+  (void) time;
+  (void) axis;
+}
+
+void cwin_wl_pointer_axis_discrete(void *data, struct wl_pointer *pointer,
+                                   uint32_t axis, int32_t discrete)
+{
+  (void) data;
+  (void) pointer;
+  (void) axis;
+  (void) discrete;
+}
+
+void cwin_wl_keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
+                             uint32_t format, int32_t fd, uint32_t size)
+{
+  (void) data;
+  (void) wl_keyboard;
+
+  if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1)
+  {
+    close(fd);
+    return;
+  }
+
+  /* The keymap is a null terminated string, so size includes the
+     terminator. */
+  char *string = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (string == MAP_FAILED)
+  {
+    return;
+  }
+
+  struct xkb_keymap *keymap =
+    xkb_keymap_new_from_string(keyboard.context, string,
+                               XKB_KEYMAP_FORMAT_TEXT_V1,
+                               XKB_KEYMAP_COMPILE_NO_FLAGS);
+  munmap(string, size);
+  if (keymap == NULL)
+  {
+    return;
+  }
+
+  struct xkb_state *state = xkb_state_new(keymap);
+  if (state == NULL)
+  {
+    xkb_keymap_unref(keymap);
+    return;
+  }
+
+  keyboard_set_keymap(keymap, state);
+}
+
+void cwin_wl_keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
+                            uint32_t serial, struct wl_surface *surface,
+                            struct wl_array *keys)
+{
+  (void) data;
+  (void) wl_keyboard;
+  (void) serial;
+  (void) keys;
+
+  struct cwin_window *window = cwin_wl_surface_to_window(surface);
+  wl.keyboard_focus = window;
+  if (window == NULL)
+  {
+    return;
+  }
+
+  alloc_window_event(window->queue, CWIN_WINDOW_EVENT_FOCUS, window);
+}
+
+void cwin_wl_keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
+                            uint32_t serial, struct wl_surface *surface)
+{
+  (void) data;
+  (void) wl_keyboard;
+  (void) serial;
+  (void) surface;
+
+  struct cwin_window *window = wl.keyboard_focus;
+  wl.keyboard_focus = NULL;
+  wl.repeat_next_ns = 0;
+  if (window == NULL)
+  {
+    return;
+  }
+
+  alloc_window_event(window->queue, CWIN_WINDOW_EVENT_UNFOCUS, window);
+}
+
+void cwin_wl_keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
+                          uint32_t serial, uint32_t time, uint32_t key,
+                          uint32_t state)
+{
+  (void) data;
+  (void) wl_keyboard;
+  (void) serial;
+
+  /* Masked keys don't start repeating either. */
+  struct cwin_window *window = wl.keyboard_focus;
+  if (window == NULL || keyboard.keymap == NULL ||
+      !window_wants(window, CWIN_EVENT_MASK_KEY | CWIN_EVENT_MASK_TEXT))
+  {
+    return;
+  }
+
+  bool pressed = state == WL_KEYBOARD_KEY_STATE_PRESSED;
+  uint64_t time_ns = posix_event_time(time, wl.dispatch_time_ns);
+  keyboard_translate(window->queue, window, key + 8, pressed, false, time_ns);
+
+  if (pressed && wl.repeat_rate > 0 &&
+      xkb_keymap_key_repeats(keyboard.keymap, key + 8))
+  {
+    wl.repeat_key = key;
+    wl.repeat_next_ns = time_ns + (uint64_t) wl.repeat_delay * 1000000;
+  } else if (!pressed && key == wl.repeat_key)
+  {
+    wl.repeat_next_ns = 0;
+  }
+}
+
+void cwin_wl_keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
+                                uint32_t serial, uint32_t depressed,
+                                uint32_t latched, uint32_t locked,
+                                uint32_t group)
+{
+  (void) data;
+  (void) wl_keyboard;
+  (void) serial;
+
+  if (keyboard.keymap != NULL)
+  {
+    keyboard_update_mask(depressed, latched, locked, group);
+  }
+}
+
+void cwin_wl_keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
+                                  int32_t rate, int32_t delay)
+{
+  (void) data;
+  (void) wl_keyboard;
+
+  /* A rate of 0 turns repeating off. */
+  wl.repeat_rate = rate;
+  wl.repeat_delay = delay;
+  if (rate <= 0)
+  {
+    wl.repeat_next_ns = 0;
+  }
+}
+
+/* Sent alongside wl_pointer.motion, which stops while the lock is active. */
+void cwin_wl_relative_motion(void *data,
+                             struct zwp_relative_pointer_v1 *relative_pointer,
+                             uint32_t utime_hi, uint32_t utime_lo,
+                             wl_fixed_t dx, wl_fixed_t dy,
+                             wl_fixed_t dx_unaccel, wl_fixed_t dy_unaccel)
+{
+  struct cwin_event *event;
+  (void) data;
+  (void) relative_pointer;
+  (void) dx;
+  (void) dy;
+
+  struct cwin_window *window = wl.pointer_focus;
+  if (window == NULL || window->plat.locked_pointer == NULL)
+  {
+    return;
+  }
+
+  event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_RELATIVE, window);
+  if (event != NULL)
+  {
+    uint64_t utime = (uint64_t) utime_hi << 32 | utime_lo;
+    event->time_ns = posix_event_time((uint32_t) (utime / 1000),
+                                      wl.dispatch_time_ns);
+    event->mouse.dx = (float) wl_fixed_to_double(dx_unaccel);
+    event->mouse.dy = (float) wl_fixed_to_double(dy_unaccel);
+  }
+}
+
+void cwin_wl_presentation_clock_id(void *data,
+                                   struct wp_presentation *presentation,
+                                   uint32_t clk_id)
+{
+  (void) data;
+  (void) presentation;
+  wl.presentation_monotonic = clk_id == CLOCK_MONOTONIC;
+}
+
+/* Sent when the compositor starts on the next frame, which is when a new
+   one is most useful. */
+void cwin_wl_frame_done(void *data, struct wl_callback *callback,
+                        uint32_t time)
+{
+  struct cwin_event *event;
+  struct cwin_window *window = data;
+
+  wl_callback_destroy(callback);
+  window->plat.frame_callback = NULL;
+
+  event = alloc_frame_event(window->queue, window, window->plat.presented_ns,
+                            window->plat.presented_ns,
+                            window->plat.refresh_ns);
+  if (event != NULL)
+  {
+    event->time_ns = posix_event_time(time, wl.dispatch_time_ns);
+  }
+}
+
+void cwin_wl_feedback_sync_output(void *data,
+                                  struct wp_presentation_feedback *feedback,
+                                  struct wl_output *output)
+{
+  (void) data;
+  (void) feedback;
+  (void) output;
+}
+
+void cwin_wl_feedback_presented(void *data,
+                                struct wp_presentation_feedback *feedback,
+                                uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                                uint32_t tv_nsec, uint32_t refresh,
+                                uint32_t seq_hi, uint32_t seq_lo,
+                                uint32_t flags)
+{
+  struct cwin_window *window = data;
+  (void) seq_hi;
+  (void) seq_lo;
+  (void) flags;
+
+  wp_presentation_feedback_destroy(feedback);
+  window->plat.feedback = NULL;
+
+  if (wl.presentation_monotonic)
+  {
+    uint64_t seconds = (uint64_t) tv_sec_hi << 32 | tv_sec_lo;
+    window->plat.presented_ns = seconds * 1000000000 + tv_nsec;
+    window->plat.refresh_ns = refresh;
+  }
+}
+
+/* The frame was replaced before it was shown. */
+void cwin_wl_feedback_discarded(void *data,
+                                struct wp_presentation_feedback *feedback)
+{
+  struct cwin_window *window = data;
+  wp_presentation_feedback_destroy(feedback);
+  window->plat.feedback = NULL;
+}
+
+#ifdef CWIN_VULKAN
+
+const char *cwin_wl_vk_extensions[] = {
+  "VK_KHR_surface",
+  "VK_KHR_wayland_surface",
+};
+
+void cwin_vk_get_required_extensions(struct cwin_window *window,
+                                     const char **extensions,
+                                     int *extension_count)
+{
+  (void) window;
+
+  if (*extension_count == 0 || extensions == NULL)
+  {
+    *extension_count = sizeof(cwin_wl_vk_extensions) /
+      sizeof(cwin_wl_vk_extensions[0]);
+  } else
+  {
+    for (int i = 0; i < *extension_count; i++)
+    {
+      extensions[i] = cwin_wl_vk_extensions[i];
+    }
+  }
+}
+
+enum cwin_error cwin_vk_create_surface(struct cwin_window *window,
+                                       VkInstance instance,
+                                       VkSurfaceKHR *surface)
+{
+  VkResult err;
+
+  /*
+   * Presenting attaches a buffer, which is a protocol error before the first
+   * configure has been acked. This only ever blocks once per window.
+   */
+  while (!window->plat.configured)
+  {
+    wl.dispatch_time_ns = message_time_ns = cwin_plat_now_ns();
+    if (wl_display_dispatch(wl.display) == -1)
+    {
+      return CWIN_ERROR_WL_INTERNAL;
+    }
+  }
+
+  VkWaylandSurfaceCreateInfoKHR surface_create_info = {
+    .sType = VK_STRUCTURE_TYPE_WAYLAND_SURFACE_CREATE_INFO_KHR,
+    .display = wl.display,
+    .surface = window->plat.surface,
+  };
+
+  err = vkCreateWaylandSurfaceKHR(instance, &surface_create_info, NULL,
+                                  surface);
+  if (err)
+  {
+    return CWIN_ERROR_VK_INTERNAL;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+#endif
+
+#endif
+
+#ifdef CWIN_BACKEND_X11
+
+#if defined(CWIN_BACKEND_WL) || defined(CWIN_BACKEND_WIN32) ||                 \
+    defined(CWIN_BACKEND_MACOS)
+#error Only one backend supported at a time.
+#endif
+
+#include <sys/socket.h>
+#include <xcb/xcb.h>
+#include <xcb/present.h>
+#include <xcb/randr.h>
+#include <xcb/shm.h>
+#include <xcb/xinput.h>
+#include <xcb/xkb.h>
+#include <xkbcommon/xkbcommon-x11.h>
+
+#define X11_DEFAULT_WIDTH 640
+#define X11_DEFAULT_HEIGHT 480
+
+/* ICCCM WM_SIZE_HINTS flags. */
+#define X11_SIZE_HINT_P_MIN_SIZE (1 << 4)
+#define X11_SIZE_HINT_P_MAX_SIZE (1 << 5)
+
+/* EWMH _NET_WM_STATE actions. */
+#define X11_NET_WM_STATE_REMOVE 0
+#define X11_NET_WM_STATE_ADD 1
+
+/* TYPES */
+
+enum x11_atom {
+  X11_ATOM_WM_PROTOCOLS,
+  X11_ATOM_WM_DELETE_WINDOW,
+  X11_ATOM_UTF8_STRING,
+  X11_ATOM_NET_WM_NAME,
+  X11_ATOM_NET_WM_STATE,
+  X11_ATOM_NET_WM_STATE_FULLSCREEN,
+  X11_ATOM_NET_WM_BYPASS_COMPOSITOR,
+  X11_ATOM_COUNT,
+};
+
+/* The layout of the WM_NORMAL_HINTS property. */
+struct x11_size_hints {
+  uint32_t flags;
+  int32_t x, y, width, height;
+  int32_t min_width, min_height;
+  int32_t max_width, max_height;
+  int32_t width_inc, height_inc;
+  int32_t min_aspect_num, min_aspect_den;
+  int32_t max_aspect_num, max_aspect_den;
+  int32_t base_width, base_height;
+  uint32_t win_gravity;
+};
+
+struct cwin_x11_window {
+  xcb_window_t handle;
+  enum cwin_screen_state screen_state;
+  int width, height; /* In pixels, like everything in X11. */
+  /* WM_NORMAL_HINTS is replaced as a whole, so both are remembered. */
+  struct x11_size_hints size_hints;
+  bool is_relative;
+  xcb_shm_seg_t segments[MAX_FRAMEBUFFER_BUFFERS];
+  xcb_gcontext_t gc; /* Created with the first buffer. */
+  /* Selected with the first frame request. */
+  xcb_present_event_t present_event;
+  bool wants_frame;
+  uint32_t frame_serial;
+  /* From Present completions, the refresh period is measured between two
+     of them. */
+  uint64_t presented_ns, refresh_ns;
+  uint64_t last_ust, last_msc;
+  /* The CRTC cwin_window_set_fullscreen switched, and how it was before.
+     Every output the CRTC drove keeps being driven, clones included. */
+  bool has_mode;
+  xcb_randr_crtc_t mode_crtc;
+  xcb_randr_mode_t desktop_mode;
+  uint16_t desktop_rotation;
+  int16_t desktop_x, desktop_y;
+  xcb_randr_output_t *desktop_outputs;
+  int desktop_output_count;
+};
+
+CWIN_WINDOW_TYPE(struct cwin_x11_window);
+
+/* A RandR monitor, named by its first output. */
+struct x11_monitor {
+  xcb_randr_output_t output;
+  int16_t x, y;
+  uint16_t width, height;
+};
+
+struct {
+  xcb_connection_t *connection;
+  xcb_screen_t *screen;
+  xcb_atom_t atoms[X11_ATOM_COUNT];
+  /* Every event names its window by XID. */
+  struct window_map windows;
+
+  /* X11 has no per monitor scale. Desktops publish theirs as Xft.dpi in the
+     root window's resources, which is reread when they change. */
+  float scale;
+
+  /* The keymap is rebuilt when XKB says the core keyboard's changed. */
+  int32_t keyboard_device;
+  uint8_t xkb_first_event;
+  /* The core event state the xkb state was last updated from. */
+  uint16_t key_state;
+  /* A bit per keycode. With detectable auto repeat, repeats are presses
+     without a release in between. */
+  uint8_t keys_down[32];
+
+  /* Raw motion comes from XInput 2, selected on the root window while any
+     window is relative. */
+  bool has_xinput;
+  uint8_t xinput_opcode;
+  int relative_count;
+  xcb_cursor_t blank_cursor; /* Created with the first relative window. */
+  struct cwin_window *focus;
+
+  /* Framebuffers are shared with the server through MIT-SHM. The version is
+     checked when the first buffer is created, by then the reply is in. The
+     first attach is checked too, since it fails on a remote display. Without
+     MIT-SHM, frames are sent with PutImage from private memory. */
+  bool has_shm, shm_checked, attach_checked;
+  uint8_t shm_first_event;
+  xcb_shm_query_version_cookie_t shm_version;
+
+  /* Frames are paced with the Present extension. */
+  bool has_present;
+  uint8_t present_opcode;
+
+  /* Monitors are listed with RandR 1.5, checked like MIT-SHM. */
+  bool has_randr, randr_checked;
+  xcb_randr_query_version_cookie_t randr_version;
+} x11;
+
+/* CONSTANTS */
+
+const char *const X11_ATOM_NAMES[X11_ATOM_COUNT] = {
+  [X11_ATOM_WM_PROTOCOLS] = "WM_PROTOCOLS",
+  [X11_ATOM_WM_DELETE_WINDOW] = "WM_DELETE_WINDOW",
+  [X11_ATOM_UTF8_STRING] = "UTF8_STRING",
+  [X11_ATOM_NET_WM_NAME] = "_NET_WM_NAME",
+  [X11_ATOM_NET_WM_STATE] = "_NET_WM_STATE",
+  [X11_ATOM_NET_WM_STATE_FULLSCREEN] = "_NET_WM_STATE_FULLSCREEN",
+  [X11_ATOM_NET_WM_BYPASS_COMPOSITOR] = "_NET_WM_BYPASS_COMPOSITOR",
+};
+
+/* PROTOTYPES */
+
+struct cwin_window *x11_find_window(xcb_window_t handle);
+float x11_read_scale(void);
+void x11_update_scale(void);
+void x11_update_keymap(void);
+uint32_t x11_event_mask(struct cwin_window *window);
+void x11_handle_event(xcb_generic_event_t *generic, uint64_t now_ns);
+void x11_set_net_wm_state(struct cwin_window *window, uint32_t action,
+                          xcb_atom_t state);
+void x11_set_bypass_compositor(struct cwin_window *window, bool bypass);
+bool x11_check_randr(void);
+uint32_t x11_mode_refresh(const xcb_randr_mode_info_t *mode);
+const xcb_randr_mode_info_t *x11_find_mode(
+  const xcb_randr_get_screen_resources_current_reply_t *resources,
+  xcb_randr_mode_t id);
+void x11_fill_monitor(const xcb_randr_monitor_info_t *info,
+                      const xcb_randr_get_screen_resources_current_reply_t
+                      *resources, struct cwin_monitor *out);
+bool x11_find_monitor(struct cwin_window *window, uint64_t id,
+                      struct x11_monitor *monitor);
+bool x11_set_crtc(xcb_randr_crtc_t crtc, int16_t x, int16_t y,
+                  xcb_randr_mode_t mode, uint16_t rotation,
+                  const xcb_randr_output_t *outputs, int output_count);
+enum cwin_error x11_apply_mode(struct cwin_window *window,
+                               xcb_randr_output_t output,
+                               const struct cwin_monitor_mode *wanted);
+enum cwin_error x11_switch_crtc(
+  struct cwin_window *window,
+  const xcb_randr_get_screen_resources_current_reply_t *resources,
+  const xcb_randr_get_output_info_reply_t *output_info,
+  const xcb_randr_get_crtc_info_reply_t *crtc,
+  const struct cwin_monitor_mode *wanted);
+void x11_restore_mode(struct cwin_window *window);
+void x11_select_raw_motion(bool select);
+void x11_handle_raw_motion(xcb_input_raw_motion_event_t *raw,
+                           uint64_t now_ns);
+void x11_handle_shm_completion(xcb_shm_completion_event_t *completion);
+void x11_put_rect(struct cwin_window *window, int index,
+                  const struct cwin_rect *rect);
+void x11_handle_present_complete(
+  xcb_present_complete_notify_event_t *complete);
+
+/* PLATFORM FUNCTIONS */
+
+void cwin_plat_get_state(struct cwin_window *window,
+                         struct cwin_window_state *state)
+{
+  state->width = window->plat.width;
+  state->height = window->plat.height;
+  state->screen_width = scale_round(window->plat.width / x11.scale);
+  state->screen_height = scale_round(window->plat.height / x11.scale);
+  state->scale = x11.scale;
+  state->screen_state = window->plat.screen_state;
+}
+
+enum cwin_error cwin_plat_pump_events(void)
+{
+  xcb_generic_event_t *event;
+
+  /* Nothing cwin sends waits for a reply, so requests go out here. */
+  xcb_flush(x11.connection);
+
+  uint64_t now_ns = cwin_plat_now_ns();
+  STATS_BEGIN("cwin translate");
+  while ((event = xcb_poll_for_event(x11.connection)) != NULL)
+  {
+    x11_handle_event(event, now_ns);
+    free(event);
+  }
+  STATS_END(stats.translate_ns);
+
+  if (xcb_connection_has_error(x11.connection))
+  {
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_plat_wait_events(uint64_t timeout_ns)
+{
+  /*
+   * Events read while waiting for a reply sit in XCB's queue without making
+   * the socket readable, so poll() would miss them.
+   */
+  xcb_generic_event_t *event = xcb_poll_for_queued_event(x11.connection);
+  if (event != NULL)
+  {
+    x11_handle_event(event, cwin_plat_now_ns());
+    free(event);
+    return cwin_plat_pump_events();
+  }
+
+  xcb_flush(x11.connection);
+
+  struct pollfd pfds[] = {
+    { .fd = xcb_get_file_descriptor(x11.connection), .events = POLLIN },
+    { .fd = posix.wake_fd, .events = POLLIN },
+    { .fd = posix.timer_fd, .events = POLLIN },
+  };
+  poll(pfds, 3, posix_timeout_ms(timeout_ns));
+  if (pfds[1].revents & POLLIN)
+  {
+    cwin_plat_clear_wake();
+  }
+
+  return cwin_plat_pump_events();
+}
+
+int cwin_plat_get_event_fd(void)
+{
+  return posix_get_event_fd(xcb_get_file_descriptor(x11.connection));
+}
+
+enum cwin_error cwin_plat_init(void)
+{
+  enum cwin_error err;
+  int screen_number;
+
+  err = posix_init_wake();
+  if (err)
+  {
+    return err;
+  }
+
+  x11.connection = xcb_connect(NULL, &screen_number);
+  if (xcb_connection_has_error(x11.connection))
+  {
+    xcb_disconnect(x11.connection);
+    posix_deinit_wake();
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+
+  xcb_screen_iterator_t it =
+    xcb_setup_roots_iterator(xcb_get_setup(x11.connection));
+  for (int i = 0; i < screen_number && it.rem > 0; i++)
+  {
+    xcb_screen_next(&it);
+  }
+  x11.screen = it.data;
+
+  /* Send every request before waiting on the first reply, so interning all
+     the atoms and querying the extensions costs a single roundtrip. */
+  xcb_prefetch_extension_data(x11.connection, &xcb_input_id);
+  xcb_prefetch_extension_data(x11.connection, &xcb_shm_id);
+  xcb_prefetch_extension_data(x11.connection, &xcb_present_id);
+  xcb_prefetch_extension_data(x11.connection, &xcb_randr_id);
+  xcb_intern_atom_cookie_t cookies[X11_ATOM_COUNT];
+  for (int i = 0; i < X11_ATOM_COUNT; i++)
+  {
+    cookies[i] = xcb_intern_atom(x11.connection, 0, strlen(X11_ATOM_NAMES[i]),
+                                 X11_ATOM_NAMES[i]);
+  }
+
+  for (int i = 0; i < X11_ATOM_COUNT; i++)
+  {
+    xcb_intern_atom_reply_t *reply =
+      xcb_intern_atom_reply(x11.connection, cookies[i], NULL);
+    if (reply == NULL)
+    {
+      xcb_disconnect(x11.connection);
+      posix_deinit_wake();
+      return CWIN_ERROR_X11_INTERNAL;
+    }
+    x11.atoms[i] = reply->atom;
+    free(reply);
+  }
+
+  /* Relative mode is unsupported without XInput. The version has to be
+     announced before raw events are selected. */
+  const xcb_query_extension_reply_t *xinput =
+    xcb_get_extension_data(x11.connection, &xcb_input_id);
+  x11.has_xinput = xinput != NULL && xinput->present;
+  if (x11.has_xinput)
+  {
+    x11.xinput_opcode = xinput->major_opcode;
+    xcb_input_xi_query_version_cookie_t version_cookie =
+      xcb_input_xi_query_version(x11.connection, 2, 2);
+    xcb_discard_reply(x11.connection, version_cookie.sequence);
+  }
+
+  const xcb_query_extension_reply_t *shm =
+    xcb_get_extension_data(x11.connection, &xcb_shm_id);
+  x11.has_shm = shm != NULL && shm->present;
+  x11.shm_checked = !x11.has_shm;
+  if (x11.has_shm)
+  {
+    x11.shm_first_event = shm->first_event;
+    x11.shm_version = xcb_shm_query_version(x11.connection);
+  }
+
+  const xcb_query_extension_reply_t *present =
+    xcb_get_extension_data(x11.connection, &xcb_present_id);
+  x11.has_present = present != NULL && present->present;
+  if (x11.has_present)
+  {
+    x11.present_opcode = present->major_opcode;
+    xcb_present_query_version_cookie_t present_cookie =
+      xcb_present_query_version(x11.connection, 1, 0);
+    xcb_discard_reply(x11.connection, present_cookie.sequence);
+  }
+
+  const xcb_query_extension_reply_t *randr =
+    xcb_get_extension_data(x11.connection, &xcb_randr_id);
+  x11.has_randr = randr != NULL && randr->present;
+  x11.randr_checked = !x11.has_randr;
+  if (x11.has_randr)
+  {
+    x11.randr_version = xcb_randr_query_version(x11.connection, 1, 5);
+  }
+
+  if (!xkb_x11_setup_xkb_extension(x11.connection,
+                                   XKB_X11_MIN_MAJOR_XKB_VERSION,
+                                   XKB_X11_MIN_MINOR_XKB_VERSION,
+                                   XKB_X11_SETUP_XKB_EXTENSION_NO_FLAGS,
+                                   NULL, NULL, &x11.xkb_first_event, NULL))
+  {
+    xcb_disconnect(x11.connection);
+    posix_deinit_wake();
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+
+  int32_t device = xkb_x11_get_core_keyboard_device_id(x11.connection);
+  x11.keyboard_device = device;
+  struct xkb_keymap *keymap = NULL;
+  struct xkb_state *state = NULL;
+  if (keyboard_init() && device != -1)
+  {
+    keymap = xkb_x11_keymap_new_from_device(keyboard.context, x11.connection,
+                                            device,
+                                            XKB_KEYMAP_COMPILE_NO_FLAGS);
+  }
+  if (keymap != NULL)
+  {
+    state = xkb_x11_state_new_from_device(keymap, x11.connection, device);
+  }
+  if (state == NULL)
+  {
+    if (keymap != NULL)
+    {
+      xkb_keymap_unref(keymap);
+    }
+    keyboard_deinit();
+    xcb_disconnect(x11.connection);
+    posix_deinit_wake();
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+  keyboard_set_keymap(keymap, state);
+  x11.key_state = 0;
+  memset(x11.keys_down, 0, sizeof(x11.keys_down));
+
+  /* Otherwise held keys send a release before every repeated press. */
+  xcb_xkb_per_client_flags_cookie_t cookie =
+    xcb_xkb_per_client_flags(x11.connection, device,
+                             XCB_XKB_PER_CLIENT_FLAG_DETECTABLE_AUTO_REPEAT,
+                             XCB_XKB_PER_CLIENT_FLAG_DETECTABLE_AUTO_REPEAT,
+                             0, 0, 0);
+  xcb_discard_reply(x11.connection, cookie.sequence);
+
+  /* A new keyboard, or a layout change on the current one. Only the map
+     parts xkbcommon reads are asked for. */
+  uint16_t map_parts = XCB_XKB_MAP_PART_KEY_TYPES |
+    XCB_XKB_MAP_PART_KEY_SYMS | XCB_XKB_MAP_PART_MODIFIER_MAP |
+    XCB_XKB_MAP_PART_EXPLICIT_COMPONENTS | XCB_XKB_MAP_PART_KEY_ACTIONS |
+    XCB_XKB_MAP_PART_VIRTUAL_MODS | XCB_XKB_MAP_PART_VIRTUAL_MOD_MAP;
+  xcb_xkb_select_events_details_t details = {
+    .affectNewKeyboard = XCB_XKB_NKN_DETAIL_KEYCODES,
+    .newKeyboardDetails = XCB_XKB_NKN_DETAIL_KEYCODES,
+  };
+  xcb_xkb_select_events_aux(x11.connection, device,
+                            XCB_XKB_EVENT_TYPE_NEW_KEYBOARD_NOTIFY |
+                            XCB_XKB_EVENT_TYPE_MAP_NOTIFY,
+                            0, 0, map_parts, map_parts, &details);
+
+  /* Resource changes are announced as property changes on the root. */
+  uint32_t root_mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+  xcb_change_window_attributes(x11.connection, x11.screen->root,
+                               XCB_CW_EVENT_MASK, &root_mask);
+  x11.scale = x11_read_scale();
+
+  memset(&x11.windows, 0, sizeof(x11.windows));
+  x11.relative_count = 0;
+  x11.blank_cursor = XCB_NONE;
+  x11.focus = NULL;
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_deinit(void)
+{
+  keyboard_deinit();
+  window_map_free(&x11.windows);
+  xcb_disconnect(x11.connection);
+  memset(&x11, 0, sizeof(x11));
+  posix_deinit_wake();
+}
+
+enum cwin_error cwin_plat_init_window(struct cwin_window *window,
+                                      struct cwin_window_builder *builder)
+{
+  enum cwin_error err;
+  int width = builder->width;
+  int height = builder->height;
+  if (builder->width == CWIN_WINDOW_SIZE_UNDEFINED)
+  {
+    width = X11_DEFAULT_WIDTH;
+  }
+  if (builder->height == CWIN_WINDOW_SIZE_UNDEFINED)
+  {
+    height = X11_DEFAULT_HEIGHT;
+  }
+  window->plat.width = scale_round(width * x11.scale);
+  window->plat.height = scale_round(height * x11.scale);
+  window->plat.screen_state = CWIN_SCREEN_WINDOWED;
+  memset(&window->plat.size_hints, 0, sizeof(window->plat.size_hints));
+  window->plat.is_relative = false;
+  window->plat.gc = XCB_NONE;
+  window->plat.present_event = XCB_NONE;
+  window->plat.wants_frame = false;
+  window->plat.frame_serial = 0;
+  window->plat.presented_ns = window->plat.refresh_ns = 0;
+  window->plat.last_ust = window->plat.last_msc = 0;
+  window->plat.has_mode = false;
+
+  uint32_t event_mask = x11_event_mask(window);
+
+  /*
+   * None of these requests have replies, so they are only queued in XCB's
+   * output buffer. Creating many windows costs no roundtrips.
+   */
+  window->plat.handle = xcb_generate_id(x11.connection);
+  xcb_create_window(x11.connection, XCB_COPY_FROM_PARENT, window->plat.handle,
+                    x11.screen->root, builder->x, builder->y,
+                    window->plat.width, window->plat.height, 0,
+                    XCB_WINDOW_CLASS_INPUT_OUTPUT, x11.screen->root_visual,
+                    XCB_CW_EVENT_MASK, &event_mask);
+
+  if (builder->name != NULL)
+  {
+    size_t name_len = builder->name_len;
+    if (name_len == 0)
+    {
+      name_len = strlen((const char *) builder->name);
+    }
+
+    xcb_change_property(x11.connection, XCB_PROP_MODE_REPLACE,
+                        window->plat.handle, x11.atoms[X11_ATOM_NET_WM_NAME],
+                        x11.atoms[X11_ATOM_UTF8_STRING], 8, name_len,
+                        builder->name);
+
+    /* STRING is Latin-1, so WM_NAME is only a STRING while the name is
+       ASCII. Older window managers may not read UTF8_STRING, but as Latin-1
+       the name would be garbled anyway. */
+    xcb_atom_t name_type = XCB_ATOM_STRING;
+    for (size_t i = 0; i < name_len; i++)
+    {
+      if (builder->name[i] >= 0x80)
+      {
+        name_type = x11.atoms[X11_ATOM_UTF8_STRING];
+      }
+    }
+    xcb_change_property(x11.connection, XCB_PROP_MODE_REPLACE,
+                        window->plat.handle, XCB_ATOM_WM_NAME, name_type, 8,
+                        name_len, builder->name);
+  }
+
+  xcb_change_property(x11.connection, XCB_PROP_MODE_REPLACE,
+                      window->plat.handle, x11.atoms[X11_ATOM_WM_PROTOCOLS],
+                      XCB_ATOM_ATOM, 32, 1,
+                      &x11.atoms[X11_ATOM_WM_DELETE_WINDOW]);
+
+  xcb_map_window(x11.connection, window->plat.handle);
+  xcb_flush(x11.connection);
+
+  err = window_map_insert(&x11.windows, window->plat.handle, window);
+  if (err)
+  {
+    cwin_plat_deinit_window(window);
+    return err;
+  }
+
+  if (xcb_connection_has_error(x11.connection))
+  {
+    cwin_plat_deinit_window(window);
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_deinit_window(struct cwin_window *window)
+{
+  if (window->plat.is_relative)
+  {
+    cwin_mouse_set_relative(window, false);
+  }
+  if (x11.focus == window)
+  {
+    x11.focus = NULL;
+  }
+
+  window_map_remove(&x11.windows, window->plat.handle);
+  x11_restore_mode(window);
+
+  if (window->plat.gc != XCB_NONE)
+  {
+    xcb_free_gc(x11.connection, window->plat.gc);
+  }
+  xcb_destroy_window(x11.connection, window->plat.handle);
+  xcb_flush(x11.connection);
+}
+
+void cwin_plat_get_raw_window(struct cwin_window *window,
+                              struct cwin_raw_window *raw)
+{
+  raw->t = CWIN_RAW_WINDOW_XCB;
+  raw->xcb.connection = x11.connection;
+  raw->xcb.window = window->plat.handle;
+}
+
+void cwin_plat_set_event_mask(struct cwin_window *window)
+{
+  uint32_t event_mask = x11_event_mask(window);
+  xcb_change_window_attributes(x11.connection, window->plat.handle,
+                               XCB_CW_EVENT_MASK, &event_mask);
+  xcb_flush(x11.connection);
+}
+
+/*
+ * The server only sends the input the window's cwin event mask needs.
+ * Configure and focus changes are always needed to track the window's state.
+ */
+uint32_t x11_event_mask(struct cwin_window *window)
+{
+  uint32_t event_mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY |
+    XCB_EVENT_MASK_FOCUS_CHANGE;
+  if (window_wants(window, CWIN_EVENT_MASK_MOUSE_MOVE))
+  {
+    event_mask |= XCB_EVENT_MASK_POINTER_MOTION;
+  }
+  /* The wheel is buttons 4 and 5. */
+  if (window_wants(window, CWIN_EVENT_MASK_MOUSE_BUTTON |
+                   CWIN_EVENT_MASK_MOUSE_WHEEL))
+  {
+    event_mask |= XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE;
+  }
+  if (window_wants(window, CWIN_EVENT_MASK_CROSSING))
+  {
+    event_mask |= XCB_EVENT_MASK_ENTER_WINDOW | XCB_EVENT_MASK_LEAVE_WINDOW;
+  }
+  if (window_wants(window, CWIN_EVENT_MASK_KEY | CWIN_EVENT_MASK_TEXT))
+  {
+    event_mask |= XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE;
+  }
+  return event_mask;
+}
+
+/*
+ * EWMH: a mapped window asks the window manager to change its state with a
+ * client message to the root window.
+ */
+void x11_set_net_wm_state(struct cwin_window *window, uint32_t action,
+                          xcb_atom_t state)
+{
+  xcb_client_message_event_t message = {
+    .response_type = XCB_CLIENT_MESSAGE,
+    .format = 32,
+    .window = window->plat.handle,
+    .type = x11.atoms[X11_ATOM_NET_WM_STATE],
+    .data.data32 = {
+      action,
+      state,
+      0,
+      1, /* Source indication: a normal application. */
+      0,
+    },
+  };
+
+  xcb_send_event(x11.connection, 0, x11.screen->root,
+                 XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+                 XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY,
+                 (const char *) &message);
+  xcb_flush(x11.connection);
+}
+
+/* Asks compositors to stop compositing while the window covers a monitor. */
+void x11_set_bypass_compositor(struct cwin_window *window, bool bypass)
+{
+  if (bypass)
+  {
+    uint32_t value = 1;
+    xcb_change_property(x11.connection, XCB_PROP_MODE_REPLACE,
+                        window->plat.handle,
+                        x11.atoms[X11_ATOM_NET_WM_BYPASS_COMPOSITOR],
+                        XCB_ATOM_CARDINAL, 32, 1, &value);
+  } else
+  {
+    xcb_delete_property(x11.connection, window->plat.handle,
+                        x11.atoms[X11_ATOM_NET_WM_BYPASS_COMPOSITOR]);
+  }
+}
+
+void cwin_plat_set_screen_state(struct cwin_window *window,
+                                enum cwin_screen_state state)
+{
+  if (state == window->plat.screen_state)
+  {
+    return;
+  }
+
+  switch (state)
+  {
+  case CWIN_SCREEN_FULLSCREEN:
+    cwin_plat_set_fullscreen(window, 0, NULL);
+    return;
+  case CWIN_SCREEN_DESKTOP:
+    x11_restore_mode(window);
+    x11_set_bypass_compositor(window, false);
+    x11_set_net_wm_state(window, X11_NET_WM_STATE_ADD,
+                         x11.atoms[X11_ATOM_NET_WM_STATE_FULLSCREEN]);
+    break;
+  case CWIN_SCREEN_WINDOWED:
+    x11_restore_mode(window);
+    x11_set_bypass_compositor(window, false);
+    x11_set_net_wm_state(window, X11_NET_WM_STATE_REMOVE,
+                         x11.atoms[X11_ATOM_NET_WM_STATE_FULLSCREEN]);
+    break;
+  }
+
+  window->plat.screen_state = state;
+}
+
+/*
+ * Window managers make a window fullscreen on the monitor it is on, so it
+ * is moved there first. Without RandR 1.5 only the current monitor works.
+ */
+enum cwin_error cwin_plat_set_fullscreen(
+  struct cwin_window *window, uint64_t monitor,
+  const struct cwin_monitor_mode *mode)
+{
+  struct x11_monitor target;
+  bool found = x11_find_monitor(window, monitor, &target);
+  if (!found && (monitor != 0 || mode != NULL))
+  {
+    return CWIN_ERROR_INVALID_MONITOR;
+  }
+
+  x11_restore_mode(window);
+  if (mode != NULL)
+  {
+    enum cwin_error err = x11_apply_mode(window, target.output, mode);
+    if (err)
+    {
+      return err;
+    }
+  }
+
+  if (found && monitor != 0)
+  {
+    if (window->plat.screen_state != CWIN_SCREEN_WINDOWED)
+    {
+      x11_set_net_wm_state(window, X11_NET_WM_STATE_REMOVE,
+                           x11.atoms[X11_ATOM_NET_WM_STATE_FULLSCREEN]);
+    }
+    uint32_t position[] = { (uint32_t) target.x, (uint32_t) target.y };
+    xcb_configure_window(x11.connection, window->plat.handle,
+                         XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, position);
+  }
+
+  x11_set_bypass_compositor(window, true);
+  x11_set_net_wm_state(window, X11_NET_WM_STATE_ADD,
+                       x11.atoms[X11_ATOM_NET_WM_STATE_FULLSCREEN]);
+  window->plat.screen_state = CWIN_SCREEN_FULLSCREEN;
+  return CWIN_SUCCESS;
+}
+
+bool x11_check_randr(void)
+{
+  if (!x11.randr_checked)
+  {
+    /* Monitors are new in 1.5. */
+    xcb_randr_query_version_reply_t *reply =
+      xcb_randr_query_version_reply(x11.connection, x11.randr_version, NULL);
+    x11.has_randr = reply != NULL &&
+      (reply->major_version > 1 || reply->minor_version >= 5);
+    free(reply);
+    x11.randr_checked = true;
+  }
+  return x11.has_randr;
+}
+
+/* In millihertz. Interlaced modes scan half the lines per refresh, and
+   doublescan modes each line twice. */
+uint32_t x11_mode_refresh(const xcb_randr_mode_info_t *mode)
+{
+  uint64_t lines = mode->vtotal;
+  if (mode->mode_flags & XCB_RANDR_MODE_FLAG_DOUBLE_SCAN)
+  {
+    lines *= 2;
+  }
+  if (mode->mode_flags & XCB_RANDR_MODE_FLAG_INTERLACE)
+  {
+    lines /= 2;
+  }
+  if (mode->htotal == 0 || lines == 0)
+  {
+    return 0;
+  }
+  return (uint32_t) ((uint64_t) mode->dot_clock * 1000 /
+                     (mode->htotal * lines));
+}
+
+const xcb_randr_mode_info_t *x11_find_mode(
+  const xcb_randr_get_screen_resources_current_reply_t *resources,
+  xcb_randr_mode_t id)
+{
+  const xcb_randr_mode_info_t *modes =
+    xcb_randr_get_screen_resources_current_modes(resources);
+  int count = xcb_randr_get_screen_resources_current_modes_length(resources);
+  for (int i = 0; i < count; i++)
+  {
+    if (modes[i].id == id)
+    {
+      return &modes[i];
+    }
+  }
+  return NULL;
+}
+
+void x11_fill_monitor(const xcb_randr_monitor_info_t *info,
+                      const xcb_randr_get_screen_resources_current_reply_t
+                      *resources, struct cwin_monitor *out)
+{
+  xcb_randr_output_t output = xcb_randr_monitor_info_outputs(info)[0];
+  xcb_get_atom_name_cookie_t name_cookie =
+    xcb_get_atom_name(x11.connection, info->name);
+  xcb_randr_get_output_info_cookie_t output_cookie =
+    xcb_randr_get_output_info(x11.connection, output,
+                              resources->config_timestamp);
+
+  memset(out, 0, sizeof(*out));
+  out->id = output;
+  out->x = info->x;
+  out->y = info->y;
+  out->width = info->width;
+  out->height = info->height;
+  out->width_mm = info->width_in_millimeters;
+  out->height_mm = info->height_in_millimeters;
+  out->scale = x11.scale;
+  out->primary = info->primary;
+
+  xcb_get_atom_name_reply_t *name =
+    xcb_get_atom_name_reply(x11.connection, name_cookie, NULL);
+  if (name != NULL)
+  {
+    copy_monitor_name(out->name, xcb_get_atom_name_name(name),
+                      xcb_get_atom_name_name_length(name));
+    free(name);
+  }
+
+  xcb_randr_get_output_info_reply_t *output_info =
+    xcb_randr_get_output_info_reply(x11.connection, output_cookie, NULL);
+  if (output_info == NULL || output_info->crtc == XCB_NONE)
+  {
+    free(output_info);
+    return;
+  }
+
+  xcb_randr_get_crtc_info_reply_t *crtc =
+    xcb_randr_get_crtc_info_reply(
+      x11.connection,
+      xcb_randr_get_crtc_info(x11.connection, output_info->crtc,
+                              resources->config_timestamp), NULL);
+  const xcb_randr_mode_info_t *mode =
+    crtc != NULL ? x11_find_mode(resources, crtc->mode) : NULL;
+  if (mode != NULL)
+  {
+    out->mode.width = mode->width;
+    out->mode.height = mode->height;
+    out->mode.refresh_mhz = x11_mode_refresh(mode);
+  }
+  free(crtc);
+  free(output_info);
+}
+
+enum cwin_error cwin_get_monitors(struct cwin_monitor *monitors, int *count)
+{
+  if (!x11_check_randr())
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  xcb_randr_get_monitors_cookie_t monitors_cookie =
+    xcb_randr_get_monitors(x11.connection, x11.screen->root, 1);
+  xcb_randr_get_screen_resources_current_cookie_t resources_cookie =
+    xcb_randr_get_screen_resources_current(x11.connection, x11.screen->root);
+  xcb_randr_get_monitors_reply_t *reply =
+    xcb_randr_get_monitors_reply(x11.connection, monitors_cookie, NULL);
+  xcb_randr_get_screen_resources_current_reply_t *resources =
+    xcb_randr_get_screen_resources_current_reply(x11.connection,
+                                                 resources_cookie, NULL);
+  if (reply == NULL || resources == NULL)
+  {
+    free(reply);
+    free(resources);
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+
+  /* Monitors without outputs have nothing to name them by. */
+  int len = 0;
+  int capacity = monitors != NULL ? *count : INT_MAX;
+  xcb_randr_monitor_info_iterator_t it =
+    xcb_randr_get_monitors_monitors_iterator(reply);
+  for (; it.rem > 0 && len < capacity; xcb_randr_monitor_info_next(&it))
+  {
+    if (it.data->nOutput == 0)
+    {
+      continue;
+    }
+    if (monitors != NULL)
+    {
+      x11_fill_monitor(it.data, resources, &monitors[len]);
+    }
+    len++;
+  }
+
+  free(reply);
+  free(resources);
+  *count = len;
+  return CWIN_SUCCESS;
+}
+
+/* Finds a monitor by id, or the one the window's center is on if id is 0. */
+bool x11_find_monitor(struct cwin_window *window, uint64_t id,
+                      struct x11_monitor *monitor)
+{
+  if (!x11_check_randr())
+  {
+    return false;
+  }
+
+  xcb_translate_coordinates_cookie_t position_cookie =
+    xcb_translate_coordinates(x11.connection, window->plat.handle,
+                              x11.screen->root, window->plat.width / 2,
+                              window->plat.height / 2);
+  xcb_randr_get_monitors_reply_t *reply =
+    xcb_randr_get_monitors_reply(
+      x11.connection,
+      xcb_randr_get_monitors(x11.connection, x11.screen->root, 1), NULL);
+  xcb_translate_coordinates_reply_t *position =
+    xcb_translate_coordinates_reply(x11.connection, position_cookie, NULL);
+  if (reply == NULL || (id == 0 && position == NULL))
+  {
+    free(reply);
+    free(position);
+    return false;
+  }
+
+  bool found = false;
+  xcb_randr_monitor_info_iterator_t it =
+    xcb_randr_get_monitors_monitors_iterator(reply);
+  for (; it.rem > 0 && !found; xcb_randr_monitor_info_next(&it))
+  {
+    const xcb_randr_monitor_info_t *info = it.data;
+    if (info->nOutput == 0)
+    {
+      continue;
+    }
+
+    xcb_randr_output_t output = xcb_randr_monitor_info_outputs(info)[0];
+    if (id == 0)
+    {
+      found = position->dst_x >= info->x && position->dst_y >= info->y &&
+        position->dst_x < info->x + info->width &&
+        position->dst_y < info->y + info->height;
+    } else
+    {
+      found = output == id;
+    }
+    if (found)
+    {
+      monitor->output = output;
+      monitor->x = info->x;
+      monitor->y = info->y;
+      monitor->width = info->width;
+      monitor->height = info->height;
+    }
+  }
+
+  free(reply);
+  free(position);
+  return found;
+}
+
+enum cwin_error cwin_monitor_get_modes(uint64_t monitor,
+                                       struct cwin_monitor_mode *modes,
+                                       int *count)
+{
+  if (!x11_check_randr())
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  xcb_randr_get_screen_resources_current_reply_t *resources =
+    xcb_randr_get_screen_resources_current_reply(
+      x11.connection,
+      xcb_randr_get_screen_resources_current(x11.connection,
+                                             x11.screen->root), NULL);
+  if (resources == NULL)
+  {
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+
+  xcb_randr_get_output_info_reply_t *output =
+    xcb_randr_get_output_info_reply(
+      x11.connection,
+      xcb_randr_get_output_info(x11.connection, (xcb_randr_output_t) monitor,
+                                resources->config_timestamp), NULL);
+  if (output == NULL || output->connection != XCB_RANDR_CONNECTION_CONNECTED)
+  {
+    free(output);
+    free(resources);
+    return CWIN_ERROR_INVALID_MONITOR;
+  }
+
+  const xcb_randr_mode_t *ids = xcb_randr_get_output_info_modes(output);
+  size_t len = (size_t) xcb_randr_get_output_info_modes_length(output);
+  struct cwin_monitor_mode *all = scratch_reserve(len * sizeof(*all) + 1);
+  if (all == NULL)
+  {
+    free(output);
+    free(resources);
+    return CWIN_ERROR_OOM;
+  }
+
+  size_t found = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    const xcb_randr_mode_info_t *mode = x11_find_mode(resources, ids[i]);
+    if (mode != NULL)
+    {
+      all[found].width = mode->width;
+      all[found].height = mode->height;
+      all[found].refresh_mhz = x11_mode_refresh(mode);
+      found++;
+    }
+  }
+
+  copy_list(modes, count, all, normalize_modes(all, found), sizeof(*all));
+  free(output);
+  free(resources);
+  return CWIN_SUCCESS;
+}
+
+/* The configuration timestamp is fetched right before, so the change isn't
+   refused as stale. */
+bool x11_set_crtc(xcb_randr_crtc_t crtc, int16_t x, int16_t y,
+                  xcb_randr_mode_t mode, uint16_t rotation,
+                  const xcb_randr_output_t *outputs, int output_count)
+{
+  xcb_randr_get_screen_resources_current_reply_t *resources =
+    xcb_randr_get_screen_resources_current_reply(
+      x11.connection,
+      xcb_randr_get_screen_resources_current(x11.connection,
+                                             x11.screen->root), NULL);
+  if (resources == NULL)
+  {
+    return false;
+  }
+
+  xcb_randr_set_crtc_config_reply_t *reply =
+    xcb_randr_set_crtc_config_reply(
+      x11.connection,
+      xcb_randr_set_crtc_config(x11.connection, crtc, XCB_CURRENT_TIME,
+                                resources->config_timestamp, x, y, mode,
+                                rotation, (uint32_t) output_count, outputs),
+      NULL);
+  bool ok = reply != NULL && reply->status == XCB_RANDR_SET_CONFIG_SUCCESS;
+  free(reply);
+  free(resources);
+  return ok;
+}
+
+/* Switches the output's CRTC to the mode pick_mode chooses, in place. */
+enum cwin_error x11_apply_mode(struct cwin_window *window,
+                               xcb_randr_output_t output,
+                               const struct cwin_monitor_mode *wanted)
+{
+  enum cwin_error err = CWIN_ERROR_UNSUPPORTED;
+  xcb_randr_get_screen_resources_current_reply_t *resources =
+    xcb_randr_get_screen_resources_current_reply(
+      x11.connection,
+      xcb_randr_get_screen_resources_current(x11.connection,
+                                             x11.screen->root), NULL);
+  xcb_randr_get_output_info_reply_t *output_info = resources == NULL ? NULL :
+    xcb_randr_get_output_info_reply(
+      x11.connection,
+      xcb_randr_get_output_info(x11.connection, output,
+                                resources->config_timestamp), NULL);
+  xcb_randr_get_crtc_info_reply_t *crtc =
+    output_info == NULL || output_info->crtc == XCB_NONE ? NULL :
+    xcb_randr_get_crtc_info_reply(
+      x11.connection,
+      xcb_randr_get_crtc_info(x11.connection, output_info->crtc,
+                              resources->config_timestamp), NULL);
+  if (crtc != NULL)
+  {
+    err = x11_switch_crtc(window, resources, output_info, crtc, wanted);
+  }
+
+  free(crtc);
+  free(output_info);
+  free(resources);
+  return err;
+}
+
+enum cwin_error x11_switch_crtc(
+  struct cwin_window *window,
+  const xcb_randr_get_screen_resources_current_reply_t *resources,
+  const xcb_randr_get_output_info_reply_t *output_info,
+  const xcb_randr_get_crtc_info_reply_t *crtc,
+  const struct cwin_monitor_mode *wanted)
+{
+  /* Mode ids are kept next to the modes, which stay in the output's order so
+     the two line up. */
+  const xcb_randr_mode_t *ids = xcb_randr_get_output_info_modes(output_info);
+  size_t len = (size_t) xcb_randr_get_output_info_modes_length(output_info);
+  struct cwin_monitor_mode *modes =
+    scratch_reserve(len * (sizeof(*modes) + sizeof(*ids)) + 1);
+  if (modes == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+  xcb_randr_mode_t *mode_ids = (xcb_randr_mode_t *) (modes + len);
+
+  size_t found = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    const xcb_randr_mode_info_t *mode = x11_find_mode(resources, ids[i]);
+    if (mode != NULL)
+    {
+      modes[found].width = mode->width;
+      modes[found].height = mode->height;
+      modes[found].refresh_mhz = x11_mode_refresh(mode);
+      mode_ids[found] = ids[i];
+      found++;
+    }
+  }
+
+  int index = pick_mode(modes, found, wanted);
+  if (index == -1)
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  /* Copied, since x11_restore_mode needs them after the reply is gone. */
+  int output_count = xcb_randr_get_crtc_info_outputs_length(crtc);
+  xcb_randr_output_t *outputs = CWIN_ARR(xcb_randr_output_t, output_count);
+  if (outputs == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+  memcpy(outputs, xcb_randr_get_crtc_info_outputs(crtc),
+         output_count * sizeof(*outputs));
+
+  if (!x11_set_crtc(output_info->crtc, crtc->x, crtc->y, mode_ids[index],
+                    crtc->rotation, outputs, output_count))
+  {
+    CWIN_FREE_ARR(xcb_randr_output_t, output_count, outputs);
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  window->plat.has_mode = true;
+  window->plat.mode_crtc = output_info->crtc;
+  window->plat.desktop_mode = crtc->mode;
+  window->plat.desktop_rotation = crtc->rotation;
+  window->plat.desktop_x = crtc->x;
+  window->plat.desktop_y = crtc->y;
+  window->plat.desktop_outputs = outputs;
+  window->plat.desktop_output_count = output_count;
+  return CWIN_SUCCESS;
+}
+
+void x11_restore_mode(struct cwin_window *window)
+{
+  if (window->plat.has_mode)
+  {
+    x11_set_crtc(window->plat.mode_crtc, window->plat.desktop_x,
+                 window->plat.desktop_y, window->plat.desktop_mode,
+                 window->plat.desktop_rotation, window->plat.desktop_outputs,
+                 window->plat.desktop_output_count);
+    CWIN_FREE_ARR(xcb_randr_output_t, window->plat.desktop_output_count,
+                  window->plat.desktop_outputs);
+    window->plat.has_mode = false;
+  }
+}
+
+void cwin_plat_set_maximum_size(struct cwin_window *window,
+                                int max_width, int max_height)
+{
+  window->plat.size_hints.flags |= X11_SIZE_HINT_P_MAX_SIZE;
+  window->plat.size_hints.max_width = scale_round(max_width * x11.scale);
+  window->plat.size_hints.max_height = scale_round(max_height * x11.scale);
+
+  xcb_change_property(x11.connection, XCB_PROP_MODE_REPLACE,
+                      window->plat.handle, XCB_ATOM_WM_NORMAL_HINTS,
+                      XCB_ATOM_WM_SIZE_HINTS, 32,
+                      sizeof(struct x11_size_hints) / 4,
+                      &window->plat.size_hints);
+  xcb_flush(x11.connection);
+}
+
+void cwin_plat_set_minimum_size(struct cwin_window *window,
+                                int min_width, int min_height)
+{
+  window->plat.size_hints.flags |= X11_SIZE_HINT_P_MIN_SIZE;
+  window->plat.size_hints.min_width = scale_round(min_width * x11.scale);
+  window->plat.size_hints.min_height = scale_round(min_height * x11.scale);
+
+  xcb_change_property(x11.connection, XCB_PROP_MODE_REPLACE,
+                      window->plat.handle, XCB_ATOM_WM_NORMAL_HINTS,
+                      XCB_ATOM_WM_SIZE_HINTS, 32,
+                      sizeof(struct x11_size_hints) / 4,
+                      &window->plat.size_hints);
+  xcb_flush(x11.connection);
+}
+
+/* A NotifyMSC with a divisor of 1 completes at the next vblank. */
+enum cwin_error cwin_window_request_frame(struct cwin_window *window)
+{
+  if (!x11.has_present)
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+  if (window->plat.wants_frame)
+  {
+    return CWIN_SUCCESS;
+  }
+
+  if (window->plat.present_event == XCB_NONE)
+  {
+    window->plat.present_event = xcb_generate_id(x11.connection);
+    xcb_present_select_input(x11.connection, window->plat.present_event,
+                             window->plat.handle,
+                             XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+  }
+
+  window->plat.wants_frame = true;
+  xcb_present_notify_msc(x11.connection, window->plat.handle,
+                         ++window->plat.frame_serial, 0, 1, 0);
+  xcb_flush(x11.connection);
+  return CWIN_SUCCESS;
+}
+
+void cwin_mouse_capture(struct cwin_window *window)
+{
+  xcb_grab_pointer_cookie_t cookie =
+    xcb_grab_pointer(x11.connection, 1, window->plat.handle,
+                     XCB_EVENT_MASK_POINTER_MOTION |
+                     XCB_EVENT_MASK_BUTTON_PRESS |
+                     XCB_EVENT_MASK_BUTTON_RELEASE,
+                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC,
+                     XCB_NONE, XCB_NONE, XCB_CURRENT_TIME);
+  /* Don't wait to find out whether the grab succeeded. */
+  xcb_discard_reply(x11.connection, cookie.sequence);
+  xcb_flush(x11.connection);
+}
+
+void cwin_mouse_uncapture(struct cwin_window *window)
+{
+  (void) window;
+  xcb_ungrab_pointer(x11.connection, XCB_CURRENT_TIME);
+  xcb_flush(x11.connection);
+}
+
+enum cwin_error cwin_plat_create_buffer(struct cwin_window *window, int index)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  if (!x11.shm_checked)
+  {
+    /* Attaching by fd needs 1.2. */
+    xcb_shm_query_version_reply_t *reply =
+      xcb_shm_query_version_reply(x11.connection, x11.shm_version, NULL);
+    x11.has_shm = reply != NULL &&
+      (reply->major_version > 1 || reply->minor_version >= 2);
+    free(reply);
+    x11.shm_checked = true;
+
+    /* And passing the fd needs a local socket. XCB would close the
+       connection when sending it fails. */
+    struct sockaddr_storage address;
+    socklen_t address_len = sizeof(address);
+    if (getsockname(xcb_get_file_descriptor(x11.connection),
+                    (struct sockaddr *) &address, &address_len) != 0 ||
+        address.ss_family != AF_UNIX)
+    {
+      x11.has_shm = false;
+    }
+  }
+
+  /* Both common depths store a pixel in 32 bits. */
+  if (x11.screen->root_depth != 24 && x11.screen->root_depth != 32)
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  if (window->plat.gc == XCB_NONE)
+  {
+    window->plat.gc = xcb_generate_id(x11.connection);
+    xcb_create_gc(x11.connection, window->plat.gc, window->plat.handle, 0,
+                  NULL);
+  }
+
+  size_t size = (size_t) framebuffer->width * 4 * framebuffer->height;
+  window->plat.segments[index] = XCB_NONE;
+  if (!x11.has_shm)
+  {
+    void *pixels = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pixels == MAP_FAILED)
+    {
+      return CWIN_ERROR_POSIX_INTERNAL;
+    }
+
+    framebuffer->buffers[index].pixels = pixels;
+    return CWIN_SUCCESS;
+  }
+
+  int fd = posix_create_shm(size);
+  if (fd == -1)
+  {
+    return CWIN_ERROR_POSIX_INTERNAL;
+  }
+
+  void *pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (pixels == MAP_FAILED)
+  {
+    close(fd);
+    return CWIN_ERROR_POSIX_INTERNAL;
+  }
+
+  /* XCB closes the fd once it has been sent. */
+  xcb_shm_seg_t segment = xcb_generate_id(x11.connection);
+  if (x11.attach_checked)
+  {
+    xcb_shm_attach_fd(x11.connection, segment, fd, 0);
+  } else
+  {
+    xcb_generic_error_t *error = xcb_request_check(
+      x11.connection, xcb_shm_attach_fd_checked(x11.connection, segment, fd,
+                                                0));
+    x11.attach_checked = true;
+    if (error != NULL)
+    {
+      /* The memory is just as good as private memory. */
+      free(error);
+      x11.has_shm = false;
+      segment = XCB_NONE;
+    } else if (xcb_connection_has_error(x11.connection))
+    {
+      munmap(pixels, size);
+      return CWIN_ERROR_X11_INTERNAL;
+    }
+  }
+
+  window->plat.segments[index] = segment;
+  framebuffer->buffers[index].pixels = pixels;
+  return CWIN_SUCCESS;
+}
+
+/* Requests are handled in order, so the server is done with the segment by
+   the time it detaches it. */
+void cwin_plat_destroy_buffer(struct cwin_window *window, int index)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  if (window->plat.segments[index] != XCB_NONE)
+  {
+    xcb_shm_detach(x11.connection, window->plat.segments[index]);
+  }
+  munmap(framebuffer->buffers[index].pixels,
+         (size_t) framebuffer->width * 4 * framebuffer->height);
+}
+
+/* Only MIT-SHM buffers are ever busy. */
+enum cwin_error cwin_plat_wait_buffer(struct cwin_window *window)
+{
+  (void) window;
+  xcb_flush(x11.connection);
+
+  xcb_generic_event_t *event = xcb_wait_for_event(x11.connection);
+  if (event == NULL)
+  {
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+  x11_handle_event(event, cwin_plat_now_ns());
+  free(event);
+
+  return CWIN_SUCCESS;
+}
+
+/*
+ * The server copies the damage straight out of the shared segment. Only the
+ * last request asks for a completion event, which marks the whole buffer
+ * free again. Private buffers are copied into the requests, so they are free
+ * as soon as this returns.
+ */
+enum cwin_error cwin_plat_present_buffer(struct cwin_window *window,
+                                         int index,
+                                         const struct cwin_rect *damage,
+                                         size_t damage_count)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  for (size_t i = 0; i < damage_count; i++)
+  {
+    if (window->plat.segments[index] == XCB_NONE)
+    {
+      x11_put_rect(window, index, &damage[i]);
+      continue;
+    }
+
+    xcb_shm_put_image(x11.connection, window->plat.handle, window->plat.gc,
+                      framebuffer->width, framebuffer->height,
+                      damage[i].x, damage[i].y,
+                      damage[i].width, damage[i].height,
+                      damage[i].x, damage[i].y, x11.screen->root_depth,
+                      XCB_IMAGE_FORMAT_Z_PIXMAP, i == damage_count - 1,
+                      window->plat.segments[index], 0);
+  }
+  framebuffer->buffers[index].busy = window->plat.segments[index] != XCB_NONE;
+
+  xcb_flush(x11.connection);
+  if (xcb_connection_has_error(x11.connection))
+  {
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+  return CWIN_SUCCESS;
+}
+
+/*
+ * Sends a rectangle of a private buffer with PutImage, split to fit the
+ * maximum request length. Rows of full width rectangles are contiguous in the
+ * buffer, narrower rectangles are sent a row at a time.
+ */
+void x11_put_rect(struct cwin_window *window, int index,
+                  const struct cwin_rect *rect)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  const uint32_t *pixels = framebuffer->buffers[index].pixels;
+  size_t row_size = (size_t) rect->width * 4;
+  size_t max_size = (size_t) xcb_get_maximum_request_length(x11.connection) *
+    4 - sizeof(xcb_put_image_request_t);
+  int rows = 1;
+  if (rect->width == framebuffer->width)
+  {
+    rows = (int) (max_size / row_size);
+  }
+
+  for (int y = rect->y; y < rect->y + rect->height; y += rows)
+  {
+    int height = rect->y + rect->height - y < rows ?
+      rect->y + rect->height - y : rows;
+    xcb_put_image(x11.connection, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                  window->plat.handle, window->plat.gc, rect->width, height,
+                  rect->x, y, 0, x11.screen->root_depth,
+                  (uint32_t) (row_size * height),
+                  (const uint8_t *) &pixels[(size_t) y * framebuffer->width +
+                                            rect->x]);
+  }
+}
+
+/*
+ * The cursor is hidden with a blank cursor on the window, and held by a grab
+ * confined to it. The grab fails while the window is unmapped, the cursor is
+ * still hidden over it then.
+ */
+enum cwin_error cwin_mouse_set_relative(struct cwin_window *window,
+                                        bool relative)
+{
+  if (relative == window->plat.is_relative)
+  {
+    return CWIN_SUCCESS;
+  }
+  if (relative && !x11.has_xinput)
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  if (relative && x11.blank_cursor == XCB_NONE)
+  {
+    xcb_pixmap_t pixmap = xcb_generate_id(x11.connection);
+    xcb_create_pixmap(x11.connection, 1, pixmap, x11.screen->root, 1, 1);
+    /* The contents of a new pixmap are undefined, clear the one bit. */
+    xcb_gcontext_t gc = xcb_generate_id(x11.connection);
+    uint32_t foreground = 0;
+    xcb_create_gc(x11.connection, gc, pixmap, XCB_GC_FOREGROUND, &foreground);
+    xcb_rectangle_t rect = { 0, 0, 1, 1 };
+    xcb_poly_fill_rectangle(x11.connection, pixmap, gc, 1, &rect);
+    xcb_free_gc(x11.connection, gc);
+
+    x11.blank_cursor = xcb_generate_id(x11.connection);
+    xcb_create_cursor(x11.connection, x11.blank_cursor, pixmap, pixmap,
+                      0, 0, 0, 0, 0, 0, 0, 0);
+    xcb_free_pixmap(x11.connection, pixmap);
+  }
+
+  window->plat.is_relative = relative;
+  uint32_t cursor = relative ? x11.blank_cursor : XCB_NONE;
+  xcb_change_window_attributes(x11.connection, window->plat.handle,
+                               XCB_CW_CURSOR, &cursor);
+
+  if (relative)
+  {
+    xcb_grab_pointer_cookie_t cookie =
+      xcb_grab_pointer(x11.connection, 1, window->plat.handle,
+                       XCB_EVENT_MASK_BUTTON_PRESS |
+                       XCB_EVENT_MASK_BUTTON_RELEASE,
+                       XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC,
+                       window->plat.handle, x11.blank_cursor,
+                       XCB_CURRENT_TIME);
+    xcb_discard_reply(x11.connection, cookie.sequence);
+    if (x11.relative_count++ == 0)
+    {
+      x11_select_raw_motion(true);
+    }
+  } else
+  {
+    xcb_ungrab_pointer(x11.connection, XCB_CURRENT_TIME);
+    if (--x11.relative_count == 0)
+    {
+      x11_select_raw_motion(false);
+    }
+  }
+
+  xcb_flush(x11.connection);
+  if (xcb_connection_has_error(x11.connection))
+  {
+    return CWIN_ERROR_X11_INTERNAL;
+  }
+  return CWIN_SUCCESS;
+}
+
+/* Raw events only go to the root window. */
+void x11_select_raw_motion(bool select)
+{
+  struct {
+    xcb_input_event_mask_t head;
+    uint32_t mask;
+  } mask = {
+    .head = {
+      .deviceid = XCB_INPUT_DEVICE_ALL_MASTER,
+      .mask_len = 1,
+    },
+    .mask = select ? XCB_INPUT_XI_EVENT_MASK_RAW_MOTION : 0,
+  };
+
+  xcb_input_xi_select_events(x11.connection, x11.screen->root, 1, &mask.head);
+}
+
+struct cwin_window *x11_find_window(xcb_window_t handle)
+{
+  return window_map_find(&x11.windows, handle);
+}
+
+/*
+ * Parses Xft.dpi out of RESOURCE_MANAGER, the resource database xrdb loads,
+ * with 96 DPI as a scale of 1. Waits for the reply, which only happens at
+ * init and when the desktop changes its settings.
+ */
+float x11_read_scale(void)
+{
+  const char name[] = "Xft.dpi:";
+  float scale = 1;
+
+  xcb_get_property_cookie_t cookie =
+    xcb_get_property(x11.connection, 0, x11.screen->root,
+                     XCB_ATOM_RESOURCE_MANAGER, XCB_ATOM_STRING, 0, 16384);
+  xcb_get_property_reply_t *reply =
+    xcb_get_property_reply(x11.connection, cookie, NULL);
+  if (reply == NULL)
+  {
+    return scale;
+  }
+
+  const char *resources = xcb_get_property_value(reply);
+  const char *end = resources + xcb_get_property_value_length(reply);
+  for (const char *line = resources; line < end;)
+  {
+    const char *next = memchr(line, '\n', end - line);
+    next = next != NULL ? next + 1 : end;
+
+    /* Parsed by hand, strtod would depend on the locale. */
+    if (next - line >= (ptrdiff_t) sizeof(name) &&
+        memcmp(line, name, sizeof(name) - 1) == 0)
+    {
+      const char *it = line + sizeof(name) - 1;
+      while (it < next && (*it == ' ' || *it == '\t'))
+      {
+        it++;
+      }
+      float dpi = 0, digit = 1;
+      for (; it < next && *it >= '0' && *it <= '9'; it++)
+      {
+        dpi = dpi * 10 + (*it - '0');
+      }
+      if (it < next && *it == '.')
+      {
+        for (it++; it < next && *it >= '0' && *it <= '9'; it++)
+        {
+          digit /= 10;
+          dpi += (*it - '0') * digit;
+        }
+      }
+      if (dpi > 0)
+      {
+        scale = dpi / 96;
+      }
+      break;
+    }
+    line = next;
+  }
+
+  free(reply);
+  return scale;
+}
+
+/* Keeps the old keymap if the new one can't be built. The new state starts
+   without modifiers, so the next key event applies its own. */
+void x11_update_keymap(void)
+{
+  struct xkb_keymap *keymap =
+    xkb_x11_keymap_new_from_device(keyboard.context, x11.connection,
+                                   x11.keyboard_device,
+                                   XKB_KEYMAP_COMPILE_NO_FLAGS);
+  if (keymap == NULL)
+  {
+    return;
+  }
+
+  struct xkb_state *state =
+    xkb_x11_state_new_from_device(keymap, x11.connection, x11.keyboard_device);
+  if (state == NULL)
+  {
+    xkb_keymap_unref(keymap);
+    return;
+  }
+
+  keyboard_set_keymap(keymap, state);
+  x11.key_state = 0;
+}
+
+/* Every window shares the scale, so every window is told. Their sizes in
+   pixels don't change. */
+void x11_update_scale(void)
+{
+  float scale = x11_read_scale();
+  if (scale == x11.scale)
+  {
+    return;
+  }
+
+  x11.scale = scale;
+  for (size_t i = 0; x11.windows.len != 0 && i <= x11.windows.mask; i++)
+  {
+    struct cwin_window *window = x11.windows.slots[i].window;
+    if (window != NULL)
+    {
+      publish_window_state(window);
+      alloc_scale_event(window->queue, window, scale);
+    }
+  }
+}
+
+void x11_handle_event(xcb_generic_event_t *generic, uint64_t now_ns)
+{
+  struct cwin_event *event;
+  struct cwin_window *window;
+
+  message_time_ns = now_ns;
+
+  /* Extension events have no fixed codes. */
+  if (x11.has_shm && (generic->response_type & ~0x80) ==
+      x11.shm_first_event + XCB_SHM_COMPLETION)
+  {
+    x11_handle_shm_completion((xcb_shm_completion_event_t *) generic);
+    return;
+  }
+  if ((generic->response_type & ~0x80) == x11.xkb_first_event)
+  {
+    /* Every XKB event starts like this one, with its own type next. */
+    xcb_xkb_map_notify_event_t *xkb = (xcb_xkb_map_notify_event_t *) generic;
+    if (xkb->deviceID == x11.keyboard_device &&
+        (xkb->xkbType == XCB_XKB_NEW_KEYBOARD_NOTIFY ||
+         xkb->xkbType == XCB_XKB_MAP_NOTIFY))
+    {
+      x11_update_keymap();
+    }
+    return;
+  }
+
+  switch (generic->response_type & ~0x80)
+  {
+  case XCB_CONFIGURE_NOTIFY: {
+    xcb_configure_notify_event_t *configure =
+      (xcb_configure_notify_event_t *) generic;
+    window = x11_find_window(configure->window);
+    if (window == NULL ||
+        (configure->width == window->plat.width &&
+         configure->height == window->plat.height))
+    {
+      break;
+    }
+
+    window->plat.width = configure->width;
+    window->plat.height = configure->height;
+    publish_window_state(window);
+
+    event = alloc_window_event(window->queue, CWIN_WINDOW_EVENT_RESIZE,
+                               window);
+    if (event != NULL)
+    {
+      event->window.width = window->plat.width;
+      event->window.height = window->plat.height;
+    }
+    break;
+  }
+  case XCB_PROPERTY_NOTIFY: {
+    xcb_property_notify_event_t *property =
+      (xcb_property_notify_event_t *) generic;
+    if (property->window == x11.screen->root &&
+        property->atom == XCB_ATOM_RESOURCE_MANAGER)
+    {
+      x11_update_scale();
+    }
+    break;
+  }
+  case XCB_CLIENT_MESSAGE: {
+    xcb_client_message_event_t *message =
+      (xcb_client_message_event_t *) generic;
+    window = x11_find_window(message->window);
+    if (window != NULL &&
+        message->type == x11.atoms[X11_ATOM_WM_PROTOCOLS] &&
+        message->data.data32[0] == x11.atoms[X11_ATOM_WM_DELETE_WINDOW])
+    {
+      alloc_window_event(window->queue, CWIN_WINDOW_EVENT_CLOSE, window);
+    }
+    break;
+  }
+  case XCB_ENTER_NOTIFY: {
+    xcb_enter_notify_event_t *enter = (xcb_enter_notify_event_t *) generic;
+    message_time_ns = posix_event_time(enter->time, now_ns);
+    window = x11_find_window(enter->event);
+    if (window != NULL)
+    {
+      alloc_window_event(window->queue, CWIN_WINDOW_EVENT_ENTER, window);
+    }
+    break;
+  }
+  case XCB_LEAVE_NOTIFY: {
+    xcb_leave_notify_event_t *leave = (xcb_leave_notify_event_t *) generic;
+    message_time_ns = posix_event_time(leave->time, now_ns);
+    window = x11_find_window(leave->event);
+    if (window != NULL)
+    {
+      alloc_window_event(window->queue, CWIN_WINDOW_EVENT_EXIT, window);
+    }
+    break;
+  }
+  case XCB_FOCUS_IN:
+  case XCB_FOCUS_OUT: {
+    xcb_focus_in_event_t *focus = (xcb_focus_in_event_t *) generic;
+    /* Focus moving between the pointer and the window isn't a change. */
+    if (focus->detail == XCB_NOTIFY_DETAIL_POINTER)
+    {
+      break;
+    }
+
+    /* Keys released while unfocused never send a release to us. */
+    memset(x11.keys_down, 0, sizeof(x11.keys_down));
+
+    window = x11_find_window(focus->event);
+    if ((generic->response_type & ~0x80) == XCB_FOCUS_IN)
+    {
+      x11.focus = window;
+    } else if (x11.focus == window)
+    {
+      x11.focus = NULL;
+    }
+    if (window != NULL)
+    {
+      alloc_window_event(window->queue,
+                         (generic->response_type & ~0x80) == XCB_FOCUS_IN ?
+                         CWIN_WINDOW_EVENT_FOCUS : CWIN_WINDOW_EVENT_UNFOCUS,
+                         window);
+    }
+    break;
+  }
+  case XCB_KEY_PRESS:
+  case XCB_KEY_RELEASE: {
+    xcb_key_press_event_t *key = (xcb_key_press_event_t *) generic;
+    message_time_ns = posix_event_time(key->time, now_ns);
+    bool pressed = (generic->response_type & ~0x80) == XCB_KEY_PRESS;
+    window = x11_find_window(key->event);
+    if (window == NULL)
+    {
+      break;
+    }
+
+    /* The core state has the modifiers in the low byte and the group in bits
+       13 and 14, which is enough to pick the right symbols. */
+    if (key->state != x11.key_state)
+    {
+      x11.key_state = key->state;
+      keyboard_update_mask(key->state & 0xff, 0, 0, (key->state >> 13) & 3);
+    }
+
+    uint8_t bit = 1 << (key->detail % 8);
+    bool repeat = pressed && (x11.keys_down[key->detail / 8] & bit);
+    if (pressed)
+    {
+      x11.keys_down[key->detail / 8] |= bit;
+    } else
+    {
+      x11.keys_down[key->detail / 8] &= ~bit;
+    }
+
+    keyboard_translate(window->queue, window, key->detail, pressed, repeat,
+                       message_time_ns);
+    break;
+  }
+  case XCB_MOTION_NOTIFY: {
+    xcb_motion_notify_event_t *motion = (xcb_motion_notify_event_t *) generic;
+    message_time_ns = posix_event_time(motion->time, now_ns);
+    window = x11_find_window(motion->event);
+    /* Raw motion replaces it, see x11_handle_raw_motion. */
+    if (window == NULL || window->plat.is_relative)
+    {
+      break;
+    }
+
+    event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_MOVE, window);
+    if (event != NULL)
+    {
+      event->mouse.x = motion->event_x;
+      event->mouse.y = motion->event_y;
+    }
+    break;
+  }
+  case XCB_BUTTON_PRESS:
+  case XCB_BUTTON_RELEASE: {
+    xcb_button_press_event_t *button = (xcb_button_press_event_t *) generic;
+    message_time_ns = posix_event_time(button->time, now_ns);
+    bool pressed = (generic->response_type & ~0x80) == XCB_BUTTON_PRESS;
+    window = x11_find_window(button->event);
+    if (window == NULL)
+    {
+      break;
+    }
+
+    switch (button->detail)
+    {
+    case XCB_BUTTON_INDEX_1:
+    case XCB_BUTTON_INDEX_2:
+    case XCB_BUTTON_INDEX_3:
+      event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_BUTTON,
+                                window);
+      if (event != NULL)
+      {
+        event->mouse.state = pressed ? CWIN_BUTTON_DOWN : CWIN_BUTTON_UP;
+        event->mouse.button =
+          button->detail == XCB_BUTTON_INDEX_1 ? CWIN_MOUSE_BUTTON_LEFT :
+          button->detail == XCB_BUTTON_INDEX_2 ? CWIN_MOUSE_BUTTON_MIDDLE :
+          CWIN_MOUSE_BUTTON_RIGHT;
+      }
+      break;
+    /* The wheel is buttons 4 and 5, one press per notch. Scale to the 120
+       units per notch that Win32 reports. */
+    case XCB_BUTTON_INDEX_4:
+    case XCB_BUTTON_INDEX_5:
+      if (!pressed)
+      {
+        break;
+      }
+      event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_WHEEL,
+                                window);
+      if (event != NULL)
+      {
+        event->mouse.delta = button->detail == XCB_BUTTON_INDEX_4 ? 120 : -120;
+      }
+      break;
+    }
+    break;
+  }
+  case XCB_GE_GENERIC: {
+    xcb_ge_generic_event_t *ge = (xcb_ge_generic_event_t *) generic;
+    if (x11.has_xinput && ge->extension == x11.xinput_opcode &&
+        ge->event_type == XCB_INPUT_RAW_MOTION)
+    {
+      x11_handle_raw_motion((xcb_input_raw_motion_event_t *) generic, now_ns);
+    } else if (x11.has_present && ge->extension == x11.present_opcode &&
+               ge->event_type == XCB_PRESENT_COMPLETE_NOTIFY)
+    {
+      x11_handle_present_complete(
+        (xcb_present_complete_notify_event_t *) generic);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void x11_handle_shm_completion(xcb_shm_completion_event_t *completion)
+{
+  struct cwin_window *window = x11_find_window(completion->drawable);
+  if (window == NULL)
+  {
+    return;
+  }
+
+  for (int i = 0; i < window->framebuffer.buffer_count; i++)
+  {
+    if (window->framebuffer.buffers[i].pixels != NULL &&
+        window->plat.segments[i] == completion->shmseg)
+    {
+      window->framebuffer.buffers[i].busy = false;
+    }
+  }
+}
+
+/*
+ * Completions of the window's presents, including the Vulkan driver's, say
+ * when a frame was shown. A NotifyMSC completion is the frame request. UST
+ * is CLOCK_MONOTONIC in microseconds, and MSC counts vblanks.
+ */
+void x11_handle_present_complete(
+  xcb_present_complete_notify_event_t *complete)
+{
+  struct cwin_event *event;
+  struct cwin_window *window = x11_find_window(complete->window);
+  if (window == NULL || complete->ust == 0)
+  {
+    return;
+  }
+
+  uint64_t ust_ns = complete->ust * 1000;
+  if (window->plat.last_msc != 0 && complete->msc > window->plat.last_msc &&
+      complete->ust > window->plat.last_ust)
+  {
+    window->plat.refresh_ns = (complete->ust - window->plat.last_ust) * 1000 /
+      (complete->msc - window->plat.last_msc);
+  }
+  window->plat.last_ust = complete->ust;
+  window->plat.last_msc = complete->msc;
+
+  if (complete->kind == XCB_PRESENT_COMPLETE_KIND_PIXMAP &&
+      complete->mode != XCB_PRESENT_COMPLETE_MODE_SKIP)
+  {
+    window->plat.presented_ns = ust_ns;
+  } else if (complete->kind == XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC &&
+             window->plat.wants_frame &&
+             complete->serial == window->plat.frame_serial)
+  {
+    window->plat.wants_frame = false;
+    event = alloc_frame_event(window->queue, window,
+                              window->plat.presented_ns, ust_ns,
+                              window->plat.refresh_ns);
+    if (event != NULL)
+    {
+      event->time_ns = ust_ns;
+    }
+  }
+}
+
+/*
+ * Raw events aren't tied to a window, they go to the focused window if it is
+ * relative. Only the axes that changed have values, in the order of the set
+ * bits in the mask. The raw values are before acceleration.
+ */
+void x11_handle_raw_motion(xcb_input_raw_motion_event_t *raw, uint64_t now_ns)
+{
+  struct cwin_event *event;
+  struct cwin_window *window = x11.focus;
+  if (window == NULL || !window->plat.is_relative)
+  {
+    return;
+  }
+
+  const uint32_t *mask = xcb_input_raw_button_press_valuator_mask(raw);
+  const xcb_input_fp3232_t *values =
+    xcb_input_raw_button_press_axisvalues_raw(raw);
+  double delta[2] = { 0, 0 };
+  for (int axis = 0; axis < 2 && axis < raw->valuators_len * 32; axis++)
+  {
+    if (mask[0] & (1u << axis))
+    {
+      delta[axis] = values->integral + values->frac / 4294967296.0;
+      values++;
+    }
+  }
+  if (delta[0] == 0 && delta[1] == 0)
+  {
+    return;
+  }
+
+  message_time_ns = posix_event_time(raw->time, now_ns);
+  event = alloc_mouse_event(window->queue, CWIN_MOUSE_EVENT_RELATIVE, window);
+  if (event != NULL)
+  {
+    event->mouse.dx = (float) delta[0];
+    event->mouse.dy = (float) delta[1];
+  }
+}
+
+#ifdef CWIN_VULKAN
+
+const char *x11_vk_extensions[] = {
+  "VK_KHR_surface",
+  "VK_KHR_xcb_surface",
+};
+
+void cwin_vk_get_required_extensions(struct cwin_window *window,
+                                     const char **extensions,
+                                     int *extension_count)
+{
+  (void) window;
+
+  if (*extension_count == 0 || extensions == NULL)
+  {
+    *extension_count = sizeof(x11_vk_extensions) /
+      sizeof(x11_vk_extensions[0]);
+  } else
+  {
+    for (int i = 0; i < *extension_count; i++)
+    {
+      extensions[i] = x11_vk_extensions[i];
+    }
+  }
+}
+
+enum cwin_error cwin_vk_create_surface(struct cwin_window *window,
+                                       VkInstance instance,
+                                       VkSurfaceKHR *surface)
+{
+  VkResult err;
+  VkXcbSurfaceCreateInfoKHR surface_create_info = {
+    .sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR,
+    .connection = x11.connection,
+    .window = window->plat.handle,
+  };
+
+  err = vkCreateXcbSurfaceKHR(instance, &surface_create_info, NULL, surface);
+  if (err)
+  {
+    return CWIN_ERROR_VK_INTERNAL;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+#endif
+
+#endif
+
+#ifdef CWIN_BACKEND_HEADLESS
+
+#if defined(CWIN_BACKEND_WL) || defined(CWIN_BACKEND_WIN32) ||                 \
+    defined(CWIN_BACKEND_X11) || defined(CWIN_BACKEND_MACOS)
+#error Only one backend supported at a time.
+#endif
+
+#define HEADLESS_DEFAULT_WIDTH 640
+#define HEADLESS_DEFAULT_HEIGHT 480
+#define HEADLESS_INIT_MESSAGES 64
+#define HEADLESS_MONITOR_ID 1
+
+/* TYPES */
+
+struct cwin_headless_window {
+  int x, y;
+  int width, height; /* In pixels. */
+  float scale;
+  enum cwin_screen_state screen_state;
+  int windowed_width, windowed_height; /* Restored on leaving fullscreen. */
+  bool has_minimum, has_maximum;
+  int min_width, min_height;
+  int max_width, max_height;
+  bool is_captured;
+  bool is_relative;
+  bool wants_frame;
+  /* What a compositor would be showing, built up from presented damage. */
+  uint32_t *screen;
+  int screen_width, screen_height;
+};
+
+CWIN_WINDOW_TYPE(struct cwin_headless_window);
+
+/*
+ * Injected messages wait here, like in a real windowing system's connection,
+ * until events are pumped. The array keeps its allocation between pumps.
+ */
+struct {
+  struct cwin_headless_message *messages;
+  size_t messages_len, messages_alloc;
+} headless;
+
+/* A single simulated monitor, with a few modes to switch between. */
+const struct cwin_monitor headless_monitor = {
+  .id = HEADLESS_MONITOR_ID,
+  .name = "headless",
+  .width = 1920,
+  .height = 1080,
+  .width_mm = 527,
+  .height_mm = 296,
+  .scale = 1,
+  .mode = { 1920, 1080, 60000 },
+  .primary = true,
+};
+
+const struct cwin_monitor_mode headless_modes[] = {
+  { 1920, 1080, 144000 },
+  { 1920, 1080, 60000 },
+  { 1280, 720, 60000 },
+};
+
+/* PROTOTYPES */
+
+void headless_translate(const struct cwin_headless_message *message);
+void headless_set_size(struct cwin_window *window, int width, int height);
+
+/* PLATFORM FUNCTIONS */
+
+void cwin_plat_get_state(struct cwin_window *window,
+                         struct cwin_window_state *state)
+{
+  state->width = window->plat.width;
+  state->height = window->plat.height;
+  state->screen_width = scale_round(window->plat.width / window->plat.scale);
+  state->screen_height = scale_round(window->plat.height /
+                                     window->plat.scale);
+  state->scale = window->plat.scale;
+  state->screen_state = window->plat.screen_state;
+}
+
+enum cwin_error cwin_plat_pump_events(void)
+{
+  STATS_BEGIN("cwin translate");
+  for (size_t i = 0; i < headless.messages_len; i++)
+  {
+    message_time_ns = headless.messages[i].time_ns;
+    headless_translate(&headless.messages[i]);
+  }
+  headless.messages_len = 0;
+  STATS_END(stats.translate_ns);
+
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_plat_wait_events(uint64_t timeout_ns)
+{
+  /* Messages are injected on the event thread, so they can't arrive while it
+     sleeps. Only posted user events can wake it. */
+  if (headless.messages_len == 0)
+  {
+    struct pollfd pfds[] = {
+      { .fd = posix.wake_fd, .events = POLLIN },
+      { .fd = posix.timer_fd, .events = POLLIN },
+    };
+    poll(pfds, 2, posix_timeout_ms(timeout_ns));
+    if (pfds[0].revents & POLLIN)
+    {
+      cwin_plat_clear_wake();
+    }
+  }
+
+  return cwin_plat_pump_events();
+}
+
+/* Only posted user events make it readable, injected messages are already
+   pending. */
+int cwin_plat_get_event_fd(void)
+{
+  return posix_get_event_fd(-1);
+}
+
+enum cwin_error cwin_plat_init(void)
+{
+  enum cwin_error err;
+
+  headless.messages_alloc = HEADLESS_INIT_MESSAGES;
+  headless.messages_len = 0;
+  headless.messages = CWIN_ARR(struct cwin_headless_message,
+                               headless.messages_alloc);
+  if (headless.messages == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  err = posix_init_wake();
+  if (err)
+  {
+    CWIN_FREE_ARR(struct cwin_headless_message, headless.messages_alloc,
+                  headless.messages);
+    return err;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_deinit(void)
+{
+  CWIN_FREE_ARR(struct cwin_headless_message, headless.messages_alloc,
+                headless.messages);
+  memset(&headless, 0, sizeof(headless));
+  posix_deinit_wake();
+}
+
+enum cwin_error cwin_plat_init_window(struct cwin_window *window,
+                                      struct cwin_window_builder *builder)
+{
+  /* Windows start at scale 1, until a scale message says otherwise. */
+  window->plat.x = builder->x;
+  window->plat.y = builder->y;
+  window->plat.width = builder->width;
+  window->plat.height = builder->height;
+  window->plat.scale = 1;
+  if (builder->width == CWIN_WINDOW_SIZE_UNDEFINED)
+  {
+    window->plat.width = HEADLESS_DEFAULT_WIDTH;
+  }
+  if (builder->height == CWIN_WINDOW_SIZE_UNDEFINED)
+  {
+    window->plat.height = HEADLESS_DEFAULT_HEIGHT;
+  }
+  window->plat.screen_state = CWIN_SCREEN_WINDOWED;
+  window->plat.has_minimum = window->plat.has_maximum = false;
+  window->plat.is_captured = false;
+  window->plat.is_relative = false;
+  window->plat.wants_frame = false;
+  window->plat.screen = NULL;
+  window->plat.screen_width = window->plat.screen_height = 0;
+
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_deinit_window(struct cwin_window *window)
+{
+  /* Drop the messages that still refer to the window. */
+  size_t kept = 0;
+  for (size_t i = 0; i < headless.messages_len; i++)
+  {
+    if (headless.messages[i].window != window)
+    {
+      headless.messages[kept++] = headless.messages[i];
+    }
+  }
+  headless.messages_len = kept;
+
+  CWIN_FREE_ARR(uint32_t, (size_t) window->plat.screen_width *
+                window->plat.screen_height, window->plat.screen);
+}
+
+void cwin_plat_get_raw_window(struct cwin_window *window,
+                              struct cwin_raw_window *raw)
+{
+  (void) window;
+  raw->t = CWIN_RAW_WINDOW_HEADLESS;
+}
+
+void cwin_plat_set_event_mask(struct cwin_window *window)
+{
+  (void) window;
+}
+
+void cwin_plat_set_screen_state(struct cwin_window *window,
+                                enum cwin_screen_state state)
+{
+  if (state == CWIN_SCREEN_WINDOWED)
+  {
+    if (window->plat.screen_state != CWIN_SCREEN_WINDOWED)
+    {
+      headless_set_size(window, window->plat.windowed_width,
+                        window->plat.windowed_height);
+    }
+    window->plat.screen_state = state;
+    return;
+  }
+
+  /* Both cover the monitor in the desktop's mode. */
+  if (window->plat.screen_state == CWIN_SCREEN_WINDOWED)
+  {
+    window->plat.windowed_width = window->plat.width;
+    window->plat.windowed_height = window->plat.height;
+  }
+  window->plat.screen_state = state;
+  headless_set_size(window, headless_monitor.mode.width,
+                    headless_monitor.mode.height);
+}
+
+enum cwin_error cwin_get_monitors(struct cwin_monitor *monitors, int *count)
+{
+  copy_list(monitors, count, &headless_monitor, 1, sizeof(headless_monitor));
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_monitor_get_modes(uint64_t monitor,
+                                       struct cwin_monitor_mode *modes,
+                                       int *count)
+{
+  if (monitor != HEADLESS_MONITOR_ID)
+  {
+    return CWIN_ERROR_INVALID_MONITOR;
+  }
+
+  copy_list(modes, count, headless_modes,
+            sizeof(headless_modes) / sizeof(headless_modes[0]),
+            sizeof(headless_modes[0]));
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_plat_set_fullscreen(
+  struct cwin_window *window, uint64_t monitor,
+  const struct cwin_monitor_mode *mode)
+{
+  if (monitor != 0 && monitor != HEADLESS_MONITOR_ID)
+  {
+    return CWIN_ERROR_INVALID_MONITOR;
+  }
+
+  int width = headless_monitor.mode.width;
+  int height = headless_monitor.mode.height;
+  if (mode != NULL)
+  {
+    int index = pick_mode(headless_modes,
+                          sizeof(headless_modes) / sizeof(headless_modes[0]),
+                          mode);
+    if (index == -1)
+    {
+      return CWIN_ERROR_UNSUPPORTED;
+    }
+    width = headless_modes[index].width;
+    height = headless_modes[index].height;
+  }
+
+  if (window->plat.screen_state == CWIN_SCREEN_WINDOWED)
+  {
+    window->plat.windowed_width = window->plat.width;
+    window->plat.windowed_height = window->plat.height;
+  }
+  window->plat.screen_state = CWIN_SCREEN_FULLSCREEN;
+  headless_set_size(window, width, height);
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_set_maximum_size(struct cwin_window *window,
+                                int max_width, int max_height)
+{
+  window->plat.has_maximum = true;
+  window->plat.max_width = max_width;
+  window->plat.max_height = max_height;
+}
+
+void cwin_plat_set_minimum_size(struct cwin_window *window,
+                                int min_width, int min_height)
+{
+  window->plat.has_minimum = true;
+  window->plat.min_width = min_width;
+  window->plat.min_height = min_height;
+}
+
+enum cwin_error cwin_window_request_frame(struct cwin_window *window)
+{
+  window->plat.wants_frame = true;
+  return CWIN_SUCCESS;
+}
+
+void cwin_mouse_capture(struct cwin_window *window)
+{
+  window->plat.is_captured = true;
+}
+
+void cwin_mouse_uncapture(struct cwin_window *window)
+{
+  window->plat.is_captured = false;
+}
+
+enum cwin_error cwin_mouse_set_relative(struct cwin_window *window,
+                                        bool relative)
+{
+  window->plat.is_relative = relative;
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_plat_create_buffer(struct cwin_window *window, int index)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  framebuffer->buffers[index].pixels =
+    CWIN_ARR(uint32_t, (size_t) framebuffer->width * framebuffer->height);
+  if (framebuffer->buffers[index].pixels == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+void cwin_plat_destroy_buffer(struct cwin_window *window, int index)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  CWIN_FREE_ARR(uint32_t, (size_t) framebuffer->width * framebuffer->height,
+                framebuffer->buffers[index].pixels);
+}
+
+/* Presenting copies out of the buffer right away, so none is ever busy. */
+enum cwin_error cwin_plat_wait_buffer(struct cwin_window *window)
+{
+  (void) window;
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_plat_present_buffer(struct cwin_window *window,
+                                         int index,
+                                         const struct cwin_rect *damage,
+                                         size_t damage_count)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  if (framebuffer->width != window->plat.screen_width ||
+      framebuffer->height != window->plat.screen_height)
+  {
+    uint32_t *screen =
+      CWIN_ARR(uint32_t, (size_t) framebuffer->width * framebuffer->height);
+    if (screen == NULL)
+    {
+      return CWIN_ERROR_OOM;
+    }
+
+    CWIN_FREE_ARR(uint32_t, (size_t) window->plat.screen_width *
+                  window->plat.screen_height, window->plat.screen);
+    window->plat.screen = screen;
+    window->plat.screen_width = framebuffer->width;
+    window->plat.screen_height = framebuffer->height;
+  }
+
+  const uint32_t *pixels = framebuffer->buffers[index].pixels;
+  for (size_t i = 0; i < damage_count; i++)
+  {
+    for (int y = damage[i].y; y < damage[i].y + damage[i].height; y++)
+    {
+      size_t offset = (size_t) y * framebuffer->width + damage[i].x;
+      memcpy(&window->plat.screen[offset], &pixels[offset],
+             damage[i].width * sizeof(uint32_t));
+    }
+  }
+
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_headless_inject(
+  const struct cwin_headless_message *message)
+{
+  if (headless.messages_len + 1 > headless.messages_alloc)
+  {
+    struct cwin_headless_message *messages =
+      CWIN_REALLOC(struct cwin_headless_message, headless.messages_alloc,
+                   headless.messages_alloc * 2, headless.messages);
+    if (messages == NULL)
+    {
+      return CWIN_ERROR_OOM;
+    }
+    headless.messages = messages;
+    headless.messages_alloc *= 2;
+  }
+
+  struct cwin_headless_message *injected =
+    &headless.messages[headless.messages_len++];
+  *injected = *message;
+  if (injected->time_ns == 0)
+  {
+    injected->time_ns = cwin_plat_now_ns();
+  }
+
+  return CWIN_SUCCESS;
+}
+
+void cwin_headless_read_framebuffer(struct cwin_window *window,
+                                    struct cwin_framebuffer *framebuffer)
+{
+  framebuffer->pixels = window->plat.screen;
+  framebuffer->width = window->plat.screen_width;
+  framebuffer->height = window->plat.screen_height;
+  framebuffer->stride = window->plat.screen_width;
+  framebuffer->age = 1;
+}
+
+/* The headless counterpart of a window procedure. */
+void headless_translate(const struct cwin_headless_message *message)
+{
+  struct cwin_event *event;
+  struct cwin_window *window = message->window;
+  struct cwin_event_queue *queue = window->queue;
+
+  switch (message->t)
+  {
+  case CWIN_HEADLESS_MESSAGE_RESIZE: {
+    /* The size limits are in screen coordinates. */
+    float scale = window->plat.scale;
+    int width = message->resize.width;
+    int height = message->resize.height;
+    if (window->plat.has_minimum)
+    {
+      int min_width = scale_round(window->plat.min_width * scale);
+      int min_height = scale_round(window->plat.min_height * scale);
+      width = width < min_width ? min_width : width;
+      height = height < min_height ? min_height : height;
+    }
+    if (window->plat.has_maximum)
+    {
+      int max_width = scale_round(window->plat.max_width * scale);
+      int max_height = scale_round(window->plat.max_height * scale);
+      width = width > max_width ? max_width : width;
+      height = height > max_height ? max_height : height;
+    }
+
+    window->plat.width = width;
+    window->plat.height = height;
+    publish_window_state(window);
+
+    event = alloc_window_event(queue, CWIN_WINDOW_EVENT_RESIZE, window);
+    if (event != NULL)
+    {
+      event->window.width = width;
+      event->window.height = height;
+    }
+    break;
+  }
+  case CWIN_HEADLESS_MESSAGE_CLOSE:
+    alloc_window_event(queue, CWIN_WINDOW_EVENT_CLOSE, window);
+    break;
+  case CWIN_HEADLESS_MESSAGE_FOCUS:
+    alloc_window_event(queue, CWIN_WINDOW_EVENT_FOCUS, window);
+    break;
+  case CWIN_HEADLESS_MESSAGE_UNFOCUS:
+    alloc_window_event(queue, CWIN_WINDOW_EVENT_UNFOCUS, window);
+    break;
+  case CWIN_HEADLESS_MESSAGE_POINTER_ENTER:
+    alloc_window_event(queue, CWIN_WINDOW_EVENT_ENTER, window);
+    break;
+  case CWIN_HEADLESS_MESSAGE_POINTER_LEAVE:
+    alloc_window_event(queue, CWIN_WINDOW_EVENT_EXIT, window);
+    break;
+  case CWIN_HEADLESS_MESSAGE_POINTER_MOTION:
+    if (window->plat.is_relative)
+    {
+      break;
+    }
+
+    event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_MOVE, window);
+    if (event != NULL)
+    {
+      event->mouse.x = message->motion.x;
+      event->mouse.y = message->motion.y;
+    }
+    break;
+  case CWIN_HEADLESS_MESSAGE_POINTER_BUTTON:
+    event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_BUTTON, window);
+    if (event != NULL)
+    {
+      event->mouse.state = message->button.state;
+      event->mouse.button = message->button.button;
+    }
+    break;
+  case CWIN_HEADLESS_MESSAGE_POINTER_WHEEL:
+    event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_WHEEL, window);
+    if (event != NULL)
+    {
+      event->mouse.delta = message->wheel.delta;
+    }
+    break;
+  case CWIN_HEADLESS_MESSAGE_POINTER_RELATIVE:
+    if (!window->plat.is_relative)
+    {
+      break;
+    }
+
+    event = alloc_mouse_event(queue, CWIN_MOUSE_EVENT_RELATIVE, window);
+    if (event != NULL)
+    {
+      event->mouse.dx = message->relative.dx;
+      event->mouse.dy = message->relative.dy;
+    }
+    break;
+  case CWIN_HEADLESS_MESSAGE_FRAME:
+    if (!window->plat.wants_frame)
+    {
+      break;
+    }
+
+    window->plat.wants_frame = false;
+    alloc_frame_event(queue, window, message->frame.presented_ns,
+                      message->frame.vblank_ns, message->frame.refresh_ns);
+    break;
+  case CWIN_HEADLESS_MESSAGE_KEY:
+    event = alloc_key_event(queue, message->key.state, window);
+    if (event != NULL)
+    {
+      event->key.scancode = message->key.scancode;
+      event->key.key = message->key.key;
+      event->key.modifiers = message->key.modifiers;
+      event->key.repeat = message->key.repeat;
+    }
+    break;
+  case CWIN_HEADLESS_MESSAGE_TEXT: {
+    size_t len = message->text.len;
+    if (len == 0)
+    {
+      len = strlen(message->text.text);
+    }
+    alloc_text_event(queue, window, message->text.text, len);
+    break;
+  }
+  case CWIN_HEADLESS_MESSAGE_SCALE: {
+    /* The size in screen coordinates is kept, like a window moved between
+       monitors. */
+    float old_scale = window->plat.scale;
+    float scale = message->scale.scale;
+    if (scale <= 0 || scale == old_scale)
+    {
+      break;
+    }
+
+    int width = scale_round(window->plat.width / old_scale * scale);
+    int height = scale_round(window->plat.height / old_scale * scale);
+    bool resized = width != window->plat.width ||
+      height != window->plat.height;
+    window->plat.scale = scale;
+    window->plat.width = width;
+    window->plat.height = height;
+    publish_window_state(window);
+
+    alloc_scale_event(queue, window, scale);
+    if (!resized)
+    {
+      break;
+    }
+
+    event = alloc_window_event(queue, CWIN_WINDOW_EVENT_RESIZE, window);
+    if (event != NULL)
+    {
+      event->window.width = width;
+      event->window.height = height;
+    }
+    break;
+  }
+  }
+}
+
+/* Resizes the window as the windowing system would, sending a resize. */
+void headless_set_size(struct cwin_window *window, int width, int height)
+{
+  if (width == window->plat.width && height == window->plat.height)
+  {
+    return;
+  }
+
+  window->plat.width = width;
+  window->plat.height = height;
+  publish_window_state(window);
+  struct cwin_event *event = alloc_window_event(window->queue,
+                                                CWIN_WINDOW_EVENT_RESIZE,
+                                                window);
+  if (event != NULL)
+  {
+    event->window.width = width;
+    event->window.height = height;
+  }
+}
+
+#ifdef CWIN_VULKAN
+
+const char *headless_vk_extensions[] = {
+  "VK_KHR_surface",
+  "VK_EXT_headless_surface",
+};
+
+void cwin_vk_get_required_extensions(struct cwin_window *window,
+                                     const char **extensions,
+                                     int *extension_count)
+{
+  (void) window;
+
+  if (*extension_count == 0 || extensions == NULL)
+  {
+    *extension_count = sizeof(headless_vk_extensions) /
+      sizeof(headless_vk_extensions[0]);
+  } else
+  {
+    for (int i = 0; i < *extension_count; i++)
+    {
+      extensions[i] = headless_vk_extensions[i];
+    }
+  }
+}
+
+enum cwin_error cwin_vk_create_surface(struct cwin_window *window,
+                                       VkInstance instance,
+                                       VkSurfaceKHR *surface)
+{
+  VkResult err;
+  (void) window;
+
+  PFN_vkCreateHeadlessSurfaceEXT create_headless_surface =
+    (PFN_vkCreateHeadlessSurfaceEXT)
+    vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT");
+  if (create_headless_surface == NULL)
+  {
+    return CWIN_ERROR_VK_INTERNAL;
+  }
+
+  VkHeadlessSurfaceCreateInfoEXT surface_create_info = {
+    .sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+  };
+
+  err = create_headless_surface(instance, &surface_create_info, NULL, surface);
+  if (err)
+  {
+    return CWIN_ERROR_VK_INTERNAL;
+  }
+
+  return CWIN_SUCCESS;
+}
+
+#endif
+
+#endif
+
+/* PRIVATE FUNCTIONS */
+
+void *default_alloc(void *user, size_t size, size_t align)
+{
+  (void) user;
+  (void) align;
+  return malloc(size);
+}
+
+void *default_realloc(void *user, void *ptr, size_t old_size, size_t new_size,
+                      size_t align)
+{
+  (void) user;
+  (void) old_size;
+  (void) align;
+  return realloc(ptr, new_size);
+}
+
+void default_free(void *user, void *ptr, size_t size)
+{
+  (void) user;
+  (void) size;
+  free(ptr);
+}
+
+/* Allocates len zeroed elements, failing on overflow like calloc. */
+void *mem_alloc(size_t len, size_t size, size_t align)
+{
+  if (len == 0 || len > SIZE_MAX / size)
+  {
+    return NULL;
+  }
+
+  void *ptr = allocator.alloc(allocator.user, len * size, align);
+  if (ptr != NULL)
+  {
+    memset(ptr, 0, len * size);
+  }
+  return ptr;
+}
+
+/* Unlike mem_alloc, the new elements are not zeroed. */
+void *mem_realloc(void *ptr, size_t old_len, size_t new_len, size_t size,
+                  size_t align)
+{
+  if (new_len == 0 || new_len > SIZE_MAX / size)
+  {
+    return NULL;
+  }
+
+  return allocator.realloc(allocator.user, ptr, old_len * size,
+                           new_len * size, align);
+}
+
+void mem_free(void *ptr, size_t size)
+{
+  if (ptr != NULL)
+  {
+    allocator.free(allocator.user, ptr, size);
+  }
+}
+
+/* Returns at least size bytes of scratch memory, invalidating the last. */
+void *scratch_reserve(size_t size)
+{
+  if (size <= scratch.size)
+  {
+    return scratch.data;
+  }
+
+  size_t new_size = scratch.size * 2;
+  if (new_size < size)
+  {
+    new_size = size;
+  }
+
+  void *data = allocator.alloc(allocator.user, new_size,
+                               _Alignof(max_align_t));
+  if (data == NULL)
+  {
+    return NULL;
+  }
+
+  mem_free(scratch.data, scratch.size);
+  scratch.data = data;
+  scratch.size = new_size;
+  return data;
+}
+
+struct cwin_event *alloc_overflow_event(struct cwin_event_queue *queue)
+{
+  switch (queue->overflow)
+  {
+  case CWIN_QUEUE_OVERFLOW_GROW:
+    if (queue->spill == NULL)
+    {
+      queue->spill = CWIN_ARR(struct cwin_event, queue->mask + 1);
+      if (queue->spill == NULL)
+      {
+        return NULL;
+      }
+      STAT_ADD(queue->stats.allocations, 1);
+      track_queue_memory(queue,
+                         (queue->mask + 1) * sizeof(struct cwin_event), 0);
+      queue->spill_head = queue->spill_tail = 0;
+    }
+
+    /* Only grow once, after that the newest events are dropped. */
+    if (queue->spill_tail > queue->mask)
+    {
+      return NULL;
+    }
+    return &queue->spill[queue->spill_tail++];
+  case CWIN_QUEUE_OVERFLOW_DROP_OLDEST:
+    /* Lent events can't be overwritten. */
+    if (queue->lent != 0)
+    {
+      return NULL;
+    }
+    STAT_ADD(queue->stats.dropped[queue->events[queue->head & queue->mask].t],
+             1);
+    queue->head++;
+    return &queue->events[queue->tail++ & queue->mask];
+  case CWIN_QUEUE_OVERFLOW_DROP_NEWEST:
+    return NULL;
+  }
+
+  return NULL;
+}
+
+struct cwin_event *alloc_event(struct cwin_event_queue *queue,
+                               enum cwin_event_type type)
+{
+  struct cwin_event *event;
+  if (queue->replaying && !replay.feeding)
+  {
+    return NULL;
+  }
+
+  if (queue->spill != NULL || queue->tail - queue->head > queue->mask)
+  {
+    event = alloc_overflow_event(queue);
+    if (event == NULL)
+    {
+      STAT_ADD(queue->stats.dropped[type], 1);
+      return NULL;
+    }
+  } else
+  {
+    event = &queue->events[queue->tail++ & queue->mask];
+  }
+
+#ifdef CWIN_STATS
+  stats_enqueued(queue, type);
+#endif
+  event->t = type;
+  event->time_ns = message_time_ns;
+  return event;
+}
+
+/*
+ * Converts a timestamp from a platform's 32 bit millisecond clock to the cwin
+ * clock, given that clock's current reading. Timestamps that can't be on the
+ * same clock fall back to now.
+ */
+uint64_t event_time_from_ms(uint32_t time_ms, uint32_t now_ms,
+                            uint64_t now_ns)
+{
+  uint32_t age = now_ms - time_ms;
+  if (age > MAX_EVENT_AGE_MS)
+  {
+    return now_ns;
+  }
+
+  return now_ns - (uint64_t) age * 1000000;
+}
+
+bool event_queue_is_empty(struct cwin_event_queue *queue)
+{
+  return queue->head == queue->tail && queue->spill == NULL;
+}
+
+bool user_events_pending(struct cwin_event_queue *queue)
+{
+  struct cwin_user_slot *slot =
+    &queue->user_slots[queue->user_head & queue->user_mask];
+  return atomic_load_explicit(&slot->seq, memory_order_acquire) ==
+    queue->user_head + 1;
+}
+
+/*
+ * Moves the published user events behind the pending platform events. They
+ * go through alloc_event like any other event, so the queue's overflow policy
+ * applies to them too.
+ */
+void drain_user_events(struct cwin_event_queue *queue)
+{
+  while (user_events_pending(queue))
+  {
+    struct cwin_user_slot *slot =
+      &queue->user_slots[queue->user_head & queue->user_mask];
+
+    struct cwin_event *event = alloc_event(queue, CWIN_EVENT_USER);
+    if (event != NULL)
+    {
+      event->time_ns = slot->time_ns;
+      event->user = slot->payload;
+    }
+
+    atomic_store_explicit(&slot->seq, queue->user_head + queue->user_mask + 1,
+                          memory_order_release);
+    queue->user_head++;
+  }
+}
+
+/* Called by the backends whenever the size, scale or screen state changed,
+   before queueing the event that reports it. */
+void publish_window_state(struct cwin_window *window)
+{
+  struct window_snapshot *snapshot = &window->snapshot;
+  struct cwin_window_state state;
+  cwin_plat_get_state(window, &state);
+
+  uint32_t scale_bits;
+  memcpy(&scale_bits, &state.scale, sizeof(scale_bits));
+
+  unsigned seq = atomic_load_explicit(&snapshot->seq, memory_order_relaxed);
+  atomic_store_explicit(&snapshot->seq, seq + 1, memory_order_relaxed);
+  /* Keeps the fields from being stored before seq turns odd. */
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&snapshot->width, state.width, memory_order_relaxed);
+  atomic_store_explicit(&snapshot->height, state.height, memory_order_relaxed);
+  atomic_store_explicit(&snapshot->screen_width, state.screen_width,
+                        memory_order_relaxed);
+  atomic_store_explicit(&snapshot->screen_height, state.screen_height,
+                        memory_order_relaxed);
+  atomic_store_explicit(&snapshot->scale_bits, scale_bits,
+                        memory_order_relaxed);
+  atomic_store_explicit(&snapshot->screen_state, (int) state.screen_state,
+                        memory_order_relaxed);
+  atomic_store_explicit(&snapshot->seq, seq + 2, memory_order_release);
+}
+
+/* Claims a slot like cwin_post_user_event, but waits for room. */
+void push_command(const struct command *command)
+{
+  struct command_slot *slot;
+  size_t pos = atomic_load_explicit(&commands.tail, memory_order_relaxed);
+  for (;;)
+  {
+    slot = &commands.slots[pos % COMMAND_CAPACITY];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t) (seq - pos);
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&commands.tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        break;
+      }
+    } else if (diff < 0)
+    {
+      /* Sampled before the recheck, so a drain in between isn't missed. */
+      unsigned drained = atomic_load_explicit(&commands.drained,
+                                              memory_order_acquire);
+      if (atomic_load_explicit(&slot->seq, memory_order_acquire) == seq)
+      {
+        cwin_plat_wake();
+        cwin_plat_wait_on_address(&commands.drained, drained);
+      }
+      pos = atomic_load_explicit(&commands.tail, memory_order_relaxed);
+    } else
+    {
+      pos = atomic_load_explicit(&commands.tail, memory_order_relaxed);
+    }
+  }
+
+  slot->command = *command;
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+  /* Pairs with the fence in cwin_wait_event. */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_exchange_explicit(&event_thread_waiting, false,
+                               memory_order_relaxed))
+  {
+    cwin_plat_wake();
+  }
+}
+
+bool commands_pending(void)
+{
+  struct command_slot *slot =
+    &commands.slots[commands.head % COMMAND_CAPACITY];
+  return atomic_load_explicit(&slot->seq, memory_order_acquire) ==
+    commands.head + 1;
+}
+
+/* Runs the published commands in the order they were pushed. */
+void drain_commands(void)
+{
+  if (!commands_pending())
+  {
+    return;
+  }
+
+  while (commands_pending())
+  {
+    struct command_slot *slot =
+      &commands.slots[commands.head % COMMAND_CAPACITY];
+    struct command command = slot->command;
+    atomic_store_explicit(&slot->seq, commands.head + COMMAND_CAPACITY,
+                          memory_order_release);
+    commands.head++;
+    run_command(&command);
+  }
+
+  atomic_fetch_add_explicit(&commands.drained, 1, memory_order_release);
+  cwin_plat_wake_address(&commands.drained);
+}
+
+void run_command(const struct command *command)
+{
+  struct cwin_window *window = command->window;
+  switch (command->t)
+  {
+  case COMMAND_SCREEN_STATE:
+    cwin_plat_set_screen_state(window, command->screen_state);
+    break;
+  case COMMAND_FULLSCREEN:
+    cwin_plat_set_fullscreen(window, command->fullscreen.monitor,
+                             command->fullscreen.has_mode ?
+                             &command->fullscreen.mode : NULL);
+    break;
+  case COMMAND_MINIMUM_SIZE:
+    cwin_plat_set_minimum_size(window, command->size.width,
+                               command->size.height);
+    break;
+  case COMMAND_MAXIMUM_SIZE:
+    cwin_plat_set_maximum_size(window, command->size.width,
+                               command->size.height);
+    break;
+  }
+  publish_window_state(window);
+}
+
+/*
+ * Returns the longest contiguous run of pending events at the front of the
+ * queue. The ring is drained before the spill segment, and a run never wraps
+ * around the end of the ring.
+ */
+size_t front_events(struct cwin_event_queue *queue,
+                    struct cwin_event **events)
+{
+  if (queue->head != queue->tail)
+  {
+    size_t start = queue->head & queue->mask;
+    size_t count = queue->tail - queue->head;
+    if (count > queue->mask + 1 - start)
+    {
+      count = queue->mask + 1 - start;
+    }
+
+    *events = &queue->events[start];
+    return count;
+  }
+
+  if (queue->spill == NULL)
+  {
+    return 0;
+  }
+
+  *events = &queue->spill[queue->spill_head];
+  return queue->spill_tail - queue->spill_head;
+}
+
+/* count must not be more than front_events last returned. Every delivered
+   event passes through here, so this is where they are recorded. */
+void drop_front_events(struct cwin_event_queue *queue, size_t count)
+{
+  if (queue->recorder != NULL)
+  {
+    struct cwin_event *front;
+    front_events(queue, &front);
+    record_events(queue->recorder, front, count);
+  }
+
+  if (queue->head != queue->tail)
+  {
+    queue->head += count;
+    return;
+  }
+
+  queue->spill_head += count;
+  if (queue->spill_head == queue->spill_tail)
+  {
+    CWIN_FREE_ARR(struct cwin_event, queue->mask + 1, queue->spill);
+    queue->spill = NULL;
+    track_queue_memory(queue, 0,
+                       (queue->mask + 1) * sizeof(struct cwin_event));
+  }
+}
+
+bool pop_event(struct cwin_event_queue *queue, struct cwin_event *event)
+{
+  struct cwin_event *front;
+  if (front_events(queue, &front) == 0)
+  {
+    return false;
+  }
+
+  *event = *front;
+  drop_front_events(queue, 1);
+  return true;
+}
+
+size_t pop_events(struct cwin_event_queue *queue, struct cwin_event *events,
+                  size_t capacity)
+{
+  size_t total = 0;
+  struct cwin_event *front;
+  size_t count;
+
+  /* At most three runs: the ring up to its end, the wrapped part of the ring,
+     and the spill segment. */
+  while (total < capacity && (count = front_events(queue, &front)) != 0)
+  {
+    if (count > capacity - total)
+    {
+      count = capacity - total;
+    }
+
+    memcpy(&events[total], front, count * sizeof(struct cwin_event));
+    drop_front_events(queue, count);
+    total += count;
+  }
+
+  return total;
+}
+
+void track_queue_memory(struct cwin_event_queue *queue, size_t allocated,
+                        size_t freed)
+{
+  queue->memory += allocated - freed;
+  if (queue->memory > queue->peak_memory)
+  {
+    queue->peak_memory = queue->memory;
+  }
+}
+
+/* Returns the newest pending event, if it isn't lent out. */
+struct cwin_event *last_pending_event(struct cwin_event_queue *queue)
+{
+  if (queue->spill != NULL)
+  {
+    /* When the ring is empty the spill segment may be the lent span. */
+    if (queue->head == queue->tail &&
+        queue->spill_tail - queue->spill_head <= queue->lent)
+    {
+      return NULL;
+    }
+    return &queue->spill[queue->spill_tail - 1];
+  }
+
+  if (queue->tail - queue->head <= queue->lent)
+  {
+    return NULL;
+  }
+  return &queue->events[(queue->tail - 1) & queue->mask];
+}
+
+/*
+ * If the newest pending event is a move for window, saves its position to the
+ * history and returns it so the caller overwrites it with the new position.
+ */
+struct cwin_event *coalesce_mouse_move(struct cwin_event_queue *queue,
+                                       struct cwin_window *window)
+{
+  struct cwin_event *last = last_pending_event(queue);
+  if (last == NULL || last->t != CWIN_EVENT_MOUSE ||
+      last->mouse.t != CWIN_MOUSE_EVENT_MOVE || last->mouse.window != window)
+  {
+    return NULL;
+  }
+
+  if (queue->history == NULL)
+  {
+    queue->history = CWIN_ARR(struct cwin_mouse_sample,
+                              queue->history_mask + 1);
+    /* Without a history the sample is just dropped. */
+    if (queue->history != NULL)
+    {
+      STAT_ADD(queue->stats.allocations, 1);
+      track_queue_memory(queue, (queue->history_mask + 1) *
+                         sizeof(struct cwin_mouse_sample), 0);
+    }
+  }
+
+  if (queue->history != NULL)
+  {
+    if (last->mouse.coalesced == 0)
+    {
+      last->mouse.history = queue->history_tail;
+    }
+
+    struct cwin_mouse_sample *sample =
+      &queue->history[queue->history_tail++ & queue->history_mask];
+    sample->x = last->mouse.x;
+    sample->y = last->mouse.y;
+    sample->time_ns = last->time_ns;
+    last->mouse.coalesced++;
+  }
+
+  STAT_ADD(queue->stats.coalesced[CWIN_EVENT_MOUSE], 1);
+  last->time_ns = message_time_ns;
+  return last;
+}
+
+/* Whether the window sends any of events, a combination of enum
+   cwin_event_mask. Platforms check it to skip translating masked input. */
+bool window_wants(struct cwin_window *window, uint32_t events)
+{
+  return (window->event_mask & events) != 0;
+}
+
+struct cwin_event *alloc_window_event(struct cwin_event_queue *queue,
+                                      enum cwin_window_event_type type,
+                                      struct cwin_window *window)
+{
+  if (window_event_masks[type] != 0 &&
+      !window_wants(window, window_event_masks[type]))
+  {
+    return NULL;
+  }
+
+  if (type == CWIN_WINDOW_EVENT_RESIZE &&
+      ((queue->coalesce | window->coalesce) & CWIN_COALESCE_RESIZE))
+  {
+    struct cwin_event *last = last_pending_event(queue);
+    if (last != NULL && last->t == CWIN_EVENT_WINDOW &&
+        last->window.t == CWIN_WINDOW_EVENT_RESIZE &&
+        last->window.window == window)
+    {
+      STAT_ADD(queue->stats.coalesced[CWIN_EVENT_WINDOW], 1);
+      last->time_ns = message_time_ns;
+      return last;
+    }
+  }
+
+  struct cwin_event *event = alloc_event(queue, CWIN_EVENT_WINDOW);
+  if (event == NULL)
+  {
+    return NULL;
+  }
+
+  event->window.window = window;
+  event->window.t = type;
+
+  return event;
+}
+
+/*
+ * vblank_ns is any vblank the platform reported, the next one is predicted
+ * from it in whole refresh periods. Unknown times are 0.
+ */
+struct cwin_event *alloc_frame_event(struct cwin_event_queue *queue,
+                                     struct cwin_window *window,
+                                     uint64_t presented_ns,
+                                     uint64_t vblank_ns, uint64_t refresh_ns)
+{
+  struct cwin_event *event =
+    alloc_window_event(queue, CWIN_WINDOW_EVENT_FRAME, window);
+  if (event == NULL)
+  {
+    return NULL;
+  }
+
+  event->window.presented_ns = presented_ns;
+  event->window.next_vblank_ns = 0;
+  event->window.refresh_ns = refresh_ns;
+  if (vblank_ns != 0 && refresh_ns != 0)
+  {
+    event->window.next_vblank_ns = predict_vblank(vblank_ns, refresh_ns,
+                                                  cwin_plat_now_ns());
+  }
+
+  return event;
+}
+
+/* The first vblank after now_ns. */
+uint64_t predict_vblank(uint64_t vblank_ns, uint64_t refresh_ns,
+                        uint64_t now_ns)
+{
+  uint64_t next = vblank_ns + refresh_ns;
+  if (next <= now_ns)
+  {
+    next += ((now_ns - next) / refresh_ns + 1) * refresh_ns;
+  }
+  return next;
+}
+
+struct cwin_event *alloc_scale_event(struct cwin_event_queue *queue,
+                                     struct cwin_window *window, float scale)
+{
+  struct cwin_event *event =
+    alloc_window_event(queue, CWIN_WINDOW_EVENT_SCALE_CHANGED, window);
+  if (event != NULL)
+  {
+    event->window.scale = scale;
+  }
+  return event;
+}
+
+/* Rounds a scaled size or position to the nearest integer, without libm. */
+int scale_round(float value)
+{
+  return (int) (value < 0 ? value - 0.5f : value + 0.5f);
+}
+
+/* Largest first, then fastest. */
+int compare_modes(const void *a, const void *b)
+{
+  const struct cwin_monitor_mode *x = a;
+  const struct cwin_monitor_mode *y = b;
+  if (x->width != y->width)
+  {
+    return x->width < y->width ? 1 : -1;
+  }
+  if (x->height != y->height)
+  {
+    return x->height < y->height ? 1 : -1;
+  }
+  return x->refresh_mhz < y->refresh_mhz ? 1 : x->refresh_mhz > y->refresh_mhz ?
+    -1 : 0;
+}
+
+/* Platforms list the same mode for every bit depth and scaling option. */
+size_t normalize_modes(struct cwin_monitor_mode *modes, size_t count)
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  qsort(modes, count, sizeof(*modes), compare_modes);
+  size_t kept = 1;
+  for (size_t i = 1; i < count; i++)
+  {
+    if (compare_modes(&modes[i], &modes[kept - 1]) != 0)
+    {
+      modes[kept++] = modes[i];
+    }
+  }
+  return kept;
+}
+
+/* The mode cwin_window_set_fullscreen switches to, or -1. */
+int pick_mode(const struct cwin_monitor_mode *modes, size_t count,
+              const struct cwin_monitor_mode *wanted)
+{
+  int best = -1;
+  uint32_t best_distance = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (modes[i].width != wanted->width || modes[i].height != wanted->height)
+    {
+      continue;
+    }
+
+    uint32_t distance;
+    if (wanted->refresh_mhz == 0)
+    {
+      distance = UINT32_MAX - modes[i].refresh_mhz;
+    } else
+    {
+      distance = modes[i].refresh_mhz > wanted->refresh_mhz ?
+        modes[i].refresh_mhz - wanted->refresh_mhz :
+        wanted->refresh_mhz - modes[i].refresh_mhz;
+    }
+    if (best == -1 || distance < best_distance)
+    {
+      best = (int) i;
+      best_distance = distance;
+    }
+  }
+  return best;
+}
+
+/* Copies a name of len bytes into struct cwin_monitor, cutting it short on a
+   character boundary. */
+void copy_monitor_name(char *name, const char *src, size_t len)
+{
+  size_t capacity = sizeof(((struct cwin_monitor *) NULL)->name);
+  if (len >= capacity)
+  {
+    len = capacity - 1;
+    while (len > 0 && ((uint8_t) src[len] & 0xc0) == 0x80)
+    {
+      len--;
+    }
+  }
+  memcpy(name, src, len);
+  name[len] = '\0';
+}
+
+/* Finishes a query that either counts the results or copies them out, see
+   cwin_get_monitors. */
+void copy_list(void *out, int *count, const void *items, size_t len,
+               size_t size)
+{
+  if (out == NULL)
+  {
+    *count = (int) len;
+    return;
+  }
+
+  if (len > (size_t) *count)
+  {
+    len = (size_t) *count;
+  }
+  if (len != 0)
+  {
+    memcpy(out, items, len * size);
+  }
+  *count = (int) len;
+}
+
+struct cwin_event *alloc_mouse_event(struct cwin_event_queue *queue,
+                                      enum cwin_mouse_event_type type,
+                                      struct cwin_window *window)
+{
+  struct cwin_event *event;
+  if (!window_wants(window, mouse_event_masks[type]))
+  {
+    return NULL;
+  }
+
+  if (type == CWIN_MOUSE_EVENT_MOVE &&
+      ((queue->coalesce | window->coalesce) & CWIN_COALESCE_MOUSE_MOVE))
+  {
+    event = coalesce_mouse_move(queue, window);
+    if (event != NULL)
+    {
+      return event;
+    }
+  }
+
+  event = alloc_event(queue, CWIN_EVENT_MOUSE);
+  if (event == NULL)
+  {
+    return NULL;
+  }
+
+  event->mouse.window = window;
+  event->mouse.t = type;
+  if (type == CWIN_MOUSE_EVENT_MOVE)
+  {
+    event->mouse.coalesced = 0;
+  }
+
+  return event;
+}
+
+struct cwin_event *alloc_key_event(struct cwin_event_queue *queue,
+                                   enum cwin_button_state state,
+                                   struct cwin_window *window)
+{
+  if (!window_wants(window, CWIN_EVENT_MASK_KEY))
+  {
+    return NULL;
+  }
+
+  struct cwin_event *event = alloc_event(queue, CWIN_EVENT_KEY);
+  if (event == NULL)
+  {
+    return NULL;
+  }
+
+  event->key.window = window;
+  event->key.state = state;
+  event->key.repeat = false;
+  return event;
+}
+
+/* Copies text into the queue's arena. If it doesn't fit the event is
+   dropped. */
+struct cwin_event *alloc_text_event(struct cwin_event_queue *queue,
+                                    struct cwin_window *window,
+                                    const char *text, size_t len)
+{
+  if (!window_wants(window, CWIN_EVENT_MASK_TEXT) || len == 0)
+  {
+    return NULL;
+  }
+  if (len >= queue->text_capacity - queue->text_used)
+  {
+    STAT_ADD(queue->stats.dropped[CWIN_EVENT_TEXT], 1);
+    return NULL;
+  }
+
+  struct cwin_event *event = alloc_event(queue, CWIN_EVENT_TEXT);
+  if (event == NULL)
+  {
+    return NULL;
+  }
+
+  char *copy = &queue->text[queue->text_used];
+  memcpy(copy, text, len);
+  copy[len] = '\0';
+  queue->text_used += len + 1;
+
+  event->text.window = window;
+  event->text.text = copy;
+  event->text.len = len;
+  return event;
+}
+
+/* Writes the 1 to 4 byte UTF-8 encoding of a code point, returning its
+   length. */
+size_t encode_utf8(uint32_t c, char *out)
+{
+  if (c < 0x80)
+  {
+    out[0] = (char) c;
+    return 1;
+  } else if (c < 0x800)
+  {
+    out[0] = (char) (0xc0 | (c >> 6));
+    out[1] = (char) (0x80 | (c & 0x3f));
+    return 2;
+  } else if (c < 0x10000)
+  {
+    out[0] = (char) (0xe0 | (c >> 12));
+    out[1] = (char) (0x80 | ((c >> 6) & 0x3f));
+    out[2] = (char) (0x80 | (c & 0x3f));
+    return 3;
+  }
+
+  out[0] = (char) (0xf0 | (c >> 18));
+  out[1] = (char) (0x80 | ((c >> 12) & 0x3f));
+  out[2] = (char) (0x80 | ((c >> 6) & 0x3f));
+  out[3] = (char) (0x80 | (c & 0x3f));
+  return 4;
+}
+
+/* Called before events are retrieved. Nothing refers to the arena once every
+   event has been handed out and none are lent. */
+void recycle_text(struct cwin_event_queue *queue)
+{
+  if (event_queue_is_empty(queue) && queue->lent == 0)
+  {
+    queue->text_used = 0;
+  }
+}
+
+void framebuffer_destroy_buffers(struct cwin_window *window)
+{
+  struct framebuffer *framebuffer = &window->framebuffer;
+  for (int i = 0; i < framebuffer->buffer_count; i++)
+  {
+    if (framebuffer->buffers[i].pixels != NULL)
+    {
+      cwin_plat_destroy_buffer(window, i);
+    }
+    memset(&framebuffer->buffers[i], 0, sizeof(framebuffer->buffers[i]));
+  }
+  framebuffer->acquired = -1;
+}
+
+/*
+ * Takes the free buffer that was presented last, since it needs the least
+ * redrawing. A new buffer is only created when every existing one is busy,
+ * so backends that never hold on to buffers only ever create one.
+ */
+enum cwin_error framebuffer_pick_buffer(struct cwin_window *window,
+                                        int *index)
+{
+  enum cwin_error err;
+  struct framebuffer *framebuffer = &window->framebuffer;
+
+  for (;;)
+  {
+    int best = -1;
+    int unused = -1;
+    for (int i = 0; i < framebuffer->buffer_count; i++)
+    {
+      struct framebuffer_buffer *buffer = &framebuffer->buffers[i];
+      if (buffer->pixels == NULL)
+      {
+        unused = unused == -1 ? i : unused;
+      } else if (!buffer->busy &&
+                 (best == -1 ||
+                  buffer->presented > framebuffer->buffers[best].presented))
+      {
+        best = i;
+      }
+    }
+
+    if (best != -1)
+    {
+      *index = best;
+      return CWIN_SUCCESS;
+    }
+    if (unused != -1)
+    {
+      err = cwin_plat_create_buffer(window, unused);
+      if (err)
+      {
+        return err;
+      }
+      *index = unused;
+      return CWIN_SUCCESS;
+    }
+
+    err = cwin_plat_wait_buffer(window);
+    if (err)
+    {
+      return err;
+    }
+  }
+}
+
+/* Returns false if nothing of the rectangle is inside width by height. */
+bool clip_rect(const struct cwin_rect *rect, int width, int height,
+               struct cwin_rect *clipped)
+{
+  int x0 = rect->x < 0 ? 0 : rect->x;
+  int y0 = rect->y < 0 ? 0 : rect->y;
+  int x1 = rect->x + rect->width;
+  int y1 = rect->y + rect->height;
+  x1 = x1 > width ? width : x1;
+  y1 = y1 > height ? height : y1;
+  if (x0 >= x1 || y0 >= y1)
+  {
+    return false;
+  }
+
+  *clipped = (struct cwin_rect) { x0, y0, x1 - x0, y1 - y0 };
+  return true;
+}
+
+/*
+ * Pixel conversion into the framebuffer's 0xAARRGGBB, with premultiplied
+ * alpha in the top byte. Each format has a row kernel, picked for the CPU
+ * once in cwin_init. The vector kernels only handle whole vectors and leave
+ * the rest of the row to the scalar kernel, and the 8 bit ones round exactly
+ * like it, so the results don't depend on the CPU.
+ *
+ * Dividing by 255 with rounding is done as (t + (t >> 8)) >> 8 with
+ * t = x * y + 128, which is exact for any two 8 bit values.
+ */
+
+uint32_t convert_div255(uint32_t t)
+{
+  t += 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+float convert_half_to_float(uint16_t half)
+{
+  uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+
+  uint32_t bits;
+  if (exponent == 0)
+  {
+    /* Zero or subnormal, both exact as a float. */
+    float value = mantissa * (1.0f / 16777216.0f);
+    return sign ? -value : value;
+  } else if (exponent == 31)
+  {
+    bits = sign | 0x7f800000 | mantissa << 13;
+  } else
+  {
+    bits = sign | (exponent + 112) << 23 | mantissa << 13;
+  }
+
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/* Clamps to [0, 1], NaN included, and rounds to 8 bits. */
+uint32_t convert_float_to_unorm8(float value)
+{
+  value = value > 0.0f ? value : 0.0f;
+  value = value < 1.0f ? value : 1.0f;
+  return (uint32_t) (value * 255.0f + 0.5f);
+}
+
+void convert_rgba8_scalar(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  for (size_t i = 0; i < count; i++, src += 4)
+  {
+    uint32_t a = src[3];
+    dst[i] = a << 24 | convert_div255(src[0] * a) << 16 |
+      convert_div255(src[1] * a) << 8 | convert_div255(src[2] * a);
+  }
+}
+
+void convert_rgba8_premultiplied_scalar(uint32_t *dst, const uint8_t *src,
+                                        size_t count)
+{
+  for (size_t i = 0; i < count; i++, src += 4)
+  {
+    dst[i] = (uint32_t) src[3] << 24 | (uint32_t) src[0] << 16 |
+      (uint32_t) src[1] << 8 | src[2];
+  }
+}
+
+void convert_rgba16f_premultiplied_scalar(uint32_t *dst, const uint8_t *src,
+                                          size_t count)
+{
+  for (size_t i = 0; i < count; i++, src += 8)
+  {
+    uint16_t half[4];
+    memcpy(half, src, sizeof(half));
+    dst[i] = convert_float_to_unorm8(convert_half_to_float(half[3])) << 24 |
+      convert_float_to_unorm8(convert_half_to_float(half[0])) << 16 |
+      convert_float_to_unorm8(convert_half_to_float(half[1])) << 8 |
+      convert_float_to_unorm8(convert_half_to_float(half[2]));
+  }
+}
+
+void convert_rgb565_scalar(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  for (size_t i = 0; i < count; i++, src += 2)
+  {
+    uint16_t pixel;
+    memcpy(&pixel, src, sizeof(pixel));
+    uint32_t r = pixel >> 11;
+    uint32_t g = (pixel >> 5) & 0x3f;
+    uint32_t b = pixel & 0x1f;
+    dst[i] = 0xff000000 | (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 |
+      (b << 3 | b >> 2);
+  }
+}
+
+#ifdef CONVERT_SSE2
+
+/* Swaps the bytes at 0 and 2 of every 32 bit lane, RGBA <-> BGRA. */
+__m128i convert_swap_rb_sse2(__m128i pixels)
+{
+  __m128i ga = _mm_and_si128(pixels, _mm_set1_epi32((int) 0xff00ff00));
+  __m128i rb = _mm_and_si128(pixels, _mm_set1_epi32(0x00ff00ff));
+  rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+  return _mm_or_si128(ga, rb);
+}
+
+/* Two pixels as 16 bit RGBA, multiplied by their alpha except alpha. */
+__m128i convert_premultiply_sse2(__m128i pixels)
+{
+  __m128i alpha = _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+  alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+  alpha = _mm_or_si128(alpha, _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(pixels, alpha),
+                            _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+void convert_rgba8_sse2(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  size_t i = 0;
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i *) (src + i * 4));
+    __m128i lo = convert_premultiply_sse2(_mm_unpacklo_epi8(pixels, zero));
+    __m128i hi = convert_premultiply_sse2(_mm_unpackhi_epi8(pixels, zero));
+    pixels = convert_swap_rb_sse2(_mm_packus_epi16(lo, hi));
+    _mm_storeu_si128((__m128i *) (dst + i), pixels);
+  }
+  convert_rgba8_scalar(dst + i, src + i * 4, count - i);
+}
+
+void convert_rgba8_premultiplied_sse2(uint32_t *dst, const uint8_t *src,
+                                      size_t count)
+{
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i *) (src + i * 4));
+    _mm_storeu_si128((__m128i *) (dst + i), convert_swap_rb_sse2(pixels));
+  }
+  convert_rgba8_premultiplied_scalar(dst + i, src + i * 4, count - i);
+}
+
+/* Expands eight 565 pixels into two registers of 0xAARRGGBB. */
+void convert_rgb565_sse2(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  size_t i = 0;
+  __m128i mask5 = _mm_set1_epi16(0x1f);
+  __m128i mask6 = _mm_set1_epi16(0x3f);
+  __m128i alpha = _mm_set1_epi16((short) 0xff00);
+  for (; i + 8 <= count; i += 8)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i *) (src + i * 2));
+    __m128i r = _mm_srli_epi16(pixels, 11);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(pixels, 5), mask6);
+    __m128i b = _mm_and_si128(pixels, mask5);
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+    /* 16 bit lanes of B | G << 8 and R | A << 8, interleaved into pixels. */
+    __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    __m128i ra = _mm_or_si128(r, alpha);
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128((__m128i *) (dst + i + 4), _mm_unpackhi_epi16(bg, ra));
+  }
+  convert_rgb565_scalar(dst + i, src + i * 2, count - i);
+}
+
+#endif
+
+#ifdef CONVERT_AVX2
+
+CONVERT_TARGET_AVX2 __m256i convert_swap_rb_avx2(__m256i pixels)
+{
+  __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11,
+                                     14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7,
+                                     10, 9, 8, 11, 14, 13, 12, 15);
+  return _mm256_shuffle_epi8(pixels, shuffle);
+}
+
+/* Four pixels as 16 bit RGBA, see convert_premultiply_sse2. */
+CONVERT_TARGET_AVX2 __m256i convert_premultiply_avx2(__m256i pixels)
+{
+  __m256i shuffle = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, -1, -1,
+                                     14, 15, 14, 15, 14, 15, -1, -1,
+                                     6, 7, 6, 7, 6, 7, -1, -1,
+                                     14, 15, 14, 15, 14, 15, -1, -1);
+  __m256i alpha = _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle),
+                                  _mm256_set1_epi64x(0x00ff000000000000));
+  __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(pixels, alpha),
+                               _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+CONVERT_TARGET_AVX2 void convert_rgba8_avx2(uint32_t *dst, const uint8_t *src,
+                                            size_t count)
+{
+  size_t i = 0;
+  __m256i zero = _mm256_setzero_si256();
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i pixels = _mm256_loadu_si256((const __m256i *) (src + i * 4));
+    /* Unpacking and packing work within 128 bit lanes, so the order is
+       kept. */
+    __m256i lo = convert_premultiply_avx2(_mm256_unpacklo_epi8(pixels, zero));
+    __m256i hi = convert_premultiply_avx2(_mm256_unpackhi_epi8(pixels, zero));
+    pixels = convert_swap_rb_avx2(_mm256_packus_epi16(lo, hi));
+    _mm256_storeu_si256((__m256i *) (dst + i), pixels);
+  }
+  convert_rgba8_scalar(dst + i, src + i * 4, count - i);
+}
+
+CONVERT_TARGET_AVX2 void convert_rgba8_premultiplied_avx2(uint32_t *dst,
+                                                          const uint8_t *src,
+                                                          size_t count)
+{
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i pixels = _mm256_loadu_si256((const __m256i *) (src + i * 4));
+    _mm256_storeu_si256((__m256i *) (dst + i), convert_swap_rb_avx2(pixels));
+  }
+  convert_rgba8_premultiplied_scalar(dst + i, src + i * 4, count - i);
+}
+
+/* F16C converts the halves, four pixels at a time, which are then clamped,
+   scaled and narrowed. */
+CONVERT_TARGET_AVX2 void convert_rgba16f_premultiplied_avx2(uint32_t *dst,
+                                                            const uint8_t *src,
+                                                            size_t count)
+{
+  size_t i = 0;
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 scale = _mm256_set1_ps(255.0f);
+  __m256 half = _mm256_set1_ps(0.5f);
+  __m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11,
+                               14, 13, 12, 15);
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256 values[2];
+    for (int j = 0; j < 2; j++)
+    {
+      __m128i halves =
+        _mm_loadu_si128((const __m128i *) (src + (i + j * 2) * 8));
+      values[j] = _mm256_cvtph_ps(halves);
+      /* max returns its second operand for NaN. */
+      values[j] = _mm256_min_ps(_mm256_max_ps(values[j], zero), one);
+      values[j] = _mm256_add_ps(_mm256_mul_ps(values[j], scale), half);
+    }
+
+    /* Packing works within 128 bit lanes, which leaves the pixels in the
+       order 0, 2, 1, 3. */
+    __m256i words = _mm256_packs_epi32(_mm256_cvttps_epi32(values[0]),
+                                       _mm256_cvttps_epi32(values[1]));
+    words = _mm256_permute4x64_epi64(words, _MM_SHUFFLE(3, 1, 2, 0));
+    __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                     _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_shuffle_epi8(bytes, swap));
+  }
+  convert_rgba16f_premultiplied_scalar(dst + i, src + i * 8, count - i);
+}
+
+CONVERT_TARGET_AVX2 void convert_rgb565_avx2(uint32_t *dst, const uint8_t *src,
+                                             size_t count)
+{
+  size_t i = 0;
+  __m256i mask5 = _mm256_set1_epi16(0x1f);
+  __m256i mask6 = _mm256_set1_epi16(0x3f);
+  __m256i alpha = _mm256_set1_epi16((short) 0xff00);
+  for (; i + 16 <= count; i += 16)
+  {
+    __m256i pixels = _mm256_loadu_si256((const __m256i *) (src + i * 2));
+    __m256i r = _mm256_srli_epi16(pixels, 11);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi16(pixels, 5), mask6);
+    __m256i b = _mm256_and_si256(pixels, mask5);
+    r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+    g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+    b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+
+    __m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+    __m256i ra = _mm256_or_si256(r, alpha);
+    /* The unpacks stay within 128 bit lanes, so the halves are swapped back
+       into order. */
+    __m256i lo = _mm256_unpacklo_epi16(bg, ra);
+    __m256i hi = _mm256_unpackhi_epi16(bg, ra);
+    _mm256_storeu_si256((__m256i *) (dst + i),
+                        _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *) (dst + i + 8),
+                        _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  convert_rgb565_scalar(dst + i, src + i * 2, count - i);
+}
+
+#endif
+
+#ifdef CONVERT_NEON
+
+/* NEON loads and stores deinterleave channels, so swizzling is free. */
+void convert_rgba8_neon(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  size_t i = 0;
+  uint16x8_t round = vdupq_n_u16(128);
+  for (; i + 8 <= count; i += 8)
+  {
+    uint8x8x4_t rgba = vld4_u8(src + i * 4);
+    uint8x8x4_t bgra;
+    uint8x8_t a = rgba.val[3];
+    for (int c = 0; c < 3; c++)
+    {
+      uint16x8_t t = vaddq_u16(vmull_u8(rgba.val[c], a), round);
+      bgra.val[2 - c] = vshrn_n_u16(vsraq_n_u16(t, t, 8), 8);
+    }
+    bgra.val[3] = a;
+    vst4_u8((uint8_t *) (dst + i), bgra);
+  }
+  convert_rgba8_scalar(dst + i, src + i * 4, count - i);
+}
+
+void convert_rgba8_premultiplied_neon(uint32_t *dst, const uint8_t *src,
+                                      size_t count)
+{
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+  {
+    uint8x16x4_t rgba = vld4q_u8(src + i * 4);
+    uint8x16_t r = rgba.val[0];
+    rgba.val[0] = rgba.val[2];
+    rgba.val[2] = r;
+    vst4q_u8((uint8_t *) (dst + i), rgba);
+  }
+  convert_rgba8_premultiplied_scalar(dst + i, src + i * 4, count - i);
+}
+
+void convert_rgba16f_premultiplied_neon(uint32_t *dst, const uint8_t *src,
+                                        size_t count)
+{
+  size_t i = 0;
+  float32x4_t zero = vdupq_n_f32(0.0f);
+  float32x4_t one = vdupq_n_f32(1.0f);
+  float32x4_t half = vdupq_n_f32(0.5f);
+  for (; i + 8 <= count; i += 8)
+  {
+    uint16x4x4_t rgba[2];
+    rgba[0] = vld4_u16((const uint16_t *) (src + i * 8));
+    rgba[1] = vld4_u16((const uint16_t *) (src + (i + 4) * 8));
+
+    uint8x8x4_t bgra;
+    for (int c = 0; c < 4; c++)
+    {
+      uint16x4_t narrow[2];
+      for (int j = 0; j < 2; j++)
+      {
+        float32x4_t value = vcvt_f32_f16(vreinterpret_f16_u16(rgba[j].val[c]));
+        /* vmaxnm picks the number over NaN. */
+        value = vminq_f32(vmaxnmq_f32(value, zero), one);
+        value = vaddq_f32(vmulq_n_f32(value, 255.0f), half);
+        narrow[j] = vmovn_u32(vcvtq_u32_f32(value));
+      }
+      bgra.val[c == 3 ? 3 : 2 - c] =
+        vmovn_u16(vcombine_u16(narrow[0], narrow[1]));
+    }
+    vst4_u8((uint8_t *) (dst + i), bgra);
+  }
+  convert_rgba16f_premultiplied_scalar(dst + i, src + i * 8, count - i);
+}
+
+void convert_rgb565_neon(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    uint16x8_t pixels = vld1q_u16((const uint16_t *) (src + i * 2));
+    uint8x8_t r = vmovn_u16(vshrq_n_u16(pixels, 11));
+    uint8x8_t g = vmovn_u16(vandq_u16(vshrq_n_u16(pixels, 5),
+                                      vdupq_n_u16(0x3f)));
+    uint8x8_t b = vmovn_u16(vandq_u16(pixels, vdupq_n_u16(0x1f)));
+
+    uint8x8x4_t bgra;
+    bgra.val[0] = vorr_u8(vshl_n_u8(b, 3), vshr_n_u8(b, 2));
+    bgra.val[1] = vorr_u8(vshl_n_u8(g, 2), vshr_n_u8(g, 4));
+    bgra.val[2] = vorr_u8(vshl_n_u8(r, 3), vshr_n_u8(r, 2));
+    bgra.val[3] = vdup_n_u8(0xff);
+    vst4_u8((uint8_t *) (dst + i), bgra);
+  }
+  convert_rgb565_scalar(dst + i, src + i * 2, count - i);
+}
+
+#endif
+
+#ifdef CONVERT_AVX2
+
+bool convert_cpu_has_avx2(void)
+{
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+  {
+    return false;
+  }
+
+  /* The OS has to save the YMM registers too. */
+  __cpuid(info, 1);
+  bool osxsave = info[2] & (1 << 27);
+  bool f16c = info[2] & (1 << 29);
+  if (!osxsave || !f16c || (_xgetbv(0) & 6) != 6)
+  {
+    return false;
+  }
+
+  __cpuidex(info, 7, 0);
+  return info[1] & (1 << 5);
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+#endif
+}
+
+#endif
+
+void convert_init(void)
+{
+  convert_rows[CWIN_PIXEL_FORMAT_RGBA8] = convert_rgba8_scalar;
+  convert_rows[CWIN_PIXEL_FORMAT_RGBA8_PREMULTIPLIED] =
+    convert_rgba8_premultiplied_scalar;
+  convert_rows[CWIN_PIXEL_FORMAT_RGBA16F_PREMULTIPLIED] =
+    convert_rgba16f_premultiplied_scalar;
+  convert_rows[CWIN_PIXEL_FORMAT_RGB565] = convert_rgb565_scalar;
+
+#ifdef CONVERT_SSE2
+  convert_rows[CWIN_PIXEL_FORMAT_RGBA8] = convert_rgba8_sse2;
+  convert_rows[CWIN_PIXEL_FORMAT_RGBA8_PREMULTIPLIED] =
+    convert_rgba8_premultiplied_sse2;
+  convert_rows[CWIN_PIXEL_FORMAT_RGB565] = convert_rgb565_sse2;
+#endif
+
+#ifdef CONVERT_AVX2
+  if (convert_cpu_has_avx2())
+  {
+    convert_rows[CWIN_PIXEL_FORMAT_RGBA8] = convert_rgba8_avx2;
+    convert_rows[CWIN_PIXEL_FORMAT_RGBA8_PREMULTIPLIED] =
+      convert_rgba8_premultiplied_avx2;
+    convert_rows[CWIN_PIXEL_FORMAT_RGBA16F_PREMULTIPLIED] =
+      convert_rgba16f_premultiplied_avx2;
+    convert_rows[CWIN_PIXEL_FORMAT_RGB565] = convert_rgb565_avx2;
+  }
+#endif
+
+#ifdef CONVERT_NEON
+  convert_rows[CWIN_PIXEL_FORMAT_RGBA8] = convert_rgba8_neon;
+  convert_rows[CWIN_PIXEL_FORMAT_RGBA8_PREMULTIPLIED] =
+    convert_rgba8_premultiplied_neon;
+  convert_rows[CWIN_PIXEL_FORMAT_RGBA16F_PREMULTIPLIED] =
+    convert_rgba16f_premultiplied_neon;
+  convert_rows[CWIN_PIXEL_FORMAT_RGB565] = convert_rgb565_neon;
+#endif
+}
+
+void timer_sift_up(size_t index)
+{
+  struct cwin_timer *timer = timers.heap[index];
+  while (index > 0)
+  {
+    size_t parent = (index - 1) / 2;
+    if (timers.heap[parent]->deadline_ns <= timer->deadline_ns)
+    {
+      break;
+    }
+    timers.heap[index] = timers.heap[parent];
+    timers.heap[index]->heap_index = index;
+    index = parent;
+  }
+  timers.heap[index] = timer;
+  timer->heap_index = index;
+}
+
+void timer_sift_down(size_t index)
+{
+  struct cwin_timer *timer = timers.heap[index];
+  for (;;)
+  {
+    size_t child = index * 2 + 1;
+    if (child >= timers.len)
+    {
+      break;
+    }
+    if (child + 1 < timers.len &&
+        timers.heap[child + 1]->deadline_ns < timers.heap[child]->deadline_ns)
+    {
+      child++;
+    }
+    if (timer->deadline_ns <= timers.heap[child]->deadline_ns)
+    {
+      break;
+    }
+    timers.heap[index] = timers.heap[child];
+    timers.heap[index]->heap_index = index;
+    index = child;
+  }
+  timers.heap[index] = timer;
+  timer->heap_index = index;
+}
+
+void timer_insert(struct cwin_timer *timer)
+{
+  timers.heap[timers.len] = timer;
+  timer_sift_up(timers.len++);
+}
+
+void timer_remove(struct cwin_timer *timer)
+{
+  size_t index = timer->heap_index;
+  timer->heap_index = TIMER_DISARMED;
+  struct cwin_timer *last = timers.heap[--timers.len];
+  if (last == timer)
+  {
+    return;
+  }
+
+  /* The last timer fills the hole, and may belong above or below it. */
+  timers.heap[index] = last;
+  last->heap_index = index;
+  timer_sift_up(index);
+  timer_sift_down(last->heap_index);
+}
+
+/* Only makes a call when the earliest deadline changed. The next event of a
+   real time replay shares the platform timer. */
+void timer_update_platform(void)
+{
+  uint64_t deadline = timers.len > 0 ? timers.heap[0]->deadline_ns : 0;
+  if (replay.queue != NULL && replay.real_time &&
+      (deadline == 0 || replay.next.time_ns < deadline))
+  {
+    deadline = replay.next.time_ns;
+  }
+  if (deadline != timers.armed_ns)
+  {
+    timers.armed_ns = deadline;
+    cwin_plat_set_timer(deadline);
+  }
+}
+
+/*
+ * Sends an event for every timer that is due. A late periodic timer sends
+ * one event counting the missed intervals, and keeps its phase.
+ */
+void fire_timers(void)
+{
+  struct cwin_event *event;
+  if (timers.len == 0)
+  {
+    return;
+  }
+
+  uint64_t now = cwin_plat_now_ns();
+  while (timers.len > 0 && timers.heap[0]->deadline_ns <= now)
+  {
+    struct cwin_timer *timer = timers.heap[0];
+    uint64_t expirations = 1;
+    if (!timer->oneshot)
+    {
+      expirations += (now - timer->deadline_ns) / timer->interval_ns;
+    }
+
+    event = alloc_event(timer->queue, CWIN_EVENT_TIMER);
+    if (event != NULL)
+    {
+      event->time_ns = timer->deadline_ns +
+        (expirations - 1) * timer->interval_ns;
+      event->timer.timer = timer;
+      event->timer.expirations = expirations;
+    }
+
+    if (timer->oneshot)
+    {
+      timer_remove(timer);
+    } else
+    {
+      timer->deadline_ns += expirations * timer->interval_ns;
+      timer_sift_down(0);
+    }
+  }
+
+  timer_update_platform();
+}
+
+enum cwin_error pump_events(void)
+{
+  STATS_BEGIN("cwin pump");
+  enum cwin_error err = cwin_plat_pump_events();
+  drain_commands();
+  fire_timers();
+  replay_feed();
+  STAT_ADD(stats.pumps, 1);
+  STATS_END(stats.pump_ns);
+  return err;
+}
+
+enum cwin_error wait_events(uint64_t timeout_ns)
+{
+  STATS_BEGIN("cwin wait");
+  enum cwin_error err = cwin_plat_wait_events(timeout_ns);
+  drain_commands();
+  fire_timers();
+  replay_feed();
+  STAT_ADD(stats.waits, 1);
+  STATS_END(stats.wait_ns);
+  return err;
+}
+
+#ifdef CWIN_STATS
+
+uint64_t stats_begin(const char *zone)
+{
+  if (trace_hooks.begin != NULL)
+  {
+    trace_hooks.begin(trace_hooks.user, zone);
+  }
+  return cwin_plat_now_ns();
+}
+
+void stats_end(atomic_uint_least64_t *total_ns, uint64_t start_ns)
+{
+  STAT_ADD(*total_ns, cwin_plat_now_ns() - start_ns);
+  if (trace_hooks.end != NULL)
+  {
+    trace_hooks.end(trace_hooks.user);
+  }
+}
+
+void stats_enqueued(struct cwin_event_queue *queue, enum cwin_event_type type)
+{
+  STAT_ADD(queue->stats.enqueued[type], 1);
+
+  size_t pending = queue->tail - queue->head;
+  if (queue->spill != NULL)
+  {
+    pending += queue->spill_tail - queue->spill_head;
+  }
+  if (pending > atomic_load_explicit(&queue->stats.high_water,
+                                     memory_order_relaxed))
+  {
+    atomic_store_explicit(&queue->stats.high_water, pending,
+                          memory_order_relaxed);
+  }
+}
+
+#endif
+
+/* Fibonacci hashing, handles like XIDs are allocated sequentially and would
+   otherwise fill neighbouring slots. */
+size_t window_map_home(const struct window_map *map, uintptr_t handle)
+{
+  return (size_t) (((uint64_t) handle * 0x9e3779b97f4a7c15) >> 32) &
+    map->mask;
+}
+
+/* The handle must not be in the map yet. */
+enum cwin_error window_map_insert(struct window_map *map, uintptr_t handle,
+                                  struct cwin_window *window)
+{
+  size_t capacity = map->slots != NULL ? map->mask + 1 : 0;
+  if ((map->len + 1) * 2 > capacity)
+  {
+    size_t new_capacity = capacity == 0 ? 16 : capacity * 2;
+    struct window_map_slot *slots = CWIN_ARR(struct window_map_slot,
+                                             new_capacity);
+    if (slots == NULL)
+    {
+      return CWIN_ERROR_OOM;
+    }
+    for (size_t i = 0; i < new_capacity; i++)
+    {
+      slots[i].window = NULL;
+    }
+
+    struct window_map old = *map;
+    map->slots = slots;
+    map->mask = new_capacity - 1;
+    map->len = 0;
+    for (size_t i = 0; i < capacity; i++)
+    {
+      if (old.slots[i].window != NULL)
+      {
+        window_map_insert(map, old.slots[i].handle, old.slots[i].window);
+      }
+    }
+    CWIN_FREE_ARR(struct window_map_slot, capacity, old.slots);
+  }
+
+  size_t i = window_map_home(map, handle);
+  while (map->slots[i].window != NULL)
+  {
+    i = (i + 1) & map->mask;
+  }
+  map->slots[i].handle = handle;
+  map->slots[i].window = window;
+  map->len++;
+  return CWIN_SUCCESS;
+}
+
+struct cwin_window *window_map_find(const struct window_map *map,
+                                    uintptr_t handle)
+{
+  if (map->slots == NULL)
+  {
+    return NULL;
+  }
+
+  for (size_t i = window_map_home(map, handle); map->slots[i].window != NULL;
+       i = (i + 1) & map->mask)
+  {
+    if (map->slots[i].handle == handle)
+    {
+      return map->slots[i].window;
+    }
+  }
+  return NULL;
+}
+
+/* Does nothing if the handle isn't in the map. */
+void window_map_remove(struct window_map *map, uintptr_t handle)
+{
+  if (map->slots == NULL)
+  {
+    return;
+  }
+
+  size_t i = window_map_home(map, handle);
+  while (map->slots[i].window != NULL && map->slots[i].handle != handle)
+  {
+    i = (i + 1) & map->mask;
+  }
+  if (map->slots[i].window == NULL)
+  {
+    return;
+  }
+
+  /*
+   * Moves back every later entry in the run that the hole is between its home
+   * slot and its current one, which keeps every entry reachable by probing
+   * from its home.
+   */
+  size_t hole = i;
+  for (size_t j = (i + 1) & map->mask; map->slots[j].window != NULL;
+       j = (j + 1) & map->mask)
+  {
+    size_t home = window_map_home(map, map->slots[j].handle);
+    if (((j - home) & map->mask) >= ((j - hole) & map->mask))
+    {
+      map->slots[hole] = map->slots[j];
+      hole = j;
+    }
+  }
+  map->slots[hole].window = NULL;
+  map->len--;
+}
+
+void window_map_free(struct window_map *map)
+{
+  if (map->slots != NULL)
+  {
+    CWIN_FREE_ARR(struct window_map_slot, map->mask + 1, map->slots);
+  }
+  memset(map, 0, sizeof(*map));
+}
+
+struct cwin_window *event_window(const struct cwin_event *event)
+{
+  switch (event->t)
+  {
+  case CWIN_EVENT_WINDOW:
+    return event->window.window;
+  case CWIN_EVENT_MOUSE:
+    return event->mouse.window;
+  case CWIN_EVENT_KEY:
+    return event->key.window;
+  case CWIN_EVENT_TEXT:
+    return event->text.window;
+  default:
+    return NULL;
+  }
+}
+
+uint8_t *log_put_varint(uint8_t *out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    *out++ = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t) value;
+  return out;
+}
+
+/* Zigzag encoding keeps small negative numbers short. */
+uint8_t *log_put_signed(uint8_t *out, int64_t value)
+{
+  return log_put_varint(out, ((uint64_t) value << 1) ^
+                        (uint64_t) (value >> 63));
+}
+
+bool log_get_varint(struct log_cursor *cursor, uint64_t *value)
+{
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    if (cursor->next == cursor->end)
+    {
+      return false;
+    }
+
+    uint8_t byte = *cursor->next++;
+    result |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+    {
+      *value = result;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool log_get_signed(struct log_cursor *cursor, int64_t *value)
+{
+  uint64_t zigzag;
+  if (!log_get_varint(cursor, &zigzag))
+  {
+    return false;
+  }
+
+  *value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+  return true;
+}
+
+/* Writes at most RECORD_MAX_SIZE bytes, plus the text of a text event. */
+uint8_t *log_encode(struct log_state *state, const struct cwin_event *event,
+                    uint32_t window_id, uint8_t *out)
+{
+  uint32_t subtype = 0;
+  if (event->t == CWIN_EVENT_WINDOW)
+  {
+    subtype = event->window.t;
+  } else if (event->t == CWIN_EVENT_MOUSE)
+  {
+    subtype = event->mouse.t;
+  }
+
+  out = log_put_varint(out, (uint64_t) event->t << 4 | subtype);
+  out = log_put_signed(out, (int64_t) (event->time_ns - state->time_ns));
+  out = log_put_varint(out, window_id);
+  state->time_ns = event->time_ns;
+
+  switch (event->t)
+  {
+  case CWIN_EVENT_WINDOW:
+    if (event->window.t == CWIN_WINDOW_EVENT_RESIZE)
+    {
+      out = log_put_signed(out, event->window.width);
+      out = log_put_signed(out, event->window.height);
+    } else if (event->window.t == CWIN_WINDOW_EVENT_FRAME)
+    {
+      out = log_put_signed(out, (int64_t) (event->window.presented_ns -
+                                           event->time_ns));
+      out = log_put_signed(out, (int64_t) (event->window.next_vblank_ns -
+                                           event->time_ns));
+      out = log_put_varint(out, event->window.refresh_ns);
+    } else if (event->window.t == CWIN_WINDOW_EVENT_SCALE_CHANGED)
+    {
+      uint32_t bits;
+      memcpy(&bits, &event->window.scale, sizeof(bits));
+      out = log_put_varint(out, bits);
+    }
+    break;
+  case CWIN_EVENT_MOUSE:
+    switch (event->mouse.t)
+    {
+    case CWIN_MOUSE_EVENT_MOVE:
+      out = log_put_signed(out, (int64_t) event->mouse.x - state->x);
+      out = log_put_signed(out, (int64_t) event->mouse.y - state->y);
+      state->x = event->mouse.x;
+      state->y = event->mouse.y;
+      break;
+    case CWIN_MOUSE_EVENT_BUTTON:
+      out = log_put_varint(out, event->mouse.state);
+      out = log_put_varint(out, event->mouse.button);
+      break;
+    case CWIN_MOUSE_EVENT_WHEEL:
+      out = log_put_signed(out, event->mouse.delta);
+      break;
+    case CWIN_MOUSE_EVENT_RELATIVE:
+      memcpy(out, &event->mouse.dx, sizeof(float));
+      memcpy(out + sizeof(float), &event->mouse.dy, sizeof(float));
+      out += 2 * sizeof(float);
+      break;
+    }
+    break;
+  case CWIN_EVENT_USER:
+    out = log_put_varint(out, event->user.code);
+    break;
+  case CWIN_EVENT_KEY:
+    out = log_put_varint(out, (uint64_t) event->key.state |
+                         (uint64_t) event->key.repeat << 1);
+    out = log_put_varint(out, event->key.scancode);
+    out = log_put_varint(out, event->key.key);
+    out = log_put_varint(out, event->key.modifiers);
+    break;
+  case CWIN_EVENT_TEXT:
+    out = log_put_varint(out, event->text.len);
+    memcpy(out, event->text.text, event->text.len);
+    out += event->text.len;
+    break;
+  case CWIN_EVENT_TIMER:
+    out = log_put_varint(out, event->timer.expirations);
+    break;
+  }
+
+  return out;
+}
+
+/* Returns false at the end of the log or if it is malformed. Text points into
+   the log and isn't null terminated. */
+bool log_decode(struct log_cursor *cursor, struct cwin_event *event,
+                uint64_t *window_id)
+{
+  uint64_t type, value, value2;
+  int64_t time_delta, a, b;
+  if (!log_get_varint(cursor, &type) ||
+      !log_get_signed(cursor, &time_delta) ||
+      !log_get_varint(cursor, window_id))
+  {
+    return false;
+  }
+
+  memset(event, 0, sizeof(*event));
+  event->t = (enum cwin_event_type) (type >> 4);
+  cursor->state.time_ns += (uint64_t) time_delta;
+  event->time_ns = cursor->state.time_ns;
+
+  switch (type >> 4)
+  {
+  case CWIN_EVENT_WINDOW:
+    event->window.t = (enum cwin_window_event_type) (type & 0xf);
+    if (event->window.t == CWIN_WINDOW_EVENT_RESIZE)
+    {
+      if (!log_get_signed(cursor, &a) || !log_get_signed(cursor, &b))
+      {
+        return false;
+      }
+      event->window.width = (int) a;
+      event->window.height = (int) b;
+    } else if (event->window.t == CWIN_WINDOW_EVENT_FRAME)
+    {
+      if (!log_get_signed(cursor, &a) || !log_get_signed(cursor, &b) ||
+          !log_get_varint(cursor, &value))
+      {
+        return false;
+      }
+      event->window.presented_ns = event->time_ns + (uint64_t) a;
+      event->window.next_vblank_ns = event->time_ns + (uint64_t) b;
+      event->window.refresh_ns = value;
+    } else if (event->window.t == CWIN_WINDOW_EVENT_SCALE_CHANGED)
+    {
+      if (!log_get_varint(cursor, &value) || value > UINT32_MAX)
+      {
+        return false;
+      }
+      uint32_t bits = (uint32_t) value;
+      memcpy(&event->window.scale, &bits, sizeof(bits));
+    } else if (event->window.t > CWIN_WINDOW_EVENT_SCALE_CHANGED)
+    {
+      return false;
+    }
+    return *window_id != 0;
+  case CWIN_EVENT_MOUSE:
+    event->mouse.t = (enum cwin_mouse_event_type) (type & 0xf);
+    switch (type & 0xf)
+    {
+    case CWIN_MOUSE_EVENT_MOVE:
+      if (!log_get_signed(cursor, &a) || !log_get_signed(cursor, &b))
+      {
+        return false;
+      }
+      cursor->state.x += (int) a;
+      cursor->state.y += (int) b;
+      event->mouse.x = cursor->state.x;
+      event->mouse.y = cursor->state.y;
+      break;
+    case CWIN_MOUSE_EVENT_BUTTON:
+      if (!log_get_varint(cursor, &value) ||
+          !log_get_varint(cursor, &value2) ||
+          value > CWIN_BUTTON_UP || value2 > CWIN_MOUSE_BUTTON_RIGHT)
+      {
+        return false;
+      }
+      event->mouse.state = (enum cwin_button_state) value;
+      event->mouse.button = (enum cwin_mouse_button) value2;
+      break;
+    case CWIN_MOUSE_EVENT_WHEEL:
+      if (!log_get_signed(cursor, &a))
+      {
+        return false;
+      }
+      event->mouse.delta = (int) a;
+      break;
+    case CWIN_MOUSE_EVENT_RELATIVE:
+      if (cursor->end - cursor->next < (ptrdiff_t) (2 * sizeof(float)))
+      {
+        return false;
+      }
+      memcpy(&event->mouse.dx, cursor->next, sizeof(float));
+      memcpy(&event->mouse.dy, cursor->next + sizeof(float), sizeof(float));
+      cursor->next += 2 * sizeof(float);
+      break;
+    default:
+      return false;
+    }
+    return true;
+  case CWIN_EVENT_USER:
+    if (!log_get_varint(cursor, &value))
+    {
+      return false;
+    }
+    event->user.code = (uint32_t) value;
+    return true;
+  case CWIN_EVENT_KEY:
+    if (!log_get_varint(cursor, &value) || value > 3)
+    {
+      return false;
+    }
+    event->key.state = (enum cwin_button_state) (value & 1);
+    event->key.repeat = value >> 1;
+    if (!log_get_varint(cursor, &value))
+    {
+      return false;
+    }
+    event->key.scancode = (uint32_t) value;
+    if (!log_get_varint(cursor, &value))
+    {
+      return false;
+    }
+    event->key.key = (uint32_t) value;
+    if (!log_get_varint(cursor, &value))
+    {
+      return false;
+    }
+    event->key.modifiers = (uint32_t) value;
+    return *window_id != 0;
+  case CWIN_EVENT_TEXT:
+    if (!log_get_varint(cursor, &value) || value == 0 ||
+        value > (uint64_t) (cursor->end - cursor->next))
+    {
+      return false;
+    }
+    event->text.text = (const char *) cursor->next;
+    event->text.len = (size_t) value;
+    cursor->next += value;
+    return *window_id != 0;
+  case CWIN_EVENT_TIMER:
+    if (!log_get_varint(cursor, &value))
+    {
+      return false;
+    }
+    event->timer.expirations = value;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* Runs on the recorder's thread. */
+void record_write(void *arg)
+{
+  struct recorder *recorder = arg;
+  unsigned written = 0;
+  for (;;)
+  {
+    unsigned filled = atomic_load_explicit(&recorder->filled,
+                                           memory_order_acquire);
+    if (written == filled)
+    {
+      cwin_plat_wait_on_address(&recorder->filled, filled);
+      continue;
+    }
+
+    size_t index = written % RECORD_CHUNKS;
+    size_t len = recorder->lens[index];
+    if (len == RECORD_END)
+    {
+      return;
+    }
+
+    if (fwrite(&recorder->chunks[index * recorder->chunk_size], 1, len,
+               recorder->file) != len)
+    {
+      recorder->failed = true;
+    }
+
+    written++;
+    atomic_store_explicit(&recorder->written, written, memory_order_release);
+    cwin_plat_wake_address(&recorder->written);
+  }
+}
+
+/* Hands the chunk being filled to the writer, and waits for the next one to
+   be free. */
+void record_hand_off(struct recorder *recorder)
+{
+  unsigned filled = atomic_load_explicit(&recorder->filled,
+                                         memory_order_relaxed);
+  recorder->lens[filled % RECORD_CHUNKS] = recorder->used;
+  atomic_store_explicit(&recorder->filled, filled + 1, memory_order_release);
+  cwin_plat_wake_address(&recorder->filled);
+  recorder->used = 0;
+
+  unsigned written;
+  while (filled + 1 - (written = atomic_load_explicit(
+                         &recorder->written, memory_order_acquire)) >=
+         RECORD_CHUNKS)
+  {
+    cwin_plat_wait_on_address(&recorder->written, written);
+  }
+}
+
+void record_events(struct recorder *recorder, const struct cwin_event *events,
+                   size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    const struct cwin_event *event = &events[i];
+
+    /* The window may have been destroyed since the event was queued. Replay
+       couldn't deliver such an event anyway, so it isn't recorded. */
+    struct cwin_window *window = event_window(event);
+    if (window != NULL &&
+        window_map_find(&live_windows, (uintptr_t) window) == NULL)
+    {
+      continue;
+    }
+
+    size_t text_len = event->t == CWIN_EVENT_TEXT ? event->text.len : 0;
+    if (recorder->used + RECORD_MAX_SIZE + text_len > recorder->chunk_size ||
+        (recorder->used > 0 &&
+         event->time_ns >= recorder->chunk_start_ns + RECORD_FLUSH_NS))
+    {
+      record_hand_off(recorder);
+    }
+    if (recorder->used == 0)
+    {
+      recorder->chunk_start_ns = event->time_ns;
+    }
+
+    uint32_t window_id = window != NULL ? window->id : 0;
+    size_t index = atomic_load_explicit(&recorder->filled,
+                                        memory_order_relaxed) % RECORD_CHUNKS;
+    uint8_t *start = &recorder->chunks[index * recorder->chunk_size +
+                                       recorder->used];
+    uint8_t *end = log_encode(&recorder->state, event, window_id, start);
+    recorder->used += end - start;
+  }
+}
+
+/* Moves the times of the next event by offset_ns. */
+void replay_shift(uint64_t offset_ns)
+{
+  replay.next.time_ns += offset_ns;
+  if (replay.next.t != CWIN_EVENT_WINDOW ||
+      replay.next.window.t != CWIN_WINDOW_EVENT_FRAME)
+  {
+    return;
+  }
+
+  /* 0 means unknown, and stays so. */
+  if (replay.next.window.presented_ns != 0)
+  {
+    replay.next.window.presented_ns += offset_ns;
+  }
+  if (replay.next.window.next_vblank_ns != 0)
+  {
+    replay.next.window.next_vblank_ns += offset_ns;
+  }
+}
+
+void replay_advance(void)
+{
+  replay.has_next = log_decode(&replay.cursor, &replay.next,
+                               &replay.next_window);
+  replay_shift(replay.offset_ns);
+}
+
+/* Queues the next event of the log, if its window exists. */
+void replay_deliver(void)
+{
+  struct cwin_event_queue *queue = replay.queue;
+  struct cwin_window *window = NULL;
+  if (replay.next_window != 0)
+  {
+    window = window_map_find(&window_ids, replay.next_window);
+    if (window == NULL)
+    {
+      return;
+    }
+  }
+
+  const char *text = replay.next.text.text;
+  size_t text_len = replay.next.text.len;
+  if (replay.next.t == CWIN_EVENT_TEXT &&
+      text_len >= queue->text_capacity - queue->text_used)
+  {
+    STAT_ADD(queue->stats.dropped[CWIN_EVENT_TEXT], 1);
+    return;
+  }
+
+  struct cwin_event *event = alloc_event(queue, replay.next.t);
+  if (event == NULL)
+  {
+    return;
+  }
+
+  *event = replay.next;
+  switch (event->t)
+  {
+  case CWIN_EVENT_WINDOW:
+    event->window.window = window;
+    break;
+  case CWIN_EVENT_MOUSE:
+    event->mouse.window = window;
+    break;
+  case CWIN_EVENT_KEY:
+    event->key.window = window;
+    break;
+  case CWIN_EVENT_TEXT: {
+    char *copy = &queue->text[queue->text_used];
+    memcpy(copy, text, text_len);
+    copy[text_len] = '\0';
+    queue->text_used += text_len + 1;
+    event->text.window = window;
+    event->text.text = copy;
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+/*
+ * Queues the events that are due, or in fast mode as many as fit in the ring
+ * without overflowing it.
+ */
+void replay_feed(void)
+{
+  struct cwin_event_queue *queue = replay.queue;
+  if (queue == NULL)
+  {
+    return;
+  }
+
+  uint64_t now = cwin_plat_now_ns();
+  replay.feeding = true;
+  while (replay.has_next)
+  {
+    if (replay.real_time ? replay.next.time_ns > now :
+        queue->spill != NULL || queue->tail - queue->head > queue->mask)
+    {
+      break;
+    }
+
+    replay_deliver();
+    replay_advance();
+  }
+  replay.feeding = false;
+
+  if (!replay.has_next)
+  {
+    cwin_stop_replay();
+  }
+  timer_update_platform();
+}
+
+/* PUBLIC FUNCTIONS */
+
+enum cwin_error cwin_create_event_queue(struct cwin_event_queue **out)
+{
+  struct cwin_event_queue_builder builder = {0};
+  return cwin_create_event_queue_ex(out, &builder);
+}
+
+enum cwin_error cwin_create_event_queue_ex(
+  struct cwin_event_queue **out, struct cwin_event_queue_builder *builder)
+{
+  struct cwin_event_queue *queue = CWIN_NEW(struct cwin_event_queue);
+  if (queue == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  size_t capacity = DEFAULT_EVENT_QUEUE_CAPACITY;
+  if (builder->capacity != 0)
+  {
+    capacity = 1;
+    while (capacity < builder->capacity)
+    {
+      capacity *= 2;
+    }
+  }
+
+  queue->mask = capacity - 1;
+  queue->head = queue->tail = 0;
+  queue->overflow = builder->overflow;
+  queue->spill = NULL;
+  queue->lent = 0;
+
+  size_t history_capacity = DEFAULT_MOUSE_HISTORY_CAPACITY;
+  if (builder->history_capacity != 0)
+  {
+    history_capacity = 1;
+    while (history_capacity < builder->history_capacity)
+    {
+      history_capacity *= 2;
+    }
+  }
+
+  queue->coalesce = builder->coalesce;
+  queue->event_mask = builder->event_mask != 0 ? builder->event_mask :
+    CWIN_EVENT_MASK_ALL;
+  queue->history = NULL;
+  queue->history_mask = history_capacity - 1;
+  queue->history_tail = 0;
+
+  size_t user_capacity = DEFAULT_USER_EVENT_CAPACITY;
+  if (builder->user_capacity != 0)
+  {
+    user_capacity = 1;
+    while (user_capacity < builder->user_capacity)
+    {
+      user_capacity *= 2;
+    }
+  }
+
+  queue->user_mask = user_capacity - 1;
+  queue->user_head = 0;
+  atomic_init(&queue->user_tail, 0);
+
+  queue->text_capacity = DEFAULT_TEXT_CAPACITY;
+  if (builder->text_capacity != 0)
+  {
+    queue->text_capacity = builder->text_capacity;
+  }
+  queue->text_used = 0;
+
+  queue->events = CWIN_ARR(struct cwin_event, capacity);
+  if (queue->events == NULL)
+  {
+    CWIN_FREE(struct cwin_event_queue, queue);
+    return CWIN_ERROR_OOM;
+  }
+
+  queue->user_slots = CWIN_ARR(struct cwin_user_slot, user_capacity);
+  if (queue->user_slots == NULL)
+  {
+    CWIN_FREE_ARR(struct cwin_event, capacity, queue->events);
+    CWIN_FREE(struct cwin_event_queue, queue);
+    return CWIN_ERROR_OOM;
+  }
+  for (size_t i = 0; i < user_capacity; i++)
+  {
+    atomic_init(&queue->user_slots[i].seq, i);
+  }
+
+  queue->text = CWIN_ARR(char, queue->text_capacity);
+  if (queue->text == NULL)
+  {
+    CWIN_FREE_ARR(struct cwin_user_slot, user_capacity, queue->user_slots);
+    CWIN_FREE_ARR(struct cwin_event, capacity, queue->events);
+    CWIN_FREE(struct cwin_event_queue, queue);
+    return CWIN_ERROR_OOM;
+  }
+
+  queue->memory = queue->peak_memory = 0;
+  track_queue_memory(queue, sizeof(struct cwin_event_queue) +
+                     capacity * sizeof(struct cwin_event) +
+                     user_capacity * sizeof(struct cwin_user_slot) +
+                     queue->text_capacity, 0);
+
+  *out = queue;
+  return CWIN_SUCCESS;
+}
+
+void cwin_destroy_event_queue(struct cwin_event_queue *queue)
+{
+  if (queue->recorder != NULL)
+  {
+    cwin_stop_recording(queue);
+  }
+  if (replay.queue == queue)
+  {
+    cwin_stop_replay();
+  }
+
+  if (queue->spill != NULL)
+  {
+    CWIN_FREE_ARR(struct cwin_event, queue->mask + 1, queue->spill);
+  }
+  if (queue->history != NULL)
+  {
+    CWIN_FREE_ARR(struct cwin_mouse_sample, queue->history_mask + 1,
+                  queue->history);
+  }
+  CWIN_FREE_ARR(char, queue->text_capacity, queue->text);
+  CWIN_FREE_ARR(struct cwin_user_slot, queue->user_mask + 1,
+                queue->user_slots);
+  CWIN_FREE_ARR(struct cwin_event, queue->mask + 1, queue->events);
+  CWIN_FREE(struct cwin_event_queue, queue);
+}
+
+enum cwin_error cwin_create_window(struct cwin_window **out,
+                                   struct cwin_window_builder *builder)
+{
+  enum cwin_error err;
+  struct cwin_window *window = CWIN_NEW(struct cwin_window);
+  if (window == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  window->queue = builder->queue;
+  if (window->queue == NULL)
+  {
+    window->queue = global_queue;
+  }
+  window->coalesce = builder->coalesce;
+  window->event_mask = builder->event_mask != 0 ? builder->event_mask :
+    CWIN_EVENT_MASK_ALL;
+  window->event_mask &= window->queue->event_mask;
+  window->id = next_window_id;
+  memset(&window->snapshot, 0, sizeof(window->snapshot));
+
+  err = window_map_insert(&window_ids, window->id, window);
+  if (err)
+  {
+    CWIN_FREE(struct cwin_window, window);
+    return err;
+  }
+  err = window_map_insert(&live_windows, (uintptr_t) window, window);
+  if (err)
+  {
+    window_map_remove(&window_ids, window->id);
+    CWIN_FREE(struct cwin_window, window);
+    return err;
+  }
+
+  err = cwin_plat_init_window(window, builder);
+  if (err)
+  {
+    window_map_remove(&window_ids, window->id);
+    window_map_remove(&live_windows, (uintptr_t) window);
+    CWIN_FREE(struct cwin_window, window);
+    return err;
+  }
+
+  publish_window_state(window);
+  next_window_id++;
+  *out = window;
+  return CWIN_SUCCESS;
+}
+
+void cwin_window_set_event_mask(struct cwin_window *window, uint32_t mask)
+{
+  mask &= window->queue->event_mask;
+  if (mask != window->event_mask)
+  {
+    window->event_mask = mask;
+    cwin_plat_set_event_mask(window);
+  }
+}
+
+void cwin_destroy_window(struct cwin_window *window)
+{
+  /* Nothing may be left to run on the window once it's gone. */
+  drain_commands();
+  cwin_framebuffer_deinit(window);
+  cwin_plat_deinit_window(window);
+  window_map_remove(&window_ids, window->id);
+  window_map_remove(&live_windows, (uintptr_t) window);
+  CWIN_FREE(struct cwin_window, window);
+}
+
+bool cwin_poll_event(struct cwin_event_queue *queue, struct cwin_event *event)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  recycle_text(queue);
+  drain_user_events(queue);
+  if (pop_event(queue, event))
+  {
+    return true;
+  }
+
+  pump_events();
+  return pop_event(queue, event);
+}
+
+bool cwin_wait_event(struct cwin_event_queue *queue, struct cwin_event *event,
+                     uint64_t timeout_ns)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  recycle_text(queue);
+  drain_user_events(queue);
+  if (pop_event(queue, event))
+  {
+    return true;
+  }
+
+  pump_events();
+  if (pop_event(queue, event))
+  {
+    return true;
+  }
+
+  uint64_t deadline = CWIN_WAIT_FOREVER;
+  if (timeout_ns != CWIN_WAIT_FOREVER)
+  {
+    deadline = cwin_plat_now_ns() + timeout_ns;
+    if (deadline < timeout_ns)
+    {
+      deadline = CWIN_WAIT_FOREVER;
+    }
+  }
+
+  /*
+   * Input for other queues also wakes us up, so keep waiting until this queue
+   * gets something or the deadline passes.
+   */
+  for (;;)
+  {
+    uint64_t remaining = CWIN_WAIT_FOREVER;
+    if (deadline != CWIN_WAIT_FOREVER)
+    {
+      uint64_t now = cwin_plat_now_ns();
+      if (now >= deadline)
+      {
+        return false;
+      }
+      remaining = deadline - now;
+    }
+
+    /*
+     * Announce the wait before the last check for user events and commands,
+     * so a post either lands in time to be seen here or sees the flag and
+     * wakes us up. The fences order the flag against the slot sequence
+     * numbers on both sides.
+     */
+    atomic_store_explicit(&event_thread_waiting, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!user_events_pending(queue) && !commands_pending())
+    {
+      wait_events(remaining);
+    }
+    atomic_store_explicit(&event_thread_waiting, false, memory_order_relaxed);
+
+    drain_user_events(queue);
+    if (pop_event(queue, event))
+    {
+      return true;
+    }
+  }
+}
+
+size_t cwin_poll_events(struct cwin_event_queue *queue,
+                        struct cwin_event *events, size_t capacity)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  recycle_text(queue);
+  pump_events();
+  drain_user_events(queue);
+  return pop_events(queue, events, capacity);
+}
+
+size_t cwin_borrow_events(struct cwin_event_queue *queue,
+                          const struct cwin_event **events)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  struct cwin_event *front;
+  recycle_text(queue);
+  pump_events();
+  drain_user_events(queue);
+  queue->lent = front_events(queue, &front);
+  *events = front;
+  return queue->lent;
+}
+
+size_t cwin_get_mouse_history(struct cwin_event_queue *queue,
+                              const struct cwin_event *event,
+                              struct cwin_mouse_sample *samples,
+                              size_t capacity)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  if (event->t != CWIN_EVENT_MOUSE || event->mouse.t != CWIN_MOUSE_EVENT_MOVE ||
+      event->mouse.coalesced == 0 || queue->history == NULL)
+  {
+    return 0;
+  }
+
+  /* Skip the samples that have been overwritten since. */
+  size_t first = event->mouse.history;
+  size_t count = event->mouse.coalesced;
+  size_t age = queue->history_tail - first;
+  if (age > queue->history_mask + 1)
+  {
+    size_t lost = age - (queue->history_mask + 1);
+    if (lost >= count)
+    {
+      return 0;
+    }
+    first += lost;
+    count -= lost;
+  }
+
+  if (count > capacity)
+  {
+    count = capacity;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    samples[i] = queue->history[(first + i) & queue->history_mask];
+  }
+
+  return count;
+}
+
+enum cwin_error cwin_post_user_event(struct cwin_event_queue *queue,
+                                     const struct cwin_user_event *payload)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  struct cwin_user_slot *slot;
+  size_t pos = atomic_load_explicit(&queue->user_tail, memory_order_relaxed);
+  for (;;)
+  {
+    slot = &queue->user_slots[pos & queue->user_mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t) (seq - pos);
+    if (diff == 0)
+    {
+      /* On failure pos is reloaded, and we retry with the new tail. */
+      if (atomic_compare_exchange_weak_explicit(&queue->user_tail, &pos,
+                                                pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        break;
+      }
+    } else if (diff < 0)
+    {
+      /* The slot from the previous lap hasn't been drained yet. */
+      return CWIN_ERROR_QUEUE_FULL;
+    } else
+    {
+      pos = atomic_load_explicit(&queue->user_tail, memory_order_relaxed);
+    }
+  }
+
+  slot->payload = *payload;
+  slot->time_ns = cwin_plat_now_ns();
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+  /* Pairs with the fence in cwin_wait_event. */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_exchange_explicit(&event_thread_waiting, false,
+                               memory_order_relaxed))
+  {
+    cwin_plat_wake();
+  }
+
+  return CWIN_SUCCESS;
+}
+
+void cwin_event_queue_get_memory(struct cwin_event_queue *queue,
+                                 size_t *current, size_t *peak)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  if (current != NULL)
+  {
+    *current = queue->memory;
+  }
+  if (peak != NULL)
+  {
+    *peak = queue->peak_memory;
+  }
+}
+
+void cwin_commit_events(struct cwin_event_queue *queue, size_t count)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  if (count > queue->lent)
+  {
+    count = queue->lent;
+  }
+
+  if (count != 0)
+  {
+    drop_front_events(queue, count);
+  }
+  queue->lent = 0;
+}
+
+enum cwin_error cwin_init(const struct cwin_allocator *custom_allocator)
+{
+  enum cwin_error err;
+
+  convert_init();
+
+  if (custom_allocator != NULL)
+  {
+    allocator = *custom_allocator;
+  } else
+  {
+    allocator.alloc = default_alloc;
+    allocator.realloc = default_realloc;
+    allocator.free = default_free;
+    allocator.user = NULL;
+  }
+
+  scratch.data = allocator.alloc(allocator.user, DEFAULT_SCRATCH_SIZE,
+                                 _Alignof(max_align_t));
+  if (scratch.data == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+  scratch.size = DEFAULT_SCRATCH_SIZE;
+
+  commands.slots = CWIN_ARR(struct command_slot, COMMAND_CAPACITY);
+  if (commands.slots == NULL)
+  {
+    mem_free(scratch.data, scratch.size);
+    return CWIN_ERROR_OOM;
+  }
+  for (size_t i = 0; i < COMMAND_CAPACITY; i++)
+  {
+    atomic_init(&commands.slots[i].seq, i);
+  }
+  commands.head = 0;
+  atomic_init(&commands.tail, 0);
+  atomic_init(&commands.drained, 0);
+
+  err = cwin_plat_init();
+  if (err)
+  {
+    CWIN_FREE_ARR(struct command_slot, COMMAND_CAPACITY, commands.slots);
+    mem_free(scratch.data, scratch.size);
+    return err;
+  }
+
+  err = cwin_create_event_queue(&global_queue);
+  if (err)
+  {
+    cwin_plat_deinit();
+    CWIN_FREE_ARR(struct command_slot, COMMAND_CAPACITY, commands.slots);
+    mem_free(scratch.data, scratch.size);
+    return err;
+  }
+
+  next_window_id = 1;
+  return CWIN_SUCCESS;
+}
+
+void cwin_deinit()
+{
+  /* Timers the application didn't destroy. */
+  while (timers.all != NULL)
+  {
+    struct cwin_timer *next = timers.all->next;
+    CWIN_FREE(struct cwin_timer, timers.all);
+    timers.all = next;
+  }
+  CWIN_FREE_ARR(struct cwin_timer *, timers.capacity, timers.heap);
+  memset(&timers, 0, sizeof(timers));
+  cwin_plat_deinit();
+  cwin_destroy_event_queue(global_queue);
+  window_map_free(&window_ids);
+  window_map_free(&live_windows);
+  CWIN_FREE_ARR(struct command_slot, COMMAND_CAPACITY, commands.slots);
+  commands.slots = NULL;
+  mem_free(scratch.data, scratch.size);
+  memset(&scratch, 0, sizeof(scratch));
+}
+
+int cwin_get_event_fd(void)
+{
+  return cwin_plat_get_event_fd();
+}
+
+enum cwin_error cwin_dispatch_pending(void)
+{
+  /*
+   * The application sleeps in its own loop from now until the next call, so
+   * stay armed for posts the whole time. Arming before clearing the wakeup
+   * means a post can't slip in between without signalling the fd again.
+   */
+  atomic_store_explicit(&event_thread_waiting, true, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  cwin_plat_clear_wake();
+
+  return pump_events();
+}
+
+enum cwin_error cwin_create_timer(struct cwin_timer **out,
+                                  struct cwin_event_queue *queue,
+                                  uint64_t interval_ns, bool oneshot)
+{
+  if (timers.count == timers.capacity)
+  {
+    size_t capacity = timers.capacity == 0 ? 16 : timers.capacity * 2;
+    struct cwin_timer **heap = CWIN_REALLOC(struct cwin_timer *,
+                                            timers.capacity, capacity,
+                                            timers.heap);
+    if (heap == NULL)
+    {
+      return CWIN_ERROR_OOM;
+    }
+    timers.heap = heap;
+    timers.capacity = capacity;
+  }
+
+  struct cwin_timer *timer = CWIN_NEW(struct cwin_timer);
+  if (timer == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  timer->queue = queue != NULL ? queue : global_queue;
+  /* A zero interval would never move the deadline forward. */
+  timer->interval_ns = interval_ns != 0 ? interval_ns : 1;
+  timer->oneshot = oneshot;
+  timer->heap_index = TIMER_DISARMED;
+  timer->prev = NULL;
+  timer->next = timers.all;
+  if (timers.all != NULL)
+  {
+    timers.all->prev = timer;
+  }
+  timers.all = timer;
+  timers.count++;
+
+  cwin_timer_restart(timer);
+  *out = timer;
+  return CWIN_SUCCESS;
+}
+
+void cwin_timer_restart(struct cwin_timer *timer)
+{
+  uint64_t old_deadline = timer->deadline_ns;
+  timer->deadline_ns = cwin_plat_now_ns() + timer->interval_ns;
+  if (timer->heap_index == TIMER_DISARMED)
+  {
+    timer_insert(timer);
+  } else if (timer->deadline_ns < old_deadline)
+  {
+    timer_sift_up(timer->heap_index);
+  } else
+  {
+    timer_sift_down(timer->heap_index);
+  }
+
+  timer_update_platform();
+}
+
+void cwin_destroy_timer(struct cwin_timer *timer)
+{
+  if (timer->heap_index != TIMER_DISARMED)
+  {
+    timer_remove(timer);
+    timer_update_platform();
+  }
+
+  if (timer->prev != NULL)
+  {
+    timer->prev->next = timer->next;
+  } else
+  {
+    timers.all = timer->next;
+  }
+  if (timer->next != NULL)
+  {
+    timer->next->prev = timer->prev;
+  }
+  timers.count--;
+  CWIN_FREE(struct cwin_timer, timer);
+}
+
+enum cwin_error cwin_start_recording(struct cwin_event_queue *queue,
+                                     const char *path)
+{
+  enum cwin_error err;
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  struct recorder *recorder = CWIN_NEW(struct recorder);
+  if (recorder == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  /* A text event has to fit in one chunk. */
+  recorder->chunk_size = RECORD_CHUNK_SIZE;
+  if (queue->text_capacity + RECORD_MAX_SIZE > recorder->chunk_size)
+  {
+    recorder->chunk_size = queue->text_capacity + RECORD_MAX_SIZE;
+  }
+  recorder->chunks = CWIN_ARR(uint8_t, RECORD_CHUNKS * recorder->chunk_size);
+  if (recorder->chunks == NULL)
+  {
+    CWIN_FREE(struct recorder, recorder);
+    return CWIN_ERROR_OOM;
+  }
+
+  recorder->file = fopen(path, "wb");
+  if (recorder->file == NULL)
+  {
+    CWIN_FREE_ARR(uint8_t, RECORD_CHUNKS * recorder->chunk_size,
+                  recorder->chunks);
+    CWIN_FREE(struct recorder, recorder);
+    return CWIN_ERROR_IO;
+  }
+
+  memcpy(recorder->chunks, RECORD_MAGIC, RECORD_MAGIC_SIZE);
+  recorder->used = RECORD_MAGIC_SIZE;
+  recorder->chunk_start_ns = cwin_plat_now_ns();
+  memset(&recorder->state, 0, sizeof(recorder->state));
+  recorder->failed = false;
+  atomic_init(&recorder->filled, 0);
+  atomic_init(&recorder->written, 0);
+
+  recorder->thread.run = record_write;
+  recorder->thread.arg = recorder;
+  err = cwin_plat_start_thread(&recorder->thread);
+  if (err)
+  {
+    fclose(recorder->file);
+    CWIN_FREE_ARR(uint8_t, RECORD_CHUNKS * recorder->chunk_size,
+                  recorder->chunks);
+    CWIN_FREE(struct recorder, recorder);
+    return err;
+  }
+
+  queue->recorder = recorder;
+  return CWIN_SUCCESS;
+}
+
+enum cwin_error cwin_stop_recording(struct cwin_event_queue *queue)
+{
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+
+  struct recorder *recorder = queue->recorder;
+  queue->recorder = NULL;
+  if (recorder->used > 0)
+  {
+    record_hand_off(recorder);
+  }
+
+  /* record_hand_off left a free chunk for the end marker. */
+  unsigned filled = atomic_load_explicit(&recorder->filled,
+                                         memory_order_relaxed);
+  recorder->lens[filled % RECORD_CHUNKS] = RECORD_END;
+  atomic_store_explicit(&recorder->filled, filled + 1, memory_order_release);
+  cwin_plat_wake_address(&recorder->filled);
+  cwin_plat_join_thread(&recorder->thread);
 
-    break;
-  default:
-    return DefWindowProc(hwnd, umsg, wparam, lparam);
+  bool failed = recorder->failed;
+  if (fclose(recorder->file) != 0)
+  {
+    failed = true;
   }
+  CWIN_FREE_ARR(uint8_t, RECORD_CHUNKS * recorder->chunk_size,
+                recorder->chunks);
+  CWIN_FREE(struct recorder, recorder);
 
-  return 0;
+  return failed ? CWIN_ERROR_IO : CWIN_SUCCESS;
 }
 
-void cwin_mouse_capture(struct cwin_window *window)
+enum cwin_error cwin_start_replay(struct cwin_event_queue *queue,
+                                  const char *path,
+                                  enum cwin_replay_speed speed)
 {
-  SetCapture(window->plat.handle);
-}
+  if (queue == NULL)
+  {
+    queue = global_queue;
+  }
+  cwin_stop_replay();
 
-void cwin_mouse_uncapture(struct cwin_window *window)
-{
-  ReleaseCapture();
-}
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return CWIN_ERROR_IO;
+  }
 
-enum cwin_error utf8_to_wide_string(WCHAR **str_out, int *len_out,
-                                    const uint8_t *src, size_t src_len)
-{
-  int real_src_len = src_len == 0 ? -1 : src_len;
-  int len = MultiByteToWideChar(CP_UTF8, 0, src, real_src_len,
-                                 NULL, 0);
-  if (len == 0)
+  long size = -1;
+  if (fseek(file, 0, SEEK_END) == 0)
   {
-    return CWIN_ERROR_INVALID_UTF8;
+    size = ftell(file);
+  }
+  if (size < 0 || fseek(file, 0, SEEK_SET) != 0)
+  {
+    fclose(file);
+    return CWIN_ERROR_IO;
+  }
+  if (size < RECORD_MAGIC_SIZE)
+  {
+    fclose(file);
+    return CWIN_ERROR_INVALID_LOG;
   }
 
-  WCHAR *str = CWIN_ARR(WCHAR, len);
-  if (str == NULL)
+  uint8_t *log = CWIN_ARR(uint8_t, size);
+  if (log == NULL)
   {
+    fclose(file);
     return CWIN_ERROR_OOM;
   }
+  size_t len = fread(log, 1, size, file);
+  fclose(file);
+  if (len != (size_t) size)
+  {
+    CWIN_FREE_ARR(uint8_t, size, log);
+    return CWIN_ERROR_IO;
+  }
 
-  if (MultiByteToWideChar(CP_UTF8, 0, src, real_src_len, str, len) == 0)
+  /* Check the whole log first, so feeding it can't fail halfway. */
+  struct log_cursor check = {
+    .next = log + RECORD_MAGIC_SIZE,
+    .end = log + size,
+  };
+  struct cwin_event event;
+  uint64_t window_id;
+  bool valid = memcmp(log, RECORD_MAGIC, RECORD_MAGIC_SIZE) == 0;
+  while (valid && check.next != check.end)
   {
-    CWIN_FREE_ARR(WCHAR, len, str);
-    return CWIN_ERROR_INVALID_UTF8;
+    valid = log_decode(&check, &event, &window_id);
+  }
+  if (!valid)
+  {
+    CWIN_FREE_ARR(uint8_t, size, log);
+    return CWIN_ERROR_INVALID_LOG;
   }
 
-  *len_out = len;
-  *str_out = str;
+  replay.queue = queue;
+  replay.real_time = speed == CWIN_REPLAY_REAL_TIME;
+  replay.log = log;
+  replay.size = size;
+  memset(&replay.cursor, 0, sizeof(replay.cursor));
+  replay.cursor.next = log + RECORD_MAGIC_SIZE;
+  replay.cursor.end = log + size;
+  replay.offset_ns = 0;
+  replay_advance();
+  if (replay.has_next)
+  {
+    replay.offset_ns = cwin_plat_now_ns() - replay.next.time_ns;
+    replay_shift(replay.offset_ns);
+  }
+  queue->replaying = true;
 
+  replay_feed();
   return CWIN_SUCCESS;
 }
 
-#ifdef CWIN_VULKAN
+bool cwin_is_replaying(void)
+{
+  return replay.queue != NULL;
+}
 
-const char *win32_vk_extensions[] = {
-  "VK_KHR_surface",
-  "VK_KHR_win32_surface",
-};
+void cwin_stop_replay(void)
+{
+  if (replay.queue == NULL)
+  {
+    return;
+  }
 
-void cwin_vk_get_required_extensions(struct cwin_window *window,
-                                     const char **extensions,
-                                     int *extension_count)
+  replay.queue->replaying = false;
+  CWIN_FREE_ARR(uint8_t, replay.size, replay.log);
+  memset(&replay, 0, sizeof(replay));
+  timer_update_platform();
+}
+
+#ifdef CWIN_STATS
+
+void cwin_get_stats(struct cwin_stats *out)
 {
-  (void) window;
+  out->pumps = atomic_load_explicit(&stats.pumps, memory_order_relaxed);
+  out->pump_ns = atomic_load_explicit(&stats.pump_ns, memory_order_relaxed);
+  out->waits = atomic_load_explicit(&stats.waits, memory_order_relaxed);
+  out->wait_ns = atomic_load_explicit(&stats.wait_ns, memory_order_relaxed);
+  out->translate_ns = atomic_load_explicit(&stats.translate_ns,
+                                           memory_order_relaxed);
+}
 
-  if (*extension_count == 0 || extensions == NULL)
+void cwin_get_queue_stats(struct cwin_event_queue *queue,
+                          struct cwin_queue_stats *out)
+{
+  if (queue == NULL)
   {
-    *extension_count = sizeof(win32_vk_extensions) /
-      sizeof(win32_vk_extensions[0]);
-  } else
+    queue = global_queue;
+  }
+
+  for (int i = 0; i < CWIN_EVENT_TYPE_COUNT; i++)
   {
-    for (int i = 0; i < *extension_count; i++)
-    {
-      extensions[i] = win32_vk_extensions[i];
-    }
+    out->enqueued[i] = atomic_load_explicit(&queue->stats.enqueued[i],
+                                            memory_order_relaxed);
+    out->dropped[i] = atomic_load_explicit(&queue->stats.dropped[i],
+                                           memory_order_relaxed);
+    out->coalesced[i] = atomic_load_explicit(&queue->stats.coalesced[i],
+                                             memory_order_relaxed);
   }
+  out->high_water = atomic_load_explicit(&queue->stats.high_water,
+                                         memory_order_relaxed);
+  out->allocations = atomic_load_explicit(&queue->stats.allocations,
+                                          memory_order_relaxed);
 }
 
-enum cwin_error cwin_vk_create_surface(struct cwin_window *window,
-                                       VkInstance instance,
-                                       VkSurfaceKHR *surface)
+void cwin_set_trace_hooks(const struct cwin_trace_hooks *hooks)
 {
-  VkResult err;
-  VkWin32SurfaceCreateInfoKHR surface_create_info = {
-    .sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
-    .hwnd = window->plat.handle,
-    .hinstance = win32.instance,
-  };
-
-  err = vkCreateWin32SurfaceKHR(instance, &surface_create_info, NULL, surface);
-  if (err)
+  if (hooks != NULL)
   {
-    return CWIN_ERROR_VK_INTERNAL;
+    trace_hooks = *hooks;
+  } else
+  {
+    memset(&trace_hooks, 0, sizeof(trace_hooks));
   }
-
-  return CWIN_SUCCESS;
 }
 
 #endif
 
-#endif
+uint64_t cwin_now_ns(void)
+{
+  return cwin_plat_now_ns();
+}
 
-/* PRIVATE FUNCTIONS */
+void cwin_get_raw_window(struct cwin_window *window,
+                         struct cwin_raw_window *raw)
+{
+  cwin_plat_get_raw_window(window, raw);
+}
 
-struct cwin_event *alloc_event(struct cwin_event_queue *queue,
-                               enum cwin_event_type type)
+void cwin_window_get_state(struct cwin_window *window,
+                           struct cwin_window_state *state)
 {
-  if (queue->events_left + 1 > queue->events_alloc)
+  struct window_snapshot *snapshot = &window->snapshot;
+  unsigned seq;
+  uint32_t scale_bits;
+  for (;;)
   {
-    queue->events = CWIN_REALLOC(struct cwin_event, queue->events_alloc,
-                                 queue->events_alloc * 2, queue->events);
-    if (queue->events == NULL)
+    seq = atomic_load_explicit(&snapshot->seq, memory_order_acquire);
+    if (seq & 1)
     {
-      return NULL;
+      continue;
+    }
+
+    state->width = atomic_load_explicit(&snapshot->width,
+                                        memory_order_relaxed);
+    state->height = atomic_load_explicit(&snapshot->height,
+                                         memory_order_relaxed);
+    state->screen_width = atomic_load_explicit(&snapshot->screen_width,
+                                               memory_order_relaxed);
+    state->screen_height = atomic_load_explicit(&snapshot->screen_height,
+                                                memory_order_relaxed);
+    scale_bits = atomic_load_explicit(&snapshot->scale_bits,
+                                      memory_order_relaxed);
+    state->screen_state = (enum cwin_screen_state)
+      atomic_load_explicit(&snapshot->screen_state, memory_order_relaxed);
+
+    /* Keeps the fields from being loaded after seq is checked again. */
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&snapshot->seq, memory_order_relaxed) == seq)
+    {
+      break;
     }
-    queue->events_alloc *= 2;
   }
 
-  struct cwin_event *event = &queue->events[queue->events_left++];
-  event->t = type;
-  return event;
+  memcpy(&state->scale, &scale_bits, sizeof(state->scale));
 }
 
-struct cwin_event *alloc_window_event(struct cwin_event_queue *queue,
-                                      enum cwin_window_event_type type,
-                                      struct cwin_window *window)
+void cwin_window_get_size_pixels(struct cwin_window *window,
+                                 int *width, int *height)
 {
-  struct cwin_event *event = alloc_event(queue, CWIN_EVENT_WINDOW);
-  if (event == NULL)
+  struct cwin_window_state state;
+  cwin_window_get_state(window, &state);
+  if (width != NULL)
   {
-    return NULL;
+    *width = state.width;
+  }
+  if (height != NULL)
+  {
+    *height = state.height;
   }
-
-  event->window.window = window;
-  event->window.t = type;
-
-  return event;
 }
-struct cwin_event *alloc_mouse_event(struct cwin_event_queue *queue,
-                                      enum cwin_mouse_event_type type,
-                                      struct cwin_window *window)
+
+void cwin_window_get_size_screen_coordinates(struct cwin_window *window,
+                                             int *width, int *height)
 {
-  struct cwin_event *event = alloc_event(queue, CWIN_EVENT_MOUSE);
-  if (event == NULL)
+  struct cwin_window_state state;
+  cwin_window_get_state(window, &state);
+  if (width != NULL)
   {
-    return NULL;
+    *width = state.screen_width;
+  }
+  if (height != NULL)
+  {
+    *height = state.screen_height;
   }
-
-  event->mouse.window = window;
-  event->mouse.t = type;
-
-  return event;
 }
 
-/* PUBLIC FUNCTIONS */
+float cwin_window_get_scale(struct cwin_window *window)
+{
+  struct cwin_window_state state;
+  cwin_window_get_state(window, &state);
+  return state.scale;
+}
 
-enum cwin_error cwin_create_event_queue(struct cwin_event_queue **out)
+void cwin_window_set_screen_state(struct cwin_window *window,
+                                  enum cwin_screen_state state)
 {
-  struct cwin_event_queue *queue = CWIN_NEW(struct cwin_event_queue);
-  if (queue == NULL)
+  struct command command = {
+    .t = COMMAND_SCREEN_STATE,
+    .window = window,
+    .screen_state = state,
+  };
+  if (cwin_plat_is_event_thread())
   {
-    return CWIN_ERROR_OOM;
+    run_command(&command);
+  } else
+  {
+    push_command(&command);
   }
+}
 
-  queue->events_alloc = INIT_EVENT_QUEUE_EVENTS;
-  queue->events_left = 0;
-
-  queue->events = CWIN_ARR(struct cwin_event, queue->events_alloc);
-  if (queue->events == NULL)
+enum cwin_error cwin_window_set_fullscreen(
+  struct cwin_window *window, uint64_t monitor,
+  const struct cwin_monitor_mode *mode)
+{
+  if (cwin_plat_is_event_thread())
   {
-    CWIN_FREE(struct cwin_event_queue, queue);
-    return CWIN_ERROR_OOM;
+    enum cwin_error err = cwin_plat_set_fullscreen(window, monitor, mode);
+    publish_window_state(window);
+    return err;
   }
 
-  *out = queue;
+  struct command command = {
+    .t = COMMAND_FULLSCREEN,
+    .window = window,
+    .fullscreen.monitor = monitor,
+    .fullscreen.has_mode = mode != NULL,
+  };
+  if (mode != NULL)
+  {
+    command.fullscreen.mode = *mode;
+  }
+  push_command(&command);
   return CWIN_SUCCESS;
 }
 
-void cwin_destroy_event_queue(struct cwin_event_queue *queue)
+void cwin_window_set_maximum_size(struct cwin_window *window,
+                                  int max_width, int max_height)
 {
-  CWIN_FREE_ARR(struct cwin_event, queue->events_alloc, queue->events);
-  CWIN_FREE(struct cwin_event_queue, queue);
+  struct command command = {
+    .t = COMMAND_MAXIMUM_SIZE,
+    .window = window,
+    .size = { max_width, max_height },
+  };
+  if (cwin_plat_is_event_thread())
+  {
+    run_command(&command);
+  } else
+  {
+    push_command(&command);
+  }
 }
 
-enum cwin_error cwin_create_window(struct cwin_window **out,
-                                   struct cwin_window_builder *builder)
+void cwin_window_set_minimum_size(struct cwin_window *window,
+                                  int min_width, int min_height)
 {
-  enum cwin_error err;
-  struct cwin_window *window = CWIN_NEW(struct cwin_window);
-  if (window == NULL)
+  struct command command = {
+    .t = COMMAND_MINIMUM_SIZE,
+    .window = window,
+    .size = { min_width, min_height },
+  };
+  if (cwin_plat_is_event_thread())
   {
-    return CWIN_ERROR_OOM;
-  }
-
-  window->queue = builder->queue;
-  if (window->queue == NULL)
+    run_command(&command);
+  } else
   {
-    window->queue = global_queue;
+    push_command(&command);
   }
+}
 
-  err = cwin_plat_init_window(window, builder);
-  if (err)
+enum cwin_error cwin_framebuffer_init(struct cwin_window *window,
+                                      int buffer_count)
+{
+  if (buffer_count == 0)
   {
-    return err;
+    buffer_count = DEFAULT_FRAMEBUFFER_BUFFERS;
   }
+  buffer_count = buffer_count < 1 ? 1 : buffer_count;
+  buffer_count = buffer_count > MAX_FRAMEBUFFER_BUFFERS ?
+    MAX_FRAMEBUFFER_BUFFERS : buffer_count;
+
+  cwin_framebuffer_deinit(window);
+  window->framebuffer.buffer_count = buffer_count;
+  window->framebuffer.acquired = -1;
 
-  *out = window;
   return CWIN_SUCCESS;
 }
 
-void cwin_destroy_window(struct cwin_window *window)
+void cwin_framebuffer_deinit(struct cwin_window *window)
 {
-  cwin_plat_deinit_window(window);
-  CWIN_FREE(struct cwin_window, window);
+  framebuffer_destroy_buffers(window);
+  memset(&window->framebuffer, 0, sizeof(window->framebuffer));
 }
 
-bool cwin_poll_event(struct cwin_event_queue *queue, struct cwin_event *event)
+enum cwin_error cwin_framebuffer_acquire(struct cwin_window *window,
+                                         struct cwin_framebuffer *out)
 {
-  if (queue == NULL)
-  {
-    queue = global_queue;
-  }
+  enum cwin_error err;
+  struct framebuffer *framebuffer = &window->framebuffer;
 
-  if (queue->events_left == 0)
+  /* Buffers follow the window's size, and are recreated when it changes. */
+  int width, height;
+  cwin_window_get_size_pixels(window, &width, &height);
+  width = width < 1 ? 1 : width;
+  height = height < 1 ? 1 : height;
+  if (width != framebuffer->width || height != framebuffer->height)
   {
-    cwin_plat_pump_events();
+    framebuffer_destroy_buffers(window);
+    framebuffer->width = width;
+    framebuffer->height = height;
   }
 
-  if (queue->events_left == 0)
+  if (framebuffer->acquired == -1)
   {
-    return false;
+    err = framebuffer_pick_buffer(window, &framebuffer->acquired);
+    if (err)
+    {
+      return err;
+    }
   }
 
-  *event = queue->events[--queue->events_left];
-  return true;
+  struct framebuffer_buffer *buffer =
+    &framebuffer->buffers[framebuffer->acquired];
+  out->pixels = buffer->pixels;
+  out->width = framebuffer->width;
+  out->height = framebuffer->height;
+  out->stride = framebuffer->width;
+  out->age = buffer->presented == 0 ? 0 :
+    (int) (framebuffer->presents - buffer->presented + 1);
+
+  return CWIN_SUCCESS;
 }
 
-enum cwin_error cwin_init()
+enum cwin_error cwin_framebuffer_present(struct cwin_window *window,
+                                         const struct cwin_rect *damage,
+                                         size_t damage_count)
 {
   enum cwin_error err;
+  struct framebuffer *framebuffer = &window->framebuffer;
+  if (framebuffer->acquired == -1)
+  {
+    return CWIN_SUCCESS;
+  }
 
-  err = cwin_plat_init();
-  if (err)
+  struct cwin_rect whole = { 0, 0, framebuffer->width, framebuffer->height };
+  if (damage_count == 0)
   {
-    return err;
+    damage = &whole;
+    damage_count = 1;
   }
 
-  err = cwin_create_event_queue(&global_queue);
+  /* Clip the damage to the buffer, dropping what falls outside. */
+  struct cwin_rect *clipped =
+    scratch_reserve(damage_count * sizeof(struct cwin_rect));
+  if (clipped == NULL)
+  {
+    return CWIN_ERROR_OOM;
+  }
+
+  size_t clipped_count = 0;
+  for (size_t i = 0; i < damage_count; i++)
+  {
+    if (clip_rect(&damage[i], framebuffer->width, framebuffer->height,
+                  &clipped[clipped_count]))
+    {
+      clipped_count++;
+    }
+  }
+
+  int index = framebuffer->acquired;
+  framebuffer->acquired = -1;
+  if (clipped_count == 0)
+  {
+    return CWIN_SUCCESS;
+  }
+
+  err = cwin_plat_present_buffer(window, index, clipped, clipped_count);
   if (err)
   {
     return err;
   }
 
+  framebuffer->buffers[index].presented = ++framebuffer->presents;
   return CWIN_SUCCESS;
 }
 
-void cwin_deinit()
+enum cwin_error cwin_framebuffer_convert(struct cwin_framebuffer *framebuffer,
+                                         const void *src, size_t src_stride,
+                                         enum cwin_pixel_format format,
+                                         const struct cwin_rect *rects,
+                                         size_t rect_count)
 {
-  cwin_plat_deinit();
-  cwin_destroy_event_queue(global_queue);
-}
+  static const size_t pixel_sizes[PIXEL_FORMAT_COUNT] = {
+    [CWIN_PIXEL_FORMAT_RGBA8] = 4,
+    [CWIN_PIXEL_FORMAT_RGBA8_PREMULTIPLIED] = 4,
+    [CWIN_PIXEL_FORMAT_RGBA16F_PREMULTIPLIED] = 8,
+    [CWIN_PIXEL_FORMAT_RGB565] = 2,
+  };
 
-void cwin_get_raw_window(struct cwin_window *window,
-                         struct cwin_raw_window *raw)
-{
-  cwin_plat_get_raw_window(window, raw);
+  if ((unsigned) format >= PIXEL_FORMAT_COUNT)
+  {
+    return CWIN_ERROR_UNSUPPORTED;
+  }
+
+  struct cwin_rect whole = { 0, 0, framebuffer->width, framebuffer->height };
+  if (rect_count == 0)
+  {
+    rects = &whole;
+    rect_count = 1;
+  }
+
+  for (size_t i = 0; i < rect_count; i++)
+  {
+    struct cwin_rect rect;
+    if (!clip_rect(&rects[i], framebuffer->width, framebuffer->height, &rect))
+    {
+      continue;
+    }
+
+    const uint8_t *src_row = (const uint8_t *) src + rect.y * src_stride +
+      rect.x * pixel_sizes[format];
+    uint32_t *dst_row = framebuffer->pixels +
+      (size_t) rect.y * framebuffer->stride + rect.x;
+    for (int y = 0; y < rect.height; y++)
+    {
+      convert_rows[format](dst_row, src_row, rect.width);
+      src_row += src_stride;
+      dst_row += framebuffer->stride;
+    }
+  }
+  return CWIN_SUCCESS;
 }
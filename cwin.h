@@ -8,6 +8,8 @@
 #define CWIN_WINDOW_POS_UNDEFINED 0
 #define CWIN_WINDOW_SIZE_UNDEFINED 0
 
+#define CWIN_WAIT_FOREVER UINT64_MAX
+
 /* The only success case is CWIN_SUCCESS, which is 0, so you can simply check
    for failure with:
 
@@ -22,14 +24,88 @@ enum cwin_error {
   CWIN_SUCCESS = 0,
   CWIN_ERROR_OOM,
   CWIN_ERROR_INVALID_UTF8,
+  CWIN_ERROR_QUEUE_FULL,
+  CWIN_ERROR_UNSUPPORTED,
+  CWIN_ERROR_IO,
+  CWIN_ERROR_INVALID_LOG,
+  CWIN_ERROR_INVALID_MONITOR, /* Disconnected, or never existed. */
 
   CWIN_ERROR_WIN32_INTERNAL,
+  CWIN_ERROR_WL_INTERNAL,
+  CWIN_ERROR_X11_INTERNAL,
+  CWIN_ERROR_POSIX_INTERNAL,
   CWIN_ERROR_VK_INTERNAL,
 };
 
 struct cwin_event_queue;
 
+/* What an event queue does when an event arrives and the queue is full. */
+enum cwin_queue_overflow {
+  /* Spill into one extra segment of the same capacity, which is freed once
+     it has been drained. If that fills up too, the newest events are
+     dropped. */
+  CWIN_QUEUE_OVERFLOW_GROW,
+  /* Overwrite the oldest pending event. */
+  CWIN_QUEUE_OVERFLOW_DROP_OLDEST,
+  /* Discard the incoming event. */
+  CWIN_QUEUE_OVERFLOW_DROP_NEWEST,
+};
+
+/* Consecutive events of these kinds for the same window are merged into the
+   newest one while they are pending. */
+enum cwin_coalesce_flags {
+  /* The positions that were merged away are kept in a history, see
+     cwin_get_mouse_history. */
+  CWIN_COALESCE_MOUSE_MOVE = 1 << 0,
+  /* Only the final size is kept. */
+  CWIN_COALESCE_RESIZE = 1 << 1,
+};
+
+/* The events windows send, see cwin_window_set_event_mask. Frame and timer
+   events are only sent on request, so they can't be masked. */
+enum cwin_event_mask {
+  CWIN_EVENT_MASK_RESIZE = 1 << 0, /* Resize and scale changes. */
+  CWIN_EVENT_MASK_CLOSE = 1 << 1,
+  CWIN_EVENT_MASK_FOCUS = 1 << 2, /* Focus and unfocus. */
+  CWIN_EVENT_MASK_CROSSING = 1 << 3, /* Enter and exit. */
+  CWIN_EVENT_MASK_MOUSE_MOVE = 1 << 4,
+  CWIN_EVENT_MASK_MOUSE_BUTTON = 1 << 5,
+  CWIN_EVENT_MASK_MOUSE_WHEEL = 1 << 6,
+  CWIN_EVENT_MASK_MOUSE_RELATIVE = 1 << 7,
+  CWIN_EVENT_MASK_KEY = 1 << 8,
+  CWIN_EVENT_MASK_TEXT = 1 << 9,
+  CWIN_EVENT_MASK_ALL = (1 << 10) - 1,
+};
+
+struct cwin_event_queue_builder {
+  /* The number of events the queue can hold, rounded up to a power of two.
+     If 0, a default capacity is used. */
+  size_t capacity;
+  enum cwin_queue_overflow overflow;
+
+  /* A combination of enum cwin_coalesce_flags, applied to every window that
+     uses this queue. */
+  uint32_t coalesce;
+  /* The number of coalesced mouse positions remembered, rounded up to a power
+     of two. If 0, a default capacity is used. */
+  size_t history_capacity;
+
+  /* The number of user events that can be posted before the event thread
+     retrieves them, rounded up to a power of two. If 0, a default capacity
+     is used. */
+  size_t user_capacity;
+
+  /* The bytes of text the pending text events can hold. If 0, a default
+     size is used. */
+  size_t text_capacity;
+
+  /* A combination of enum cwin_event_mask, the events any window using this
+     queue may send. If 0, all of them. */
+  uint32_t event_mask;
+};
+
 struct cwin_window;
+struct cwin_timer;
 
 struct cwin_window_builder {
   /* A UTF-8 string containing the requested name. If name_len is 0, it is
@@ -38,16 +114,28 @@ struct cwin_window_builder {
   size_t name_len;
   /* If 0, they will be placed at an undefined location. */
   int x, y;
-  /* If 0, the height is undefined. */
+  /* In screen coordinates. If 0, the height is undefined. */
   int width, height;
 
   /* If NULL, the default queue is used. */
   struct cwin_event_queue *queue;
+
+  /* A combination of enum cwin_coalesce_flags, in addition to the ones set on
+     the queue. */
+  uint32_t coalesce;
+
+  /* A combination of enum cwin_event_mask, the events the window sends,
+     further limited by the queue's mask. If 0, all of them. */
+  uint32_t event_mask;
 };
 
 enum cwin_event_type {
   CWIN_EVENT_WINDOW,
   CWIN_EVENT_MOUSE,
+  CWIN_EVENT_USER,
+  CWIN_EVENT_KEY,
+  CWIN_EVENT_TEXT,
+  CWIN_EVENT_TIMER,
 };
 
 enum cwin_window_event_type {
@@ -57,18 +145,41 @@ enum cwin_window_event_type {
   CWIN_WINDOW_EVENT_UNFOCUS,
   CWIN_WINDOW_EVENT_ENTER,
   CWIN_WINDOW_EVENT_EXIT,
+  /* See cwin_window_request_frame. */
+  CWIN_WINDOW_EVENT_FRAME,
+  /* The window's scale changed, usually because it moved to another monitor.
+     If the pixel size changes with it, a resize follows. A Vulkan swapchain
+     has to be recreated for the new pixel size before presenting again,
+     since on Wayland the new scale applies to the next present. */
+  CWIN_WINDOW_EVENT_SCALE_CHANGED,
 };
 
 struct cwin_window_event {
   enum cwin_window_event_type t;
   struct cwin_window *window;
-  int width, height;
+  union {
+    /* The new size in pixels. */
+    struct {
+      int width, height;
+    };
+    float scale; /* See cwin_window_get_scale. */
+    /* On the cwin_now_ns clock, or 0 where the platform doesn't say. */
+    struct {
+      /* When the window's last presented frame reached the screen. */
+      uint64_t presented_ns;
+      /* When the display is predicted to start showing the next frame. */
+      uint64_t next_vblank_ns;
+      uint64_t refresh_ns; /* The display's refresh period. */
+    };
+  };
 };
 
 enum cwin_mouse_event_type {
   CWIN_MOUSE_EVENT_MOVE,
   CWIN_MOUSE_EVENT_BUTTON,
   CWIN_MOUSE_EVENT_WHEEL,
+  /* Motion in relative mode, see cwin_mouse_set_relative. */
+  CWIN_MOUSE_EVENT_RELATIVE,
 };
 
 enum cwin_button_state {
@@ -87,7 +198,10 @@ struct cwin_mouse_event {
   struct cwin_window *window; /* The window with mouse focus. */
   union {
     struct {
-      int x, y;
+      int x, y; /* In pixels, from the top left of the window. */
+      /* The number of earlier positions merged into this event. */
+      size_t coalesced;
+      size_t history; /* Internal. */
     };
     struct {
       enum cwin_button_state state;
@@ -96,19 +210,135 @@ struct cwin_mouse_event {
     struct {
       int delta;
     };
+    struct {
+      /* Unaccelerated, in the mouse's own units. */
+      float dx, dy;
+    };
   };
 };
 
+/* Passed through untouched from cwin_post_user_event. */
+struct cwin_user_event {
+  uint32_t code;
+  void *data;
+};
+
+enum cwin_modifiers {
+  CWIN_MOD_SHIFT = 1 << 0,
+  CWIN_MOD_CTRL = 1 << 1,
+  CWIN_MOD_ALT = 1 << 2,
+  CWIN_MOD_SUPER = 1 << 3,
+  CWIN_MOD_CAPS_LOCK = 1 << 4,
+  CWIN_MOD_NUM_LOCK = 1 << 5,
+};
+
+/* Keys that type a character in the current layout are identified by the
+   Unicode code point they type without modifiers, which is lowercase for
+   letters. The other keys are one of these. */
+enum cwin_key {
+  CWIN_KEY_UNKNOWN = 0,
+  CWIN_KEY_BACKSPACE = 0x08,
+  CWIN_KEY_TAB = 0x09,
+  CWIN_KEY_ENTER = 0x0d,
+  CWIN_KEY_ESCAPE = 0x1b,
+  CWIN_KEY_SPACE = 0x20,
+  CWIN_KEY_DELETE = 0x7f,
+
+  /* Past the end of Unicode. */
+  CWIN_KEY_F1 = 0x110000,
+  CWIN_KEY_F2,
+  CWIN_KEY_F3,
+  CWIN_KEY_F4,
+  CWIN_KEY_F5,
+  CWIN_KEY_F6,
+  CWIN_KEY_F7,
+  CWIN_KEY_F8,
+  CWIN_KEY_F9,
+  CWIN_KEY_F10,
+  CWIN_KEY_F11,
+  CWIN_KEY_F12,
+  CWIN_KEY_LEFT,
+  CWIN_KEY_RIGHT,
+  CWIN_KEY_UP,
+  CWIN_KEY_DOWN,
+  CWIN_KEY_HOME,
+  CWIN_KEY_END,
+  CWIN_KEY_PAGE_UP,
+  CWIN_KEY_PAGE_DOWN,
+  CWIN_KEY_INSERT,
+  CWIN_KEY_LEFT_SHIFT,
+  CWIN_KEY_RIGHT_SHIFT,
+  CWIN_KEY_LEFT_CTRL,
+  CWIN_KEY_RIGHT_CTRL,
+  CWIN_KEY_LEFT_ALT,
+  CWIN_KEY_RIGHT_ALT,
+  CWIN_KEY_LEFT_SUPER,
+  CWIN_KEY_RIGHT_SUPER,
+  CWIN_KEY_CAPS_LOCK,
+  CWIN_KEY_NUM_LOCK,
+  CWIN_KEY_SCROLL_LOCK,
+  CWIN_KEY_PRINT_SCREEN,
+  CWIN_KEY_PAUSE,
+  CWIN_KEY_MENU,
+};
+
+struct cwin_key_event {
+  struct cwin_window *window; /* The window with keyboard focus. */
+  enum cwin_button_state state;
+  /* The physical key, independent of the layout. These are evdev codes on
+     Linux, and set 1 scan codes with 0xe000 added for extended keys on
+     Win32. */
+  uint32_t scancode;
+  uint32_t key; /* enum cwin_key, or a code point. */
+  uint32_t modifiers; /* enum cwin_modifiers */
+  /* Set when the key is being held down and this press is a repeat. */
+  bool repeat;
+};
+
+/* Typed text, including text committed by an input method. Keys that don't
+   type anything, like backspace or ctrl + c, only send key events. */
+struct cwin_text_event {
+  struct cwin_window *window;
+  /* Null terminated UTF-8, stored in the queue. It stays valid until the next
+     call that retrieves events from the queue. */
+  const char *text;
+  size_t len;
+};
+
+struct cwin_timer_event {
+  struct cwin_timer *timer;
+  /* The intervals that have passed since the last event, more than 1 if
+     events weren't pumped in time. The event's time_ns is when the last of
+     them was due. */
+  uint64_t expirations;
+};
+
+struct cwin_mouse_sample {
+  int x, y;
+  uint64_t time_ns;
+};
+
 struct cwin_event {
   enum cwin_event_type t;
+  /* When the input happened according to the platform, on the cwin_now_ns
+     clock. Events the platform doesn't timestamp get the time they were
+     read. */
+  uint64_t time_ns;
   union {
     struct cwin_window_event window;
     struct cwin_mouse_event mouse;
+    struct cwin_user_event user;
+    struct cwin_key_event key;
+    struct cwin_text_event text;
+    struct cwin_timer_event timer;
   };
 };
 
 enum cwin_raw_window_type {
   CWIN_RAW_WINDOW_WIN32,
+  CWIN_RAW_WINDOW_WAYLAND,
+  CWIN_RAW_WINDOW_XCB,
+  CWIN_RAW_WINDOW_HEADLESS,
 };
 
 struct cwin_raw_window {
@@ -118,50 +348,486 @@ struct cwin_raw_window {
       void *hwnd;
       void *hinstance;
     } win32;
+    struct {
+      void *display; /* struct wl_display */
+      void *surface; /* struct wl_surface */
+    } wayland;
+    struct {
+      void *connection; /* xcb_connection_t */
+      uint32_t window; /* xcb_window_t */
+    } xcb;
   };
 };
 
+/* Pixels are 32 bits, 0xXXRRGGBB in native byte order, with the top byte
+   ignored. stride is the distance between rows in pixels. age is how many
+   presents ago the buffer's current contents were presented, so only what
+   changed in the last age frames has to be redrawn. 0 means the contents
+   are undefined. */
+struct cwin_framebuffer {
+  uint32_t *pixels;
+  int width, height;
+  int stride;
+  int age;
+};
+
+struct cwin_rect {
+  int x, y;
+  int width, height;
+};
+
+/* Pixel formats cwin_framebuffer_convert reads, with the channels in memory
+   order. RGBA16F is half floats, which are clamped to [0, 1]. */
+enum cwin_pixel_format {
+  CWIN_PIXEL_FORMAT_RGBA8,
+  CWIN_PIXEL_FORMAT_RGBA8_PREMULTIPLIED,
+  CWIN_PIXEL_FORMAT_RGBA16F_PREMULTIPLIED,
+  CWIN_PIXEL_FORMAT_RGB565, /* Native endian 16 bit pixels, opaque. */
+};
+
 enum cwin_screen_state {
+  /* Covers a monitor, possibly in another mode, see cwin_window_set_fullscreen.
+     The windowing system may show it without compositing. */
   CWIN_SCREEN_FULLSCREEN,
+  /* A borderless window covering the monitor it is on, which keeps the
+     desktop's mode. */
   CWIN_SCREEN_DESKTOP,
   CWIN_SCREEN_WINDOWED,
 };
 
-/* Initializes the library internals. */
-enum cwin_error cwin_init(void);
+struct cwin_monitor_mode {
+  int width, height; /* In pixels. */
+  /* In millihertz, or 0 where the platform doesn't say. */
+  uint32_t refresh_mhz;
+};
+
+struct cwin_window_state {
+  int width, height; /* In pixels. */
+  int screen_width, screen_height; /* In screen coordinates. */
+  float scale;
+  enum cwin_screen_state screen_state;
+};
+
+/* What a monitor looked like when cwin_get_monitors was called. */
+struct cwin_monitor {
+  /* Names the monitor to the other monitor functions while it stays
+     connected. Never 0. */
+  uint64_t id;
+  char name[64]; /* Null terminated UTF-8, cut short if needed. */
+  /* The monitor's area of the desktop. It is in pixels on Win32 and X11,
+     and in the compositor's logical coordinates on Wayland. */
+  int x, y, width, height;
+  int width_mm, height_mm; /* The physical size, 0 if unknown. */
+  /* What cwin_window_get_scale is on the monitor. Wayland only reports it
+     rounded up to an integer. */
+  float scale;
+  struct cwin_monitor_mode mode; /* The current mode. */
+  bool primary; /* Always false on Wayland, which has no primary monitor. */
+};
+
+/* Every allocation cwin makes goes through these, with sizes in bytes. align
+   is a power of two no greater than alignof(max_align_t). realloc and free
+   are given the size the memory was last allocated with. Memory allocated
+   by the platform's own libraries doesn't go through them. */
+struct cwin_allocator {
+  void *(*alloc)(void *user, size_t size, size_t align);
+  void *(*realloc)(void *user, void *ptr, size_t old_size, size_t new_size,
+                   size_t align);
+  void (*free)(void *user, void *ptr, size_t size);
+  void *user;
+};
+
+/* A monotonic clock in nanoseconds, the one event timestamps are on. */
+uint64_t cwin_now_ns(void);
+
+/* Initializes the library internals. If allocator is NULL, the C library's
+   malloc, realloc and free are used. The calling thread becomes the event
+   thread, and functions are only called from it unless they say
+   otherwise. */
+enum cwin_error cwin_init(const struct cwin_allocator *allocator);
 void cwin_deinit(void);
 
+/* Events are delivered in the order they arrived in. */
 enum cwin_error cwin_create_event_queue(struct cwin_event_queue **out);
+enum cwin_error cwin_create_event_queue_ex(
+  struct cwin_event_queue **out, struct cwin_event_queue_builder *builder);
 void cwin_destroy_event_queue(struct cwin_event_queue *queue);
 
 enum cwin_error cwin_create_window(struct cwin_window **out,
                                    struct cwin_window_builder *builder);
 
+/*
+ * Screen coordinates are the platform's DPI independent units, which window
+ * sizes are set in. Pixels are what is rendered: the pixel size is the size a
+ * framebuffer or swapchain needs to cover the window exactly. The scale is
+ * pixels per screen coordinate, and may be fractional.
+ *
+ * These read a snapshot the event thread updates whenever one of them
+ * changes, before queueing the event that reports it. They may be called
+ * from any thread while the window exists, and never make a system call or
+ * take a lock, so a render thread can size its swapchain every frame.
+ */
 void cwin_window_get_size_screen_coordinates(struct cwin_window *window,
                                              int *width, int *height);
 void cwin_window_get_size_pixels(struct cwin_window *window,
                                  int *width, int *height);
+float cwin_window_get_scale(struct cwin_window *window);
+/* All of the above at once, from the same snapshot. */
+void cwin_window_get_state(struct cwin_window *window,
+                           struct cwin_window_state *state);
+
+/* Sets the events the window sends, a combination of enum cwin_event_mask
+   limited by the queue's mask. Masked input is dropped before it is
+   translated, and where the platform allows it the window stops receiving it
+   at all. Events already queued are still delivered. */
+void cwin_window_set_event_mask(struct cwin_window *window, uint32_t mask);
 
 void cwin_mouse_capture(struct cwin_window *window);
 void cwin_mouse_uncapture(struct cwin_window *window);
 
+/* While relative, the cursor is hidden and held inside the window, and while
+   the window has the pointer, motion is sent as CWIN_MOUSE_EVENT_RELATIVE
+   events with every raw sample from the mouse instead of
+   CWIN_MOUSE_EVENT_MOVE. Returns CWIN_ERROR_UNSUPPORTED if the platform
+   can't do it. */
+enum cwin_error cwin_mouse_set_relative(struct cwin_window *window,
+                                        bool relative);
+
 void cwin_destroy_window(struct cwin_window *window);
 
 bool cwin_poll_event(struct cwin_event_queue *queue, struct cwin_event *event);
 
+/* Like cwin_poll_event, but sleeps until an event arrives for the queue or
+   timeout_ns nanoseconds have passed. Returns false on timeout. Pass
+   CWIN_WAIT_FOREVER to never time out. */
+bool cwin_wait_event(struct cwin_event_queue *queue, struct cwin_event *event,
+                     uint64_t timeout_ns);
+
+/* Pumps the platform once and copies up to capacity pending events into
+   events. Returns the number of events copied. */
+size_t cwin_poll_events(struct cwin_event_queue *queue,
+                        struct cwin_event *events, size_t capacity);
+
+/* Pumps the platform once and points events at the pending events stored in
+   the queue itself, returning how many there are. The span may not hold every
+   pending event, so borrow again after committing until it returns 0.
+
+   The span stays valid until cwin_commit_events, which removes the first count
+   events of it from the queue. No other function may retrieve events from the
+   queue in between. */
+size_t cwin_borrow_events(struct cwin_event_queue *queue,
+                          const struct cwin_event **events);
+void cwin_commit_events(struct cwin_event_queue *queue, size_t count);
+
+/* A file descriptor for integrating cwin into another event loop, or -1 on
+   Win32 and on failure. It becomes readable when there is platform input or a
+   posted user event, and only cwin_dispatch_pending makes it unreadable
+   again. Don't read from it or close it.
+
+   When it is readable, call cwin_dispatch_pending and then retrieve events
+   with cwin_poll_event until it returns false. Do that once before the first
+   sleep as well, since input may already have been read into memory. */
+int cwin_get_event_fd(void);
+
+/* Reads and translates whatever input is ready without blocking, and clears
+   the readiness of cwin_get_event_fd. */
+enum cwin_error cwin_dispatch_pending(void);
+
+/* Queues a CWIN_EVENT_USER event and wakes up cwin_wait_event if it is
+   sleeping. It may be called from any thread, as long as the queue outlives
+   the call. It never blocks, and returns CWIN_ERROR_QUEUE_FULL if the
+   queue's user events haven't been retrieved in time. The event is
+   timestamped when posted, and delivered after the events that were already
+   pending when it is retrieved. */
+enum cwin_error cwin_post_user_event(struct cwin_event_queue *queue,
+                                     const struct cwin_user_event *payload);
+
+/* Sends a CWIN_EVENT_TIMER event to queue every interval_ns nanoseconds,
+   starting interval_ns from now, or only once if oneshot. If queue is NULL,
+   the default queue is used. Timers fire while events are pumped, and waiting
+   for events, or on cwin_get_event_fd, wakes up for them. */
+enum cwin_error cwin_create_timer(struct cwin_timer **out,
+                                  struct cwin_event_queue *queue,
+                                  uint64_t interval_ns, bool oneshot);
+/* Starts the interval over from now, rearming a oneshot timer that fired. */
+void cwin_timer_restart(struct cwin_timer *timer);
+/* Events for the timer that are already queued are still delivered. */
+void cwin_destroy_timer(struct cwin_timer *timer);
+
+/* Writes every event delivered from queue to a log file at path, opened with
+   fopen, until cwin_stop_recording. If queue is NULL, the default queue is
+   used. The file is written on a background thread, and recording only
+   blocks if the thread falls a few hundred kilobytes behind. Pointers that
+   aren't windows, like user event data and timers, are recorded as NULL, and
+   coalesced mouse history isn't recorded. */
+enum cwin_error cwin_start_recording(struct cwin_event_queue *queue,
+                                     const char *path);
+/* Finishes writing the log, returning CWIN_ERROR_IO if any of it couldn't be
+   written. */
+enum cwin_error cwin_stop_recording(struct cwin_event_queue *queue);
+
+enum cwin_replay_speed {
+  /* Each event is delivered once the time since the first one has passed
+     that it had when it was recorded. */
+  CWIN_REPLAY_REAL_TIME,
+  /* Events are delivered as fast as they are retrieved, as many at once as
+     fit in the queue. */
+  CWIN_REPLAY_FAST,
+};
+
+/* Feeds a log written by cwin_start_recording into queue, instead of its live
+   events, which are dropped while replaying. If queue is NULL, the default
+   queue is used. Windows are identified by the order they were created in
+   since cwin_init, so create the same windows before replaying, and events
+   for windows that don't exist are skipped. Events keep their recorded
+   spacing, with the first one timestamped now. Only one log is replayed at a
+   time, starting another stops the current one. Returns
+   CWIN_ERROR_INVALID_LOG if the file isn't a complete log. */
+enum cwin_error cwin_start_replay(struct cwin_event_queue *queue,
+                                  const char *path,
+                                  enum cwin_replay_speed speed);
+/* Whether the log still has events to feed. The queue goes back to its live
+   events once it doesn't. */
+bool cwin_is_replaying(void);
+void cwin_stop_replay(void);
+
+/* The bytes the queue has allocated now, and the most it ever had allocated
+   at once. */
+void cwin_event_queue_get_memory(struct cwin_event_queue *queue,
+                                 size_t *current, size_t *peak);
+
+/* Copies the positions that were coalesced into a mouse move event, oldest
+   first, and returns how many were copied. Samples that have since been
+   overwritten in the queue's history are skipped. */
+size_t cwin_get_mouse_history(struct cwin_event_queue *queue,
+                              const struct cwin_event *event,
+                              struct cwin_mouse_sample *samples,
+                              size_t capacity);
+
 void cwin_get_raw_window(struct cwin_window *window,
                          struct cwin_raw_window *raw);
 
+/*
+ * Fullscreen uses the monitor the window is on, in its current mode.
+ *
+ * This, cwin_window_set_fullscreen and the size limit functions may be
+ * called from any thread while the window exists. Off the event thread the
+ * change is queued, and made the next time the event thread retrieves
+ * events. They only block if a few dozen changes are already waiting.
+ */
 void cwin_window_set_screen_state(struct cwin_window *window,
                                   enum cwin_screen_state state);
 
+/* If monitors is NULL, sets count to the number of monitors. Otherwise writes
+   up to count of them, and sets count to the number written. */
+enum cwin_error cwin_get_monitors(struct cwin_monitor *monitors, int *count);
+
+/* Lists the modes the monitor can be switched to, like cwin_get_monitors.
+   Wayland clients can't switch modes, so there it is only the current one. */
+enum cwin_error cwin_monitor_get_modes(uint64_t monitor,
+                                       struct cwin_monitor_mode *modes,
+                                       int *count);
+
+/*
+ * Makes the window fullscreen on a monitor, or the one it is on if monitor
+ * is 0. If mode is not NULL, the monitor switches to the listed mode of that
+ * size whose refresh rate is closest to mode's, or the highest one if it is
+ * 0. The desktop's mode comes back when the window leaves fullscreen, loses
+ * focus on Win32, or is destroyed. Returns CWIN_ERROR_UNSUPPORTED if the mode
+ * can't be set. Queued from other threads, where errors aren't reported.
+ */
+enum cwin_error cwin_window_set_fullscreen(
+  struct cwin_window *window, uint64_t monitor,
+  const struct cwin_monitor_mode *mode);
+
+/* In screen coordinates. */
 void cwin_window_set_maximum_size(struct cwin_window *window,
                                   int max_width, int max_height);
 void cwin_window_set_minimum_size(struct cwin_window *window,
                                   int min_width, int min_height);
+
+/* Asks for a single CWIN_WINDOW_EVENT_FRAME, sent when the windowing system
+   is ready for the window's next frame, which is when to start rendering it.
+   Request before presenting the current frame, since on Wayland the request
+   goes out with the next present. Requesting again before the event arrives
+   does nothing. */
+enum cwin_error cwin_window_request_frame(struct cwin_window *window);
+
+/* Gives the window CPU-written content that is shared with the windowing
+   system, so presenting copies nothing. Up to buffer_count buffers are
+   created as needed, one can be written while others are still on screen.
+   buffer_count is 2 or 3, if 0, 2 is used. The window's framebuffer is
+   released with the window. */
+enum cwin_error cwin_framebuffer_init(struct cwin_window *window,
+                                      int buffer_count);
+void cwin_framebuffer_deinit(struct cwin_window *window);
+
+/* Gets a buffer the size of the window, in pixels, to draw the next frame
+   into. It blocks if every buffer is still being read by the windowing
+   system. Acquiring again before presenting returns the same buffer. */
+enum cwin_error cwin_framebuffer_acquire(struct cwin_window *window,
+                                         struct cwin_framebuffer *framebuffer);
+
+/* Shows the acquired buffer. Only the damaged rectangles are sent to the
+   windowing system, or the whole buffer if damage_count is 0. */
+enum cwin_error cwin_framebuffer_present(struct cwin_window *window,
+                                         const struct cwin_rect *damage,
+                                         size_t damage_count);
+
+/* Converts the rectangles of an image the framebuffer's size into it, or the
+   whole image if rect_count is 0. src_stride is the distance between rows in
+   bytes. Colors are premultiplied by alpha, which goes in the top byte, so
+   translucent pixels are shown over black. The fastest kernels for the CPU
+   are picked by cwin_init. Returns CWIN_ERROR_UNSUPPORTED without converting
+   anything if format isn't one of the above. */
+enum cwin_error cwin_framebuffer_convert(struct cwin_framebuffer *framebuffer,
+                                         const void *src, size_t src_stride,
+                                         enum cwin_pixel_format format,
+                                         const struct cwin_rect *rects,
+                                         size_t rect_count);
+
+/* Built with the stats meson option. Without it, cwin doesn't count or time
+   anything. */
+#ifdef CWIN_STATS
+
+#define CWIN_EVENT_TYPE_COUNT (CWIN_EVENT_TIMER + 1)
+
+/* The arrays are indexed by enum cwin_event_type. */
+struct cwin_queue_stats {
+  uint64_t enqueued[CWIN_EVENT_TYPE_COUNT];
+  /* Lost to the overflow policy, or for text, to a full text buffer. */
+  uint64_t dropped[CWIN_EVENT_TYPE_COUNT];
+  /* Merged into a pending event instead of queued. */
+  uint64_t coalesced[CWIN_EVENT_TYPE_COUNT];
+  size_t high_water; /* The most events pending at once. */
+  /* Spill segments and mouse histories allocated after creation. */
+  uint64_t allocations;
+};
+
+struct cwin_stats {
+  /* Reading and translating input without sleeping. */
+  uint64_t pumps, pump_ns;
+  /* Sleeping for input, and the pump after it. */
+  uint64_t waits, wait_ns;
+  /* The part of pumping and waiting spent translating platform messages into
+     events. */
+  uint64_t translate_ns;
+};
+
+/* These read counters without locking, so they may be called from any thread,
+   but the fields aren't read at the same instant. The queue must outlive the
+   call. If queue is NULL, the default queue is read. */
+void cwin_get_stats(struct cwin_stats *stats);
+void cwin_get_queue_stats(struct cwin_event_queue *queue,
+                          struct cwin_queue_stats *stats);
+
+/* Called around cwin's own work, matching the zones of profilers like Tracy
+   and Perfetto. name is a static string, and zones nest. */
+struct cwin_trace_hooks {
+  void (*begin)(void *user, const char *name);
+  void (*end)(void *user);
+  void *user;
+};
+
+/* Pass NULL to remove the hooks. Call it from the event thread. */
+void cwin_set_trace_hooks(const struct cwin_trace_hooks *hooks);
+
+#endif
+
+#ifdef CWIN_BACKEND_HEADLESS
+
+/* The headless backend keeps windows in memory only. Its input is injected
+   as synthetic platform messages, which go through the same translation into
+   events as a real windowing system's messages. */
+
+enum cwin_headless_message_type {
+  CWIN_HEADLESS_MESSAGE_RESIZE,
+  CWIN_HEADLESS_MESSAGE_CLOSE,
+  CWIN_HEADLESS_MESSAGE_FOCUS,
+  CWIN_HEADLESS_MESSAGE_UNFOCUS,
+  CWIN_HEADLESS_MESSAGE_POINTER_ENTER,
+  CWIN_HEADLESS_MESSAGE_POINTER_LEAVE,
+  CWIN_HEADLESS_MESSAGE_POINTER_MOTION,
+  CWIN_HEADLESS_MESSAGE_POINTER_BUTTON,
+  CWIN_HEADLESS_MESSAGE_POINTER_WHEEL,
+  /* Only translated while the window is relative. */
+  CWIN_HEADLESS_MESSAGE_POINTER_RELATIVE,
+  /* Only translated while a frame is requested. */
+  CWIN_HEADLESS_MESSAGE_FRAME,
+  CWIN_HEADLESS_MESSAGE_KEY,
+  CWIN_HEADLESS_MESSAGE_TEXT,
+  /* Like moving to a monitor with another scale, the pixel size follows. */
+  CWIN_HEADLESS_MESSAGE_SCALE,
+};
+
+struct cwin_headless_message {
+  enum cwin_headless_message_type t;
+  struct cwin_window *window;
+  /* If 0, the time of injection. */
+  uint64_t time_ns;
+  union {
+    struct {
+      int width, height; /* In pixels. */
+    } resize;
+    struct {
+      int x, y;
+    } motion;
+    struct {
+      enum cwin_button_state state;
+      enum cwin_mouse_button button;
+    } button;
+    struct {
+      int delta;
+    } wheel;
+    struct {
+      float dx, dy;
+    } relative;
+    struct {
+      uint64_t presented_ns;
+      uint64_t vblank_ns; /* Any past vblank. */
+      uint64_t refresh_ns;
+    } frame;
+    struct {
+      enum cwin_button_state state;
+      uint32_t scancode;
+      uint32_t key;
+      uint32_t modifiers;
+      bool repeat;
+    } key;
+    struct {
+      /* Not copied, so it must stay valid until events are pumped. If len is
+         0, it is null terminated. */
+      const char *text;
+      size_t len;
+    } text;
+    struct {
+      float scale;
+    } scale;
+  };
+};
+
+/* Queues a message, which is translated the next time events are pumped. */
+enum cwin_error cwin_headless_inject(
+  const struct cwin_headless_message *message);
+
+/* What a compositor would show for the window: every presented damage
+   rectangle, copied out of the buffers as they were presented. The pixels
+   are NULL before the first present, and valid until the next one. age is
+   always 1. */
+void cwin_headless_read_framebuffer(struct cwin_window *window,
+                                    struct cwin_framebuffer *framebuffer);
+
+#endif
+
 #ifdef CWIN_VULKAN
 
+#if defined(CWIN_BACKEND_WIN32)
 #define VK_USE_PLATFORM_WIN32_KHR
+#elif defined(CWIN_BACKEND_WL)
+#define VK_USE_PLATFORM_WAYLAND_KHR
+#elif defined(CWIN_BACKEND_X11)
+#define VK_USE_PLATFORM_XCB_KHR
+#endif
 #include <vulkan/vulkan.h>
 
 void cwin_vk_get_required_extensions(struct cwin_window *window,
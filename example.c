@@ -1,6 +1,5 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <assert.h>
 
 #include "cwin.h"
 
@@ -13,7 +12,8 @@ int main()
   struct cwin_raw_window raw;
 
   bool running = true;
-  err = cwin_init();
+  bool relative = false;
+  err = cwin_init(NULL);
   if (err)
   {
     printf("error: %d\n", err);
@@ -42,7 +42,7 @@ int main()
   }
 
   cwin_get_raw_window(window, &raw);
-  assert(raw.t == CWIN_RAW_WINDOW_WIN32);
+  printf("Raw window type: %d\n", raw.t);
 
   int pwidth, pheight, scwidth, scheight;
   cwin_window_get_size_pixels(window, &pwidth, &pheight);
@@ -50,13 +50,28 @@ int main()
 
   cwin_window_get_size_screen_coordinates(window, &scwidth, &scheight);
   printf("Screen coordinate size: (%d, %d)\n", scwidth, scheight);
+  printf("Scale: %g\n", cwin_window_get_scale(window));
+
+  struct cwin_monitor monitors[8];
+  int monitor_count = 8;
+  if (cwin_get_monitors(monitors, &monitor_count) == CWIN_SUCCESS)
+  {
+    for (int i = 0; i < monitor_count; i++)
+    {
+      printf("Monitor %s: %dx%d at (%d, %d), %dx%d @ %.3f Hz%s\n",
+             monitors[i].name, monitors[i].width, monitors[i].height,
+             monitors[i].x, monitors[i].y, monitors[i].mode.width,
+             monitors[i].mode.height, monitors[i].mode.refresh_mhz / 1000.0,
+             monitors[i].primary ? ", primary" : "");
+    }
+  }
 
   cwin_window_set_minimum_size(window, 100, 100);
   cwin_window_set_maximum_size(window, 300, 300);
 
   while (running)
   {
-    while (cwin_poll_event(queue, &event))
+    if (cwin_wait_event(queue, &event, CWIN_WAIT_FOREVER))
     {
       switch (event.t)
       {
@@ -82,6 +97,13 @@ int main()
         case CWIN_WINDOW_EVENT_UNFOCUS:
           printf("Mouse unfocus\n");
           break;
+        case CWIN_WINDOW_EVENT_FRAME:
+          printf("Frame, next vblank at %llu ns\n",
+                 (unsigned long long) event.window.next_vblank_ns);
+          break;
+        case CWIN_WINDOW_EVENT_SCALE_CHANGED:
+          printf("Window scale: %g\n", event.window.scale);
+          break;
         }
         break;
       case CWIN_EVENT_MOUSE:
@@ -93,6 +115,9 @@ int main()
         case CWIN_MOUSE_EVENT_WHEEL:
           printf("Mouse wheel: %d\n", event.mouse.delta);
           break;
+        case CWIN_MOUSE_EVENT_RELATIVE:
+          printf("Mouse relative: (%g, %g)\n", event.mouse.dx, event.mouse.dy);
+          break;
         case CWIN_MOUSE_EVENT_BUTTON:
           if (event.mouse.state == CWIN_BUTTON_DOWN &&
               event.mouse.button == CWIN_MOUSE_BUTTON_LEFT)
@@ -104,12 +129,38 @@ int main()
           {
             cwin_window_set_screen_state(window, CWIN_SCREEN_WINDOWED);
           }
+          if (event.mouse.state == CWIN_BUTTON_DOWN &&
+              event.mouse.button == CWIN_MOUSE_BUTTON_MIDDLE)
+          {
+            relative = !relative;
+            err = cwin_mouse_set_relative(window, relative);
+            if (err)
+            {
+              printf("Relative mode error: %d\n", err);
+              relative = false;
+            }
+          }
           printf("Mouse %s: %d\n",
                  event.mouse.state == CWIN_BUTTON_DOWN ? "down" : "up",
                  event.mouse.button);
           break;
         }
 
+        break;
+      case CWIN_EVENT_KEY:
+        printf("Key %s: scancode %u, key %u, modifiers %u%s\n",
+               event.key.state == CWIN_BUTTON_DOWN ? "down" : "up",
+               event.key.scancode, event.key.key, event.key.modifiers,
+               event.key.repeat ? ", repeat" : "");
+        if (event.key.key == CWIN_KEY_ESCAPE)
+        {
+          running = false;
+        }
+        break;
+      case CWIN_EVENT_TEXT:
+        printf("Text: %s\n", event.text.text);
+        break;
+      default:
         break;
     }
     }